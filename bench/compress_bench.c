@@ -0,0 +1,186 @@
+#include "dns_server.h"
+#include "dns_records.h"
+#include "dns_parser.h"
+#include "dns_types.h"
+#include "dns_compress.h"
+#include <getopt.h>
+
+/*
+ * compares writing the answer section with its names expanded, as the
+ * server did before, against compressing them per response. each set is
+ * one rrset of a small zone; the response is built after header and
+ * question the way build_dns_response() does, so bytes per response and
+ * encode time per response cover only the answers being laid out.
+ */
+
+#define COMPRESS_BENCH_MAX_VALUES 8
+
+static int count = 10000000;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+typedef struct
+{
+    const char *label;
+    const char *qname;
+    unsigned short type;
+    const char *values[COMPRESS_BENCH_MAX_VALUES];
+} AnswerSet;
+
+static const AnswerSet sets[] = {
+    { "ns in zone", "example.com", DNS_TYPE_NS,
+      { "ns1.example.com", "ns2.example.com", "ns3.example.com", "ns4.example.com" } },
+    { "ns hosted", "example.com", DNS_TYPE_NS,
+      { "ns-1021.awsdns-63.net", "ns-1544.awsdns-01.co.uk", "ns-201.awsdns-25.com", "ns-862.awsdns-43.net" } },
+    { "mx", "example.com", DNS_TYPE_MX,
+      { "10 mx1.mail.example.com", "20 mx2.mail.example.com", "30 mx3.mail.example.com" } },
+    { "cname", "www.example.com", DNS_TYPE_CNAME, { "www.example.com.cdn.example.net" } },
+    { "a", "www.example.com", DNS_TYPE_A, { "192.0.2.1", "192.0.2.2", "192.0.2.3", "192.0.2.4" } },
+};
+
+typedef struct
+{
+    unsigned char answers[COMPRESS_BENCH_MAX_VALUES * (DNS_ANSWER_FIXED_SIZE + DNS_MAX_RDATA_SIZE)];
+    size_t answer_lens[COMPRESS_BENCH_MAX_VALUES];
+    int num_values;
+    int name_offset;
+    unsigned char query[sizeof(DNSHeader) + 260];
+    size_t query_len;
+} Response;
+
+/* the pre-encoded answers as a table load leaves them, and the header and question of a query */
+static void build_response(Response *response, const AnswerSet *set)
+{
+    const DNSTypeInfo *type_info = dns_type_info(set->type);
+    unsigned char *answer = response->answers;
+    
+    response->name_offset = type_info->name_offset;
+    response->num_values = 0;
+    for (int i = 0; i < COMPRESS_BENCH_MAX_VALUES && set->values[i] != NULL; i++) {
+        int rdata_len = type_info->encode(set->values[i], answer + DNS_ANSWER_FIXED_SIZE, DNS_MAX_RDATA_SIZE);
+        if (rdata_len < 0) {
+            exit(1);
+        }
+        
+        unsigned short type = htons(set->type);
+        unsigned short class = htons(1);
+        unsigned int ttl = htonl(DEFAULT_TTL);
+        unsigned short rdlength = htons(rdata_len);
+        memcpy(answer, &type, 2);
+        memcpy(answer + 2, &class, 2);
+        memcpy(answer + 4, &ttl, 4);
+        memcpy(answer + 8, &rdlength, 2);
+        
+        response->answer_lens[response->num_values++] = DNS_ANSWER_FIXED_SIZE + rdata_len;
+        answer += DNS_ANSWER_FIXED_SIZE + rdata_len;
+    }
+    
+    memset(response->query, 0, sizeof(DNSHeader));
+    int name_len = domainToDNSFormat(set->qname, response->query + sizeof(DNSHeader),
+                                     sizeof(response->query) - sizeof(DNSHeader) - 4);
+    if (name_len < 0) {
+        exit(1);
+    }
+    
+    unsigned short question[2] = { htons(set->type), htons(1) };
+    memcpy(response->query + sizeof(DNSHeader) + name_len, question, 4);
+    response->query_len = sizeof(DNSHeader) + name_len + 4;
+}
+
+/* the answer loop build_dns_response() had before, every name written out in full */
+static size_t write_expanded(const Response *response, unsigned char *out, size_t size)
+{
+    const unsigned char *answer = response->answers;
+    size_t offset = response->query_len;
+    
+    for (int i = 0; i < response->num_values; i++) {
+        size_t answer_len = response->answer_lens[i];
+        if (offset + 2 + answer_len > size) {
+            break;
+        }
+        
+        out[offset++] = 0xC0;
+        out[offset++] = sizeof(DNSHeader);
+        memcpy(out + offset, answer, answer_len);
+        offset += answer_len;
+        answer += answer_len;
+    }
+    return offset;
+}
+
+static size_t write_compressed(const Response *response, unsigned char *out, size_t size)
+{
+    const unsigned char *answer = response->answers;
+    size_t offset = response->query_len;
+    DNSCompressor compressor;
+    dns_compress_init(&compressor, out, sizeof(DNSHeader));
+    
+    for (int i = 0; i < response->num_values; i++) {
+        size_t end = offset + 2;
+        if (end > size || dns_compress_answer(&compressor, out, &end, size, answer, response->answer_lens[i],
+                                              response->name_offset) != 0) {
+            break;
+        }
+        
+        out[offset] = 0xC0;
+        out[offset + 1] = sizeof(DNSHeader);
+        offset = end;
+        answer += response->answer_lens[i];
+    }
+    return offset;
+}
+
+typedef size_t (*write_fn)(const Response *response, unsigned char *out, size_t size);
+
+static double time_writes(write_fn fn, const Response *response, unsigned char *out, size_t *len)
+{
+    unsigned long total = 0;
+    
+    long long start = now_ns();
+    for (int i = 0; i < count; i++) {
+        total += fn(response, out, DEFAULT_BUFFER_SIZE);
+    }
+    double ns = (double)(now_ns() - start) / count;
+    
+    *len = total / count;
+    return ns;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+        case 'n': count = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-n ITERATIONS]\n", argv[0]);
+            return 1;
+        }
+    }
+    
+    if (count < 1) {
+        return 1;
+    }
+    
+    static Response response;
+    unsigned char out[DEFAULT_BUFFER_SIZE];
+    
+    for (size_t i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+        build_response(&response, &sets[i]);
+        memcpy(out, response.query, response.query_len);
+        
+        size_t expanded_len, compressed_len;
+        double expanded_ns = time_writes(write_expanded, &response, out, &expanded_len);
+        double compressed_ns = time_writes(write_compressed, &response, out, &compressed_len);
+        
+        printf("%-10s %d answers   expanded %4zu bytes %6.1f ns   compressed %4zu bytes %6.1f ns\n",
+               sets[i].label, response.num_values, expanded_len, expanded_ns, compressed_len, compressed_ns);
+    }
+    
+    return 0;
+}
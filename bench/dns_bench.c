@@ -0,0 +1,249 @@
+#include "dns_server.h"
+#include "dns_parser.h"
+#include <getopt.h>
+#include <poll.h>
+
+/*
+ * closed-loop udp load generator. every thread owns a socket and keeps a
+ * fixed number of queries in flight, matching responses by transaction id,
+ * and reports throughput plus latency percentiles over all threads.
+ */
+
+#define BENCH_MAX_INFLIGHT 4096
+#define BENCH_TIMEOUT_NS 1000000000LL
+
+typedef struct
+{
+    int id;
+    pthread_t thread;
+    int sock;
+    
+    unsigned char query[DEFAULT_BUFFER_SIZE];
+    int query_len;
+    
+    long long sent_at[BENCH_MAX_INFLIGHT];
+    long long *latencies;
+    size_t latency_count;
+    size_t latency_capacity;
+    unsigned long long lost;
+} BenchThread;
+
+static struct sockaddr_in server_addr;
+static int inflight = 64;
+static int duration = 5;
+static const char *qname = "example.com";
+static unsigned short qtype = DNS_TYPE_A;
+static volatile int bench_running = 1;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int build_query(BenchThread *bt)
+{
+    DNSHeader header;
+    memset(&header, 0, sizeof(header));
+    header.rd = 1;
+    header.qdcount = htons(1);
+    
+    memcpy(bt->query, &header, sizeof(header));
+    
+    int name_len = domainToDNSFormat(qname, bt->query + sizeof(header), sizeof(bt->query) - sizeof(header) - 4);
+    if (name_len < 0) {
+        return -1;
+    }
+    
+    int offset = sizeof(header) + name_len;
+    unsigned short type = htons(qtype);
+    unsigned short qclass = htons(1);
+    memcpy(bt->query + offset, &type, 2);
+    memcpy(bt->query + offset + 2, &qclass, 2);
+    bt->query_len = offset + 4;
+    return 0;
+}
+
+static void send_query(BenchThread *bt, int slot)
+{
+    unsigned short id = htons((unsigned short)slot);
+    memcpy(bt->query, &id, sizeof(id));
+    
+    bt->sent_at[slot] = now_ns();
+    sendto(bt->sock, bt->query, bt->query_len, 0, (struct sockaddr *)&server_addr, sizeof(server_addr));
+}
+
+static void record_latency(BenchThread *bt, long long latency)
+{
+    if (bt->latency_count == bt->latency_capacity) {
+        size_t capacity = bt->latency_capacity ? bt->latency_capacity * 2 : 1 << 16;
+        long long *latencies = realloc(bt->latencies, capacity * sizeof(long long));
+        if (latencies == NULL) {
+            return;
+        }
+        bt->latencies = latencies;
+        bt->latency_capacity = capacity;
+    }
+    
+    bt->latencies[bt->latency_count++] = latency;
+}
+
+static void *bench_thread(void *arg)
+{
+    BenchThread *bt = (BenchThread *)arg;
+    unsigned char response[DEFAULT_BUFFER_SIZE];
+    
+    for (int slot = 0; slot < inflight; slot++) {
+        send_query(bt, slot);
+    }
+    
+    struct pollfd pfd = { .fd = bt->sock, .events = POLLIN };
+    
+    while (bench_running) {
+        int ready = poll(&pfd, 1, 10);
+        
+        if (ready > 0) {
+            ssize_t len;
+            while ((len = recv(bt->sock, response, sizeof(response), MSG_DONTWAIT)) >= (ssize_t)sizeof(DNSHeader)) {
+                unsigned short id;
+                memcpy(&id, response, sizeof(id));
+                int slot = ntohs(id);
+                
+                if (slot >= inflight || bt->sent_at[slot] == 0) {
+                    continue;
+                }
+                
+                record_latency(bt, now_ns() - bt->sent_at[slot]);
+                send_query(bt, slot);
+            }
+        }
+        
+        long long now = now_ns();
+        for (int slot = 0; slot < inflight; slot++) {
+            if (now - bt->sent_at[slot] > BENCH_TIMEOUT_NS) {
+                bt->lost++;
+                send_query(bt, slot);
+            }
+        }
+    }
+    
+    return NULL;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [OPTIONS]\n", prog);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -s SERVER    Server address (default: 127.0.0.1)\n");
+    fprintf(stderr, "  -p PORT      Server port (default: %d)\n", DEFAULT_DNS_PORT);
+    fprintf(stderr, "  -j THREADS   Client threads, each with its own socket (default: 1)\n");
+    fprintf(stderr, "  -c INFLIGHT  Outstanding queries per thread (default: 64, max: %d)\n", BENCH_MAX_INFLIGHT);
+    fprintf(stderr, "  -d SECONDS   Test duration (default: 5)\n");
+    fprintf(stderr, "  -q NAME      Query name (default: example.com)\n");
+    fprintf(stderr, "  -t TYPE      Query type code (default: 1)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *server = "127.0.0.1";
+    int port = DEFAULT_DNS_PORT;
+    int threads = 1;
+    int opt;
+    
+    while ((opt = getopt(argc, argv, "s:p:j:c:d:q:t:h")) != -1) {
+        switch (opt) {
+        case 's': server = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'j': threads = atoi(optarg); break;
+        case 'c': inflight = atoi(optarg); break;
+        case 'd': duration = atoi(optarg); break;
+        case 'q': qname = optarg; break;
+        case 't': qtype = (unsigned short)atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    if (threads < 1 || inflight < 1 || inflight > BENCH_MAX_INFLIGHT || duration < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, server, &server_addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid server address: %s\n", server);
+        return 1;
+    }
+    
+    BenchThread *bts = calloc(threads, sizeof(BenchThread));
+    if (bts == NULL) {
+        return 1;
+    }
+    
+    for (int i = 0; i < threads; i++) {
+        bts[i].id = i;
+        bts[i].sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if (bts[i].sock < 0 || build_query(&bts[i]) != 0) {
+            fprintf(stderr, "Failed to set up thread %d\n", i);
+            return 1;
+        }
+        
+        int rcvbuf = 1 << 22;
+        setsockopt(bts[i].sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    
+    long long start = now_ns();
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&bts[i].thread, NULL, bench_thread, &bts[i]);
+    }
+    
+    sleep(duration);
+    bench_running = 0;
+    
+    size_t total = 0;
+    unsigned long long lost = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(bts[i].thread, NULL);
+        total += bts[i].latency_count;
+        lost += bts[i].lost;
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+    
+    long long *all = malloc((total ? total : 1) * sizeof(long long));
+    if (all == NULL) {
+        return 1;
+    }
+    
+    size_t offset = 0;
+    for (int i = 0; i < threads; i++) {
+        memcpy(all + offset, bts[i].latencies, bts[i].latency_count * sizeof(long long));
+        offset += bts[i].latency_count;
+        free(bts[i].latencies);
+        close(bts[i].sock);
+    }
+    qsort(all, total, sizeof(long long), compare_latency);
+    
+    printf("queries: %zu in %.2fs, lost: %llu\n", total, elapsed, lost);
+    printf("qps: %.0f\n", total / elapsed);
+    if (total > 0) {
+        printf("latency us: p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+               all[total / 2] / 1e3, all[(size_t)(total * 0.99)] / 1e3,
+               all[(size_t)(total * 0.999)] / 1e3, all[total - 1] / 1e3);
+    }
+    
+    free(all);
+    free(bts);
+    return 0;
+}
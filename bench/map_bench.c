@@ -0,0 +1,229 @@
+#include "dns_records.h"
+#include "dns_phash.h"
+#include "uthash.h"
+#include <getopt.h>
+
+/*
+ * compares the record map against uthash, which held the records before
+ * on "<scope>_<domain>_<type>" strings, over a synthetic zone: the map is
+ * keyed on a record's domain, scope and type, uthash on the key string it
+ * used to be given. time to load every
+ * key, the slowest single insert of that load, lookup latency for hits and
+ * misses in random order, and the bytes each index adds per record on top
+ * of the records themselves.
+ */
+
+#define MAP_BENCH_QUERIES 1000000
+
+static int count = 1000000;
+
+typedef struct
+{
+    const char *key;
+    UT_hash_handle hh;
+} UTRecord;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* the map's hash is pluggable, fnv-1a stands in for a cheap byte at a time hash */
+static uint64_t fnv1a_hash(uint64_t seed, const char *key, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL ^ seed;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)key[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static char *make_domain(int i, const char *zone)
+{
+    char *domain;
+    if (asprintf(&domain, "h%d.z%d.%s", i, i % 1000, zone) < 0) {
+        exit(1);
+    }
+    return domain;
+}
+
+static char *make_key(const char *domain)
+{
+    char *key;
+    if (asprintf(&key, "base_%s_A", domain) < 0) {
+        exit(1);
+    }
+    return key;
+}
+
+/* a second load with every insert timed on its own, so the clock reads stay out of the load time */
+static long long map_worst_insert(dns_hash_fn hash, DNSRecord *records)
+{
+    DNSRecordMap map;
+    long long worst = 0;
+    record_map_init(&map, hash, 0x2545f4914f6cdd1dULL);
+    
+    for (int i = 0; i < count; i++) {
+        long long start = now_ns();
+        record_map_insert(&map, &records[i]);
+        long long elapsed = now_ns() - start;
+        worst = elapsed > worst ? elapsed : worst;
+    }
+    
+    record_map_free(&map);
+    return worst;
+}
+
+static long long uthash_worst_insert(char **keys)
+{
+    UTRecord *entries = calloc(count, sizeof(UTRecord));
+    UTRecord *table = NULL;
+    long long worst = 0;
+    
+    for (int i = 0; i < count; i++) {
+        entries[i].key = keys[i];
+        long long start = now_ns();
+        HASH_ADD_KEYPTR(hh, table, entries[i].key, strlen(entries[i].key), &entries[i]);
+        long long elapsed = now_ns() - start;
+        worst = elapsed > worst ? elapsed : worst;
+    }
+    
+    HASH_CLEAR(hh, table);
+    free(entries);
+    return worst;
+}
+
+static void run_map(const char *label, dns_hash_fn hash, DNSRecord *records, char **misses, const int *order)
+{
+    DNSRecordMap map;
+    record_map_init(&map, hash, 0x2545f4914f6cdd1dULL);
+    
+    long long start = now_ns();
+    for (int i = 0; i < count; i++) {
+        record_map_insert(&map, &records[i]);
+    }
+    long long load_ns = now_ns() - start;
+    long long worst_ns = map_worst_insert(hash, records);
+    
+    unsigned long found = 0;
+    start = now_ns();
+    for (int i = 0; i < MAP_BENCH_QUERIES; i++) {
+        const DNSRecord *record = &records[order[i]];
+        found += record_map_find(&map, record->text->domain, record->scope, record->type_code) != NULL;
+    }
+    long long hit_ns = now_ns() - start;
+    
+    start = now_ns();
+    for (int i = 0; i < MAP_BENCH_QUERIES; i++) {
+        found += record_map_find(&map, misses[order[i]], DNS_SCOPE_BASE, DNS_TYPE_A) != NULL;
+    }
+    long long miss_ns = now_ns() - start;
+    
+    double bytes = (double)map.capacity * (sizeof(DNSRecordSlot) + 1) / count;
+    
+    printf("%-16s load %7.1f ms   worst insert %8.1f us   hit %6.1f ns   miss %6.1f ns   %5.1f bytes/record   (%lu found)\n",
+           label, load_ns / 1e6, worst_ns / 1e3, (double)hit_ns / MAP_BENCH_QUERIES, (double)miss_ns / MAP_BENCH_QUERIES,
+           bytes, found);
+    
+    record_map_free(&map);
+}
+
+static void run_uthash(char **keys, char **misses, const int *order)
+{
+    UTRecord *entries = calloc(count, sizeof(UTRecord));
+    UTRecord *table = NULL;
+    UTRecord *entry;
+    
+    long long start = now_ns();
+    for (int i = 0; i < count; i++) {
+        entries[i].key = keys[i];
+        HASH_ADD_KEYPTR(hh, table, entries[i].key, strlen(entries[i].key), &entries[i]);
+    }
+    long long load_ns = now_ns() - start;
+    long long worst_ns = uthash_worst_insert(keys);
+    
+    unsigned long found = 0;
+    start = now_ns();
+    for (int i = 0; i < MAP_BENCH_QUERIES; i++) {
+        HASH_FIND_STR(table, keys[order[i]], entry);
+        found += entry != NULL;
+    }
+    long long hit_ns = now_ns() - start;
+    
+    start = now_ns();
+    for (int i = 0; i < MAP_BENCH_QUERIES; i++) {
+        HASH_FIND_STR(table, misses[order[i]], entry);
+        found += entry != NULL;
+    }
+    long long miss_ns = now_ns() - start;
+    
+    double bytes = sizeof(UT_hash_handle) +
+        ((double)table->hh.tbl->num_buckets * sizeof(UT_hash_bucket) + sizeof(UT_hash_table)) / count;
+    
+    printf("%-16s load %7.1f ms   worst insert %8.1f us   hit %6.1f ns   miss %6.1f ns   %5.1f bytes/record   (%lu found)\n",
+           "uthash", load_ns / 1e6, worst_ns / 1e3, (double)hit_ns / MAP_BENCH_QUERIES, (double)miss_ns / MAP_BENCH_QUERIES,
+           bytes, found);
+    
+    HASH_CLEAR(hh, table);
+    free(entries);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+        case 'n': count = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-n RECORDS]\n", argv[0]);
+            return 1;
+        }
+    }
+    
+    if (count < 1) {
+        return 1;
+    }
+    
+    DNSRecord *records = calloc(count, sizeof(DNSRecord));
+    DNSRecordText *texts = calloc(count, sizeof(DNSRecordText));
+    char **keys = malloc(count * sizeof(char *));
+    char **misses = malloc(count * sizeof(char *));
+    char **miss_keys = malloc(count * sizeof(char *));
+    int *order = malloc(MAP_BENCH_QUERIES * sizeof(int));
+    
+    for (int i = 0; i < count; i++) {
+        records[i].text = &texts[i];
+        records[i].text->domain = make_domain(i, "example.com");
+        records[i].type_code = DNS_TYPE_A;
+        records[i].scope = DNS_SCOPE_BASE;
+        keys[i] = make_key(records[i].text->domain);
+        misses[i] = make_domain(i, "example.org");
+        miss_keys[i] = make_key(misses[i]);
+    }
+    
+    srand(1);
+    for (int i = 0; i < MAP_BENCH_QUERIES; i++) {
+        order[i] = rand() % count;
+    }
+    
+    printf("%d records, %d lookups per set\n", count, MAP_BENCH_QUERIES);
+    run_uthash(keys, miss_keys, order);
+    run_map("map phash_hash", phash_hash, records, misses, order);
+    run_map("map fnv-1a", fnv1a_hash, records, misses, order);
+    
+    for (int i = 0; i < count; i++) {
+        free(records[i].text->domain);
+        free(keys[i]);
+        free(misses[i]);
+        free(miss_keys[i]);
+    }
+    free(records);
+    free(texts);
+    free(keys);
+    free(misses);
+    free(miss_keys);
+    free(order);
+    return 0;
+}
@@ -0,0 +1,239 @@
+#include "dns_records.h"
+#include "dns_name_tree.h"
+#include <getopt.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+/*
+ * compares name lookup in the reverse-label name tree against the previous
+ * hash key scheme, a record map probe per scope and wildcard suffix, on a
+ * synthetic zone. the zone has
+ * one A record per host spread over a number of zones, each zone also has
+ * a wildcard, and both indexes share the same record objects. where the
+ * kernel exposes a hardware cache miss counter, misses per lookup are
+ * reported next to the latency.
+ */
+
+#define NAME_BENCH_QUERIES 1000000
+
+static int hosts = 1000000;
+static int zones = 1000;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* last level cache misses of this thread, -1 if there is no such counter */
+static int open_cache_misses(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long read_cache_misses(int fd)
+{
+    long long count = 0;
+    if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count)) {
+        return -1;
+    }
+    return count;
+}
+
+static void format_misses(char *buf, size_t size, long long misses)
+{
+    if (misses < 0) {
+        snprintf(buf, size, "n/a");
+    } else {
+        snprintf(buf, size, "%.2f", (double)misses / NAME_BENCH_QUERIES);
+    }
+}
+
+static long rss_kb(void)
+{
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static DNSRecord *make_record(const char *domain, int scope)
+{
+    DNSRecord *record = calloc(1, sizeof(DNSRecord));
+    record->text = calloc(1, sizeof(DNSRecordText));
+    record->text->domain = strdup(domain);
+    record->type_code = DNS_TYPE_A;
+    record->scope = scope;
+    return record;
+}
+
+/* the lookup resolveRecord() did before the name tree, one map probe per scope and wildcard suffix */
+static const DNSRecord *key_lookup(const DNSRecordMap *records, const char *domain, unsigned short type)
+{
+    DNSRecord *record = record_map_find(records, domain, DNS_SCOPE_BASE, type);
+    if (record) {
+        return record;
+    }
+    
+    record = record_map_find(records, domain, DNS_SCOPE_SUBDOMAIN, type);
+    if (record) {
+        return record;
+    }
+    
+    char wildcard_domain[256];
+    wildcard_domain[0] = '*';
+    
+    for (const char *dot = strchr(domain, '.'); dot != NULL; dot = strchr(dot + 1, '.')) {
+        size_t suffix_len = strlen(dot);
+        if (suffix_len < 2 || suffix_len + 1 >= sizeof(wildcard_domain)) {
+            continue;
+        }
+        memcpy(wildcard_domain + 1, dot, suffix_len + 1);
+        
+        record = record_map_find(records, wildcard_domain, DNS_SCOPE_WILDCARD, type);
+        if (record) {
+            return record;
+        }
+    }
+    
+    return NULL;
+}
+
+typedef struct
+{
+    const char *label;
+    char (*names)[128];
+} QuerySet;
+
+static void run_set(const DNSRecordMap *records, DNSNameNode *tree, const QuerySet *set, int misses_fd)
+{
+    unsigned long found_key = 0, found_tree = 0;
+    char key_misses[16], tree_misses[16];
+    int scope;
+    
+    ioctl(misses_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(misses_fd, PERF_EVENT_IOC_ENABLE, 0);
+    long long start = now_ns();
+    for (int i = 0; i < NAME_BENCH_QUERIES; i++) {
+        found_key += key_lookup(records, set->names[i], DNS_TYPE_A) != NULL;
+    }
+    long long key_ns = now_ns() - start;
+    ioctl(misses_fd, PERF_EVENT_IOC_DISABLE, 0);
+    format_misses(key_misses, sizeof(key_misses), read_cache_misses(misses_fd));
+    
+    ioctl(misses_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(misses_fd, PERF_EVENT_IOC_ENABLE, 0);
+    start = now_ns();
+    for (int i = 0; i < NAME_BENCH_QUERIES; i++) {
+        found_tree += name_tree_lookup(tree, set->names[i], DNS_TYPE_A, &scope) != NULL;
+    }
+    long long tree_ns = now_ns() - start;
+    ioctl(misses_fd, PERF_EVENT_IOC_DISABLE, 0);
+    format_misses(tree_misses, sizeof(tree_misses), read_cache_misses(misses_fd));
+    
+    printf("%-10s key scheme %7.1f ns/lookup %5s misses   name tree %7.1f ns/lookup %5s misses   (%lu/%lu found)\n",
+           set->label, (double)key_ns / NAME_BENCH_QUERIES, key_misses, (double)tree_ns / NAME_BENCH_QUERIES,
+           tree_misses, found_key, found_tree);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "n:z:h")) != -1) {
+        switch (opt) {
+        case 'n': hosts = atoi(optarg); break;
+        case 'z': zones = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-n HOSTS] [-z ZONES]\n", argv[0]);
+            return 1;
+        }
+    }
+    
+    if (hosts < 1 || zones < 1) {
+        return 1;
+    }
+    
+    char name[128];
+    DNSRecord **all = malloc((size_t)(hosts + zones) * sizeof(DNSRecord *));
+    for (int i = 0; i < hosts; i++) {
+        snprintf(name, sizeof(name), "h%d.z%d.example.com", i, i % zones);
+        all[i] = make_record(name, DNS_SCOPE_BASE);
+    }
+    for (int z = 0; z < zones; z++) {
+        snprintf(name, sizeof(name), "*.z%d.example.com", z);
+        all[hosts + z] = make_record(name, DNS_SCOPE_WILDCARD);
+    }
+    
+    DNSRecordMap records;
+    record_map_init(&records, NULL, 0);
+    long rss = rss_kb();
+    long long start = now_ns();
+    for (int i = 0; i < hosts + zones; i++) {
+        record_map_insert(&records, all[i]);
+    }
+    long long key_build = now_ns() - start;
+    long key_rss = rss_kb() - rss;
+    
+    DNSArena arena;
+    arena_init(&arena);
+    rss = rss_kb();
+    start = now_ns();
+    DNSNameNode *tree = name_tree_create(&arena);
+    for (int i = 0; i < hosts + zones; i++) {
+        name_tree_insert(&arena, tree, all[i]);
+    }
+    long long tree_build = now_ns() - start;
+    long tree_rss = rss_kb() - rss;
+    
+    printf("%d names in %d zones\n", hosts + zones, zones);
+    printf("build      key scheme %7.1f ms, %ld KiB   name tree %7.1f ms, %ld KiB\n",
+           key_build / 1e6, key_rss, tree_build / 1e6, tree_rss);
+    
+    QuerySet sets[3] = {
+        { "exact", malloc(NAME_BENCH_QUERIES * sizeof(*sets[0].names)) },
+        { "wildcard", malloc(NAME_BENCH_QUERIES * sizeof(*sets[0].names)) },
+        { "miss", malloc(NAME_BENCH_QUERIES * sizeof(*sets[0].names)) },
+    };
+    
+    srand(1);
+    for (int i = 0; i < NAME_BENCH_QUERIES; i++) {
+        int host = rand() % hosts;
+        snprintf(sets[0].names[i], sizeof(sets[0].names[i]), "h%d.z%d.example.com", host, host % zones);
+        snprintf(sets[1].names[i], sizeof(sets[1].names[i]), "a.b.c.d.www%d.z%d.example.com", host, host % zones);
+        snprintf(sets[2].names[i], sizeof(sets[2].names[i]), "www.h%d.nope%d.org", host, host % zones);
+    }
+    
+    int misses_fd = open_cache_misses();
+    for (int i = 0; i < 3; i++) {
+        run_set(&records, tree, &sets[i], misses_fd);
+        free(sets[i].names);
+    }
+    if (misses_fd >= 0) {
+        close(misses_fd);
+    }
+    
+    arena_free(&arena);
+    record_map_free(&records);
+    for (int i = 0; i < hosts + zones; i++) {
+        free(all[i]->text->domain);
+        free(all[i]->text);
+        free(all[i]);
+    }
+    free(all);
+    return 0;
+}
@@ -0,0 +1,220 @@
+#include "dns_server.h"
+#include "dns_parser.h"
+#include <getopt.h>
+
+/*
+ * compares qname normalization on queries whose names carry 0x20 style
+ * random case. "copy" is the loop parseDNSQuery() had before names were
+ * lowercased, "scalar" lowercases and validates one byte at a time and
+ * "vector" is the loop parseDNSQuery() runs now. the full parseDNSQuery()
+ * is timed as well. the query set is small enough to stay in cache, so the
+ * loops are compared rather than memory latency.
+ */
+
+#define PARSE_BENCH_SET 1024
+
+static int count = 10000000;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+typedef struct
+{
+    unsigned char data[sizeof(DNSHeader) + 260];
+    int len;
+} Query;
+
+static int copy_name(const unsigned char *buffer, size_t buffer_size, char *domain, size_t domain_size)
+{
+    size_t i = sizeof(DNSHeader);
+    size_t j = 0;
+    
+    while (i < buffer_size && buffer[i] != 0 && j < domain_size - 1) {
+        int len = buffer[i++];
+        if (len > 63 || i + len > buffer_size) {
+            return -1;
+        }
+        
+        for (int k = 0; k < len && j < domain_size - 2; k++) {
+            domain[j++] = buffer[i++];
+        }
+        
+        if (j < domain_size - 1) {
+            domain[j++] = '.';
+        }
+    }
+    
+    if (j == 0) {
+        return -1;
+    }
+    domain[j - 1] = '\0';
+    return 0;
+}
+
+static int scalar_name(const unsigned char *buffer, size_t buffer_size, char *domain, size_t domain_size)
+{
+    size_t i = sizeof(DNSHeader);
+    size_t j = 0;
+    
+    while (i < buffer_size && buffer[i] != 0) {
+        int len = buffer[i++];
+        if (len > 63 || i + len > buffer_size || j + len + 1 > domain_size) {
+            return -1;
+        }
+        
+        for (int k = 0; k < len; k++) {
+            unsigned char c = buffer[i++];
+            if (c == '.' || c == 0) {
+                return -1;
+            }
+            domain[j++] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+        }
+        domain[j++] = '.';
+    }
+    
+    if (j == 0) {
+        return -1;
+    }
+    domain[j - 1] = '\0';
+    return 0;
+}
+
+static int vector_name(const unsigned char *buffer, size_t buffer_size, char *domain, size_t domain_size)
+{
+    size_t i = sizeof(DNSHeader);
+    size_t j = 0;
+    
+    while (i < buffer_size && buffer[i] != 0) {
+        int len = buffer[i++];
+        if (len > 63 || i + len > buffer_size || j + len + 1 > domain_size) {
+            return -1;
+        }
+        
+        if (dns_normalize_label(domain + j, buffer + i, len) != 0) {
+            return -1;
+        }
+        i += len;
+        j += len;
+        domain[j++] = '.';
+    }
+    
+    if (j == 0) {
+        return -1;
+    }
+    domain[j - 1] = '\0';
+    return 0;
+}
+
+static void build_query(Query *query, const char *name)
+{
+    DNSHeader header;
+    memset(&header, 0, sizeof(header));
+    header.qdcount = htons(1);
+    memcpy(query->data, &header, sizeof(header));
+    
+    int name_len = domainToDNSFormat(name, query->data + sizeof(header), sizeof(query->data) - sizeof(header) - 4);
+    if (name_len < 0) {
+        exit(1);
+    }
+    
+    int offset = sizeof(header) + name_len;
+    unsigned short qtype = htons(DNS_TYPE_A);
+    unsigned short qclass = htons(1);
+    memcpy(query->data + offset, &qtype, 2);
+    memcpy(query->data + offset + 2, &qclass, 2);
+    offset += 4;
+    query->len = offset;
+}
+
+/* random case on every letter, the way resolvers apply 0x20 encoding */
+static void random_name(char *name, size_t size, int label_len, int labels)
+{
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789-";
+    size_t j = 0;
+    
+    for (int l = 0; l < labels && j + label_len + 1 < size; l++) {
+        for (int k = 0; k < label_len; k++) {
+            char c = alphabet[rand() % (sizeof(alphabet) - 1)];
+            name[j++] = (c >= 'a' && c <= 'z' && rand() % 2) ? c - ('a' - 'A') : c;
+        }
+        name[j++] = '.';
+    }
+    memcpy(name + j, "Com", 4);
+}
+
+typedef int (*name_fn)(const unsigned char *buffer, size_t buffer_size, char *domain, size_t domain_size);
+
+static double time_names(name_fn fn, const Query *queries, unsigned long *ok)
+{
+    char domain[256];
+    
+    long long start = now_ns();
+    for (int i = 0; i < count; i++) {
+        const Query *query = &queries[i % PARSE_BENCH_SET];
+        *ok += fn(query->data, query->len, domain, sizeof(domain)) == 0;
+    }
+    return (double)(now_ns() - start) / count;
+}
+
+static void run_set(const char *label, const Query *queries)
+{
+    char domain[256];
+    unsigned short qtype;
+    int query_len;
+    unsigned long ok_copy = 0, ok_scalar = 0, ok_vector = 0, ok_parse = 0;
+    
+    double copy_ns = time_names(copy_name, queries, &ok_copy);
+    double scalar_ns = time_names(scalar_name, queries, &ok_scalar);
+    double vector_ns = time_names(vector_name, queries, &ok_vector);
+    
+    long long start = now_ns();
+    for (int i = 0; i < count; i++) {
+        const Query *query = &queries[i % PARSE_BENCH_SET];
+        ok_parse += parseDNSQuery(query->data, query->len, domain, sizeof(domain), &qtype, &query_len) == 0;
+    }
+    double parse_ns = (double)(now_ns() - start) / count;
+    
+    printf("%-6s copy %6.1f   scalar %6.1f   vector %6.1f   parseDNSQuery %6.1f ns/name   (%lu/%lu/%lu/%lu ok)\n",
+           label, copy_ns, scalar_ns, vector_ns, parse_ns, ok_copy, ok_scalar, ok_vector, ok_parse);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch (opt) {
+        case 'n': count = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-n ITERATIONS]\n", argv[0]);
+            return 1;
+        }
+    }
+    
+    if (count < 1) {
+        return 1;
+    }
+    
+    static const struct { const char *label; int label_len; int labels; } shapes[] = {
+        { "short", 6, 2 },
+        { "medium", 16, 3 },
+        { "long", 48, 4 },
+    };
+    
+    static Query queries[PARSE_BENCH_SET];
+    char name[256];
+    srand(1);
+    
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        for (int i = 0; i < PARSE_BENCH_SET; i++) {
+            random_name(name, sizeof(name), shapes[s].label_len, shapes[s].labels);
+            build_query(&queries[i], name);
+        }
+        run_set(shapes[s].label, queries);
+    }
+    
+    return 0;
+}
@@ -29,6 +29,9 @@ function usage {
     echo "  reload"
     echo "    Reload DNS records from configuration file"
     echo ""
+    echo "  stats"
+    echo "    Show response cache statistics"
+    echo ""
     echo "Scopes:"
     echo "  base      - Regular domain records"
     echo "  wildcard  - Wildcard domain records (*.domain)"
@@ -89,6 +92,9 @@ case "$1" in
     reload)
         send_command "RELOAD"
         ;;
+    stats)
+        send_command "STATS"
+        ;;
     *)
         echo "Error: Unknown command '$1'"
         usage
@@ -0,0 +1,34 @@
+#ifndef DNS_ALLOC_H
+#define DNS_ALLOC_H
+
+/*
+ * allocation checking for the query hot path. built with ALLOC_CHECK=1 the
+ * server replaces malloc and friends with counting wrappers around the glibc
+ * allocator, and every receive->parse->lookup->encode->send pass aborts if
+ * the thread's allocation counter moved. in normal builds the guards are
+ * empty.
+ */
+
+#ifdef DNS_ALLOC_CHECK
+
+extern __thread unsigned long dns_alloc_count;
+
+void dns_alloc_check_failed(const char *where, unsigned long allocations);
+
+#define HOT_PATH_BEGIN() unsigned long hot_path_allocs_ = dns_alloc_count
+
+#define HOT_PATH_END(where) \
+    do { \
+        if (dns_alloc_count != hot_path_allocs_) { \
+            dns_alloc_check_failed((where), dns_alloc_count - hot_path_allocs_); \
+        } \
+    } while (0)
+
+#else
+
+#define HOT_PATH_BEGIN() do { } while (0)
+#define HOT_PATH_END(where) do { } while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef DNS_ARENA_H
+#define DNS_ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE (1024 * 1024)
+
+/*
+ * bump allocator for data that lives exactly as long as one record table
+ * generation. memory is carved out of large chunks and only given back all
+ * at once, so a whole zone is freed with one call per chunk.
+ */
+typedef struct dns_arena_chunk
+{
+    struct dns_arena_chunk *next;
+    size_t size;
+    size_t used;
+    unsigned char data[];
+} DNSArenaChunk;
+
+typedef struct
+{
+    DNSArenaChunk *chunks;
+    size_t allocated;
+} DNSArena;
+
+void arena_init(DNSArena *arena);
+
+void *arena_alloc(DNSArena *arena, size_t size);
+
+void *arena_calloc(DNSArena *arena, size_t count, size_t size);
+
+char *arena_strdup(DNSArena *arena, const char *str);
+
+void *arena_memdup(DNSArena *arena, const void *data, size_t size);
+
+void arena_free(DNSArena *arena);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include "dns_server.h"
+
+#define CACHE_WAYS 4
+#define CACHE_KEY_SIZE 262   /* lowercased qname in wire format, qtype, qclass and the variant */
+
+/*
+ * per-worker cache of complete encoded responses, keyed by the lowercased
+ * question and the response size limit the query asked for. entries are
+ * tagged with the record table generation they were built from, and any
+ * entry from an older generation counts as a miss. all memory is allocated
+ * up front, set associative with lru replacement per set, so neither
+ * lookups nor inserts touch the heap. responses longer than 512 bytes are
+ * not cached.
+ */
+typedef struct
+{
+    unsigned char data[CACHE_KEY_SIZE];
+    int len;
+    int question_len;
+    uint32_t hash;
+} DNSCacheKey;
+
+typedef struct
+{
+    unsigned long generation;
+    uint64_t last_used;
+    uint32_t hash;
+    uint16_t key_len;
+    uint16_t response_len;
+    unsigned char key[CACHE_KEY_SIZE];
+    unsigned char response[DEFAULT_BUFFER_SIZE];
+} DNSCacheEntry;
+
+typedef struct dns_response_cache
+{
+    DNSCacheEntry *entries;
+    uint32_t set_mask;
+    uint64_t tick;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+} DNSResponseCache;
+
+typedef struct
+{
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    size_t entries;
+    size_t bytes;
+} DNSCacheStats;
+
+DNSResponseCache *response_cache_create(size_t max_bytes);
+
+void response_cache_destroy(DNSResponseCache *cache);
+
+int response_cache_key(const unsigned char *query, int len, DNSCacheKey *key);
+
+/* appends what else the response depends on besides the question, 0 for a query without EDNS */
+void response_cache_key_variant(DNSCacheKey *key, unsigned short variant);
+
+int response_cache_lookup(DNSResponseCache *cache, const DNSCacheKey *key, unsigned long generation,
+                          const unsigned char *query, unsigned char *response, size_t response_size);
+
+void response_cache_store(DNSResponseCache *cache, const DNSCacheKey *key, unsigned long generation,
+                          const unsigned char *response, int response_len);
+
+void response_cache_add_stats(const DNSResponseCache *cache, DNSCacheStats *stats);
+
+#endif
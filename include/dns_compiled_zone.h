@@ -0,0 +1,76 @@
+#ifndef DNS_COMPILED_ZONE_H
+#define DNS_COMPILED_ZONE_H
+
+#include "dns_records.h"
+#include "dns_phash.h"
+
+#define ZONE_OVERLAY_MAX 256   /* management writes kept beside a compiled zone or base before it is rebuilt */
+
+/*
+ * read-only index of every owner name in a zone, built once from a loaded
+ * record table. owner names are placed in a flat slot array through a
+ * perfect hash, so finding a name is one hash, one probe and one compare.
+ * a compiled zone never changes after it is built. table versions share it
+ * by reference and keep later management writes in their own small overlay
+ * (the usual records hash and name tree), which is merged into a new
+ * compiled zone once it outgrows ZONE_OVERLAY_MAX.
+ *
+ * slots refer to their owner name and records by position rather than by
+ * pointer, so the slot array, the names and the perfect hash can be written
+ * out as a zone image and mapped back in as they are (see dns_zone_image.h).
+ */
+typedef struct
+{
+    uint64_t hash;
+    uint32_t name;                 /* offset of the lowercased owner name in the zone's names */
+    uint32_t name_len;             /* 0 for an empty slot */
+    uint32_t records[DNS_SCOPE_COUNT];   /* index + 1 of the first record per scope, 0 for none */
+    uint32_t reserved;
+} DNSCompiledEntry;
+
+typedef struct dns_compiled_zone
+{
+    DNSPerfectHash phash;
+    const DNSCompiledEntry *entries;     /* one per perfect hash slot */
+    const char *names;             /* nul terminated owner names the slots point into */
+    uint32_t names_size;
+    DNSRecord *records;            /* record_count records, chained per owner and scope by name_next */
+    DNSRecordText *texts;          /* their strings, kept apart so lookups never touch them */
+    uint32_t name_count;
+    uint32_t record_count;
+    uint32_t wildcard_count;
+    DNSNameFilter filter;          /* owner names and wildcard apexes of the zone */
+    const DNSZoneTtl *zone_ttls;   /* of the table it was built from */
+    uint32_t zone_ttl_count;
+    const void *image;             /* mapped zone image the zone lives in, NULL if built in memory */
+    size_t image_size;
+    int refs;
+    DNSArena arena;
+} DNSCompiledZone;
+
+/* the first of an owner's records in scope, the rest follow through name_next */
+static inline const DNSRecord *compiled_entry_records(const DNSCompiledZone *zone, const DNSCompiledEntry *entry,
+                                                      int scope)
+{
+    return entry->records[scope] != 0 ? &zone->records[entry->records[scope] - 1] : NULL;
+}
+
+DNSCompiledZone *compiled_zone_build(const DNSRecordTable *src);
+
+DNSCompiledZone *compiled_zone_retain(DNSCompiledZone *zone);
+
+void compiled_zone_release(DNSCompiledZone *zone);
+
+const DNSCompiledEntry *compiled_zone_find(const DNSCompiledZone *zone, const char *name, size_t len);
+
+/* the compiled record with exactly this domain, scope and type, as a DELETE names it */
+const DNSRecord *compiled_zone_find_record(const DNSCompiledZone *zone, const char *domain, int scope,
+                                           unsigned short type);
+
+/*
+ * resolves like name_tree_lookup() over the table's compiled zone with its
+ * overlay on top. name must be lowercased, as parseDNSQuery() returns it.
+ */
+const DNSRecord *compiled_zone_lookup(const DNSRecordTable *table, const char *name, unsigned short type, int *scope);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef DNS_COMPRESS_H
+#define DNS_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DNS_COMPRESS_MAX_SUFFIXES 64
+#define DNS_COMPRESS_MAX_OFFSET 0x3FFF   /* furthest a 14 bit pointer reaches */
+#define DNS_MAX_NAME_WIRE_SIZE 256       /* a name the query parser accepts, in wire format */
+
+/*
+ * name compression table of one response being written (rfc 1035 4.1.4).
+ * it holds the offset of every name suffix written so far, the question
+ * name's first. a name in an answer is written label by label until the
+ * rest of it is one of these suffixes, which is then a two byte pointer.
+ * a suffix is only compared byte by byte when its uncompressed length is
+ * that of the name's rest, and names are compared case-insensitively.
+ * a response with more suffixes
+ * than the table holds is still correct, later names are just compressed
+ * against the first ones only.
+ */
+typedef struct
+{
+    uint16_t offset;
+    uint16_t length;               /* uncompressed, with the root label */
+} DNSCompressSuffix;
+
+typedef struct
+{
+    const unsigned char *message;
+    int count;
+    DNSCompressSuffix suffixes[DNS_COMPRESS_MAX_SUFFIXES];
+} DNSCompressor;
+
+/* starts a table over message, with the suffixes of the uncompressed name at offset */
+void dns_compress_init(DNSCompressor *compressor, const unsigned char *message, size_t name_offset);
+
+/*
+ * appends one pre-encoded answer (type, class, ttl, rdlength and rdata) at
+ * message + *len, compressing the name at name_offset in its rdata and
+ * fixing up the rdlength. name_offset < 0 copies the answer as it is.
+ * returns -1 and leaves *len alone if the answer doesn't fit in size.
+ */
+int dns_compress_answer(DNSCompressor *compressor, unsigned char *message, size_t *len, size_t size,
+                        const unsigned char *answer, size_t answer_len, int name_offset);
+
+/*
+ * appends the first record in record_size bytes at record, one that starts
+ * with its owner name uncompressed and has no name in its rdata, with the
+ * owner name compressed. returns how many bytes of record it took, or -1
+ * and leaves *len alone if it doesn't fit in size.
+ */
+int dns_compress_record(DNSCompressor *compressor, unsigned char *message, size_t *len, size_t size,
+                        const unsigned char *record, size_t record_size);
+
+#endif
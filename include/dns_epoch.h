@@ -0,0 +1,24 @@
+#ifndef DNS_EPOCH_H
+#define DNS_EPOCH_H
+
+#include <stdint.h>
+
+/*
+ * epoch based reclamation for read-mostly data. readers bracket every access
+ * with epoch_enter()/epoch_exit(), which only publish the epoch the thread is
+ * reading in. a writer that unpublished an object calls epoch_advance() and
+ * may free the object once epoch_safe() reports that no reader is still
+ * inside an older epoch.
+ */
+
+#define EPOCH_MAX_READERS 512
+
+int epoch_enter(void);
+
+void epoch_exit(void);
+
+uint64_t epoch_advance(void);
+
+int epoch_safe(uint64_t retire_epoch);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef DNS_EVENT_H
+#define DNS_EVENT_H
+
+#include "dns_server.h"
+#include <stdint.h>
+#include <sys/epoll.h>
+
+typedef struct dns_event_loop DNSEventLoop;
+
+typedef void (*dns_event_handler)(DNSEventLoop *loop, int fd, uint32_t events, void *arg);
+
+typedef struct dns_event_source
+{
+    int fd;
+    int internal;
+    int removed;
+    dns_event_handler handler;
+    void *arg;
+    struct dns_event_source *next;
+    struct dns_event_source *prev;
+} DNSEventSource;
+
+/*
+ * live sources are linked for teardown and indexed by fd, so modifying or
+ * removing one costs the same with thousands of connections in the loop.
+ * removed sources wait on their own list until the dispatch round ends.
+ */
+struct dns_event_loop
+{
+    int epoll_fd;
+    int notify_fd;
+    int stop;
+    DNSEventSource *sources;
+    DNSEventSource *removed;
+    DNSEventSource **by_fd;
+    int by_fd_size;
+};
+
+extern int shutdown_event_fd;
+
+int init_shutdown_event(void);
+void signal_shutdown(void);
+void cleanup_shutdown_event(void);
+
+int event_loop_init(DNSEventLoop *loop, dns_event_handler notify_handler, void *arg);
+int event_loop_add(DNSEventLoop *loop, int fd, uint32_t events, dns_event_handler handler, void *arg);
+int event_loop_modify(DNSEventLoop *loop, int fd, uint32_t events);
+int event_loop_remove(DNSEventLoop *loop, int fd);
+int event_loop_add_timer(DNSEventLoop *loop, int interval_ms, dns_event_handler handler, void *arg);
+void event_loop_notify(DNSEventLoop *loop);
+
+/* waits up to timeout_ms (-1 forever, 0 not at all) and runs the handlers of ready sources */
+int event_loop_dispatch(DNSEventLoop *loop, int timeout_ms);
+void event_loop_run(DNSEventLoop *loop);
+void event_loop_destroy(DNSEventLoop *loop);
+
+#endif
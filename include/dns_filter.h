@@ -0,0 +1,41 @@
+#ifndef DNS_FILTER_H
+#define DNS_FILTER_H
+
+#include "dns_arena.h"
+#include <stdint.h>
+
+#define FILTER_BITS_PER_NAME 16
+#define FILTER_BLOCK_WORDS 8
+
+struct dns_name_node;
+
+/*
+ * split block bloom filter over the owner names of a zone and the names
+ * that own a wildcard. every key sets one bit in each of the eight words of
+ * a single 32 byte block, so a check touches one cache line. a name the
+ * filter rejects has no record and no enclosing wildcard, and is answered
+ * NXDOMAIN without a lookup. an unbuilt filter (no blocks) accepts
+ * everything.
+ */
+typedef struct
+{
+    uint32_t (*blocks)[FILTER_BLOCK_WORDS];
+    uint32_t block_mask;
+    uint32_t names;
+} DNSNameFilter;
+
+/* an empty filter with room for names keys, allocated from arena */
+int name_filter_init(DNSNameFilter *filter, DNSArena *arena, uint32_t names);
+
+/* adds the names holding records in the tree, built from the table's arena */
+int name_filter_build(DNSNameFilter *filter, DNSArena *arena, const struct dns_name_node *root);
+
+void name_filter_add(DNSNameFilter *filter, const char *name, size_t len, int wildcard);
+
+/* 0 if the key was never added, without looking at enclosing wildcards */
+int name_filter_contains(const DNSNameFilter *filter, const char *name, size_t len, int wildcard);
+
+/* 0 if name, lowercased and without a trailing dot, can't match any record */
+int name_filter_check(const DNSNameFilter *filter, const char *name, size_t len);
+
+#endif
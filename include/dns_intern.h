@@ -0,0 +1,49 @@
+#ifndef DNS_INTERN_H
+#define DNS_INTERN_H
+
+#include "dns_arena.h"
+#include <stdint.h>
+
+#define INTERN_MIN_CAPACITY 1024
+
+/*
+ * dictionary of the byte strings a record table is built from: owner
+ * names, presentation values and encoded answers. interning one returns
+ * the copy already in the dictionary, so a name shared by an owner's
+ * records, a target many records point at or an answer repeated across
+ * records is stored once. the dictionary only indexes the strings, they
+ * live in an arena or in a buffer of the caller, and it is only needed
+ * while a table is being built.
+ */
+typedef struct
+{
+    const void *data;
+    uint32_t len;
+    uint32_t hash;                 /* low bits of the string's hash, compared before the bytes */
+} DNSInternSlot;
+
+typedef struct
+{
+    DNSInternSlot *slots;          /* linear probing, an empty slot has no data */
+    uint32_t capacity;             /* a power of two, 0 until the first add */
+    uint32_t count;
+    uint64_t seed;
+} DNSInternTable;
+
+void intern_init(DNSInternTable *intern, uint64_t seed);
+
+/* the interned copy of len bytes at data, NULL if there is none */
+const void *intern_find(const DNSInternTable *intern, const void *data, size_t len);
+
+/* adds bytes that stay put for as long as the dictionary is used, -1 on allocation failure */
+int intern_add(DNSInternTable *intern, const void *data, size_t len);
+
+/* the interned copy of len bytes at data, copied into arena first if there is none */
+const void *intern_memdup(DNSInternTable *intern, DNSArena *arena, const void *data, size_t len);
+
+/* intern_memdup() of a nul terminated string */
+char *intern_strdup(DNSInternTable *intern, DNSArena *arena, const char *str);
+
+void intern_free(DNSInternTable *intern);
+
+#endif
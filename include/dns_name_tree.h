@@ -0,0 +1,65 @@
+#ifndef DNS_NAME_TREE_H
+#define DNS_NAME_TREE_H
+
+#include "dns_records.h"
+
+#define DNS_MAX_LABEL_LEN 63
+#define DNS_NAME_WALK_SIZE 512   /* longest name name_tree_walk() reports, plus one */
+
+/*
+ * name tree keyed on reversed labels: the root is ".", its children are the
+ * top level labels and so on down to the leftmost label. every node stores
+ * its label in wire format (length byte followed by the label bytes) and
+ * carries the records owned by that exact name, plus the records of
+ * "*.<name>" which cover every name below it.
+ *
+ * children are found through a small open addressing table with the label
+ * hash kept next to the pointer, so a probe only touches the child node on
+ * a hash match.
+ */
+struct dns_name_node;
+
+typedef struct
+{
+    uint32_t hash;
+    struct dns_name_node *node;
+} DNSNameSlot;
+
+typedef struct dns_name_node
+{
+    DNSNameSlot *children;
+    uint32_t child_count;
+    uint32_t child_mask;
+    DNSRecord *records[DNS_SCOPE_COUNT];
+    unsigned char label[];
+} DNSNameNode;
+
+DNSNameNode *name_tree_create(DNSArena *arena);
+
+int name_tree_insert(DNSArena *arena, DNSNameNode *root, DNSRecord *record);
+
+void name_tree_remove(DNSNameNode *root, DNSRecord *record);
+
+const DNSRecord *name_tree_lookup(const DNSNameNode *root, const char *name, unsigned short type, int *scope);
+
+/*
+ * resolves like name_tree_lookup() over base with the records of overlay,
+ * tombstones included, taking the place of base's for the same name,
+ * scope and type. neither tree is modified and nothing is allocated.
+ */
+const DNSRecord *name_tree_lookup_overlay(const DNSNameNode *base, const DNSNameNode *overlay, const char *name,
+                                          unsigned short type, int *scope);
+
+/* the record of type stored on exactly name under scope, no wildcard matching */
+const DNSRecord *name_tree_find(const DNSNameNode *root, const char *name, int scope, unsigned short type);
+
+/*
+ * calls fn for every node below the root with its lowercased dotted name,
+ * which is only valid during the call. deeper names than fit in
+ * DNS_NAME_WALK_SIZE are skipped.
+ */
+typedef void (*dns_name_walk_fn)(const char *name, size_t len, const DNSNameNode *node, void *arg);
+
+void name_tree_walk(const DNSNameNode *root, dns_name_walk_fn fn, void *arg);
+
+#endif
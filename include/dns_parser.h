@@ -5,11 +5,35 @@
 
 int parseDNSQuery(const unsigned char *buffer, size_t buffer_size, 
                  char *domain, size_t domain_size, 
-                 unsigned short *queryType, char *typeString, size_t typeString_size, 
-                 int *query_len);
+                 unsigned short *queryType, int *query_len);
+
+/*
+ * copies a wire format label of len bytes into dst lowercased. returns -1
+ * if the label contains a '.' or NUL byte, which the dotted form can't hold.
+ */
+int dns_normalize_label(char *dst, const unsigned char *src, size_t len);
 
 int domainToDNSFormat(const char *domain, unsigned char *dns_format, size_t max_size);
 
-const char *getRecordTypeString(unsigned short type);
+#define DNS_OPT_SIZE 11   /* an OPT record without options */
+
+/* what a query's OPT record (rfc 6891) asks for */
+typedef struct
+{
+    int present;
+    unsigned short payload;        /* the largest udp response the client takes */
+    unsigned char version;
+} DNSEdns;
+
+/*
+ * skips the answer and authority records of a query whose question ends at
+ * offset and looks for an OPT record among its additional records. returns
+ * -1 if the records are malformed or there is more than one OPT record,
+ * which is a FORMERR.
+ */
+int dns_parse_edns(const unsigned char *buffer, size_t buffer_size, size_t offset, DNSEdns *edns);
+
+/* appends an OPT record advertising payload at offset, rcode is the full extended rcode. returns the new length or -1 */
+int dns_write_opt(unsigned char *response, size_t offset, size_t response_size, unsigned short payload, int rcode);
 
 #endif
\ No newline at end of file
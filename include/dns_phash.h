@@ -0,0 +1,58 @@
+#ifndef DNS_PHASH_H
+#define DNS_PHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PHASH_BUCKET_KEYS 3       /* average keys per bucket */
+#define PHASH_SLOT_LOAD 98        /* keys per 100 slots */
+#define PHASH_MAX_PILOT 65535
+#define PHASH_MAX_SEEDS 8
+
+/*
+ * static perfect hash over a fixed key set, pilot style: keys are spread
+ * over buckets by their hash, and every bucket stores a small pilot value
+ * that moves all of its keys to distinct free slots. finding the slot of a
+ * key is one hash of the key, one read of its bucket's pilot and a few
+ * integer operations. keys that were not in the set still land on some
+ * slot, so callers keep the hash and key in the slot to compare against.
+ */
+typedef struct
+{
+    uint64_t seed;
+    uint32_t key_count;
+    uint32_t slot_count;
+    uint32_t bucket_count;
+    uint16_t *pilots;
+} DNSPerfectHash;
+
+uint64_t phash_hash(uint64_t seed, const char *key, size_t len);
+
+/*
+ * builds the hash for count keys and stores the slot of key i in slots[i].
+ * returns -1 if no seed within PHASH_MAX_SEEDS worked or on allocation
+ * failure.
+ */
+int phash_build(DNSPerfectHash *phash, const char *const *keys, const size_t *lens, uint32_t count,
+                uint32_t *slots);
+
+void phash_free(DNSPerfectHash *phash);
+
+static inline uint64_t phash_mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static inline uint32_t phash_slot(const DNSPerfectHash *phash, uint64_t hash)
+{
+    uint32_t bucket = (uint32_t)(((hash >> 32) * phash->bucket_count) >> 32);
+    uint32_t mixed = (uint32_t)(hash ^ phash_mix(phash->pilots[bucket] + phash->seed));
+    return (uint32_t)(((uint64_t)mixed * phash->slot_count) >> 32);
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef DNS_RECORD_MAP_H
+#define DNS_RECORD_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RECORD_MAP_GROUP 16        /* control bytes compared per probe step */
+#define RECORD_MAP_LOAD_NUM 7      /* used slots per RECORD_MAP_LOAD_DEN before a rehash */
+#define RECORD_MAP_LOAD_DEN 8
+#define RECORD_MAP_MIGRATE_SLOTS 64   /* old slots moved per insert or remove while growing */
+
+struct dns_record;
+
+/* hashes len bytes of key, different seeds give unrelated hashes */
+typedef uint64_t (*dns_hash_fn)(uint64_t seed, const char *key, size_t len);
+
+typedef struct
+{
+    uint64_t hash;
+    struct dns_record *record;
+} DNSRecordSlot;
+
+/*
+ * open addressing map from a record's key (its owner name, scope and type)
+ * to the record, swiss table style. every slot has a control byte that is
+ * empty, deleted, or the low 7 bits of its key's hash with the high bit
+ * set, and slots are probed in groups of RECORD_MAP_GROUP whose control
+ * bytes are compared with one SSE2 instruction. the full 64-bit hash is
+ * kept in the slot, so a key is only compared when the hash matches. the
+ * map holds no per-record state and no key of its own, the key is read
+ * from the record.
+ *
+ * a full map is not rehashed in one go. inserts go to a new slot array
+ * right away, and every insert and remove moves the next
+ * RECORD_MAP_MIGRATE_SLOTS slots of the old array over, which empties it
+ * long before the new one fills up. until then a key is looked for in
+ * the new array and then in the old one.
+ */
+typedef struct
+{
+    DNSRecordSlot *slots;
+    uint8_t *ctrl;                 /* capacity control bytes, right behind the slots */
+    uint32_t capacity;             /* a power of two multiple of RECORD_MAP_GROUP, 0 until the first insert */
+    uint32_t count;                /* records in both arrays */
+    uint32_t growth_left;          /* empty slots that may still be taken before a rehash */
+    DNSRecordSlot *old_slots;      /* array being moved out of, NULL when no rehash is under way */
+    uint8_t *old_ctrl;
+    uint32_t old_capacity;
+    uint32_t migrate_pos;          /* old slots below this have been moved */
+    dns_hash_fn hash;
+    uint64_t seed;
+} DNSRecordMap;
+
+/* a NULL hash picks phash_hash() */
+void record_map_init(DNSRecordMap *map, dns_hash_fn hash, uint64_t seed);
+
+/* makes room for count records without a rehash, finishing any rehash under way */
+int record_map_reserve(DNSRecordMap *map, uint32_t count);
+
+struct dns_record *record_map_find(const DNSRecordMap *map, const char *domain, int scope, unsigned short type);
+
+/* adds a record whose owner, scope and type are not in the map yet, -1 on allocation failure */
+int record_map_insert(DNSRecordMap *map, struct dns_record *record);
+
+/* points the record's owner, scope and type at it, in place of the record they had if any. -1 on allocation failure */
+int record_map_put(DNSRecordMap *map, struct dns_record *record);
+
+/* removes and returns the record of this owner, scope and type, NULL if there is none */
+struct dns_record *record_map_remove(DNSRecordMap *map, const char *domain, int scope, unsigned short type);
+
+/* the next record from *pos on, start at 0. NULL at the end */
+struct dns_record *record_map_next(const DNSRecordMap *map, uint32_t *pos);
+
+void record_map_free(DNSRecordMap *map);
+
+#endif
@@ -2,32 +2,167 @@
 #define DNS_RECORDS_H
 
 #include "dns_server.h"
+#include "dns_arena.h"
+#include "dns_filter.h"
+#include "dns_record_map.h"
+#include "dns_intern.h"
 #include <pthread.h>
 
-typedef struct dns_record
+#define DNS_ANSWER_FIXED_SIZE 10   /* type, class, ttl and rdlength ahead of the rdata */
+#define DNS_MAX_RDATA_SIZE DEFAULT_BUFFER_SIZE   /* largest rdata that fits a response at all */
+#define DNS_MAX_VALUE_SIZE 256   /* longest value a type's parse formats from a mappings entry */
+#define DNS_MAX_GLUE_SIZE DNS_RESPONSE_BUFFER_SIZE   /* more glue than any udp response holds isn't kept */
+
+enum
+{
+    DNS_SCOPE_BASE,
+    DNS_SCOPE_SUBDOMAIN,
+    DNS_SCOPE_WILDCARD,
+    DNS_SCOPE_COUNT
+};
+
+/*
+ * presentation form of a record, read by LIST, DELETE, the record map and
+ * rebuilds but never by a query. the owner name and values are interned,
+ * records of one owner or with the same value share one copy. a record's
+ * key is its domain, scope and type code, and the type's name comes from
+ * dns_type_name(), so neither is stored.
+ */
+typedef struct dns_record_text
 {
     char *domain;
-    char *type;
-    char *key;
     char **values;
+} DNSRecordText;
+
+/*
+ * the part of a record a query touches: its type, the next record of the
+ * owner and the encoded answers. the strings live behind text, so walking
+ * an owner's records stays within a few small, dense structs.
+ *
+ * the answers of an NS, MX or SRV record are followed by its glue: the A
+ * and AAAA records of its in-zone targets, each with the target's name
+ * uncompressed in front, one rrset after the other. glue is gathered when
+ * the record or a target's addresses change, never by a query.
+ */
+typedef struct dns_record
+{
+    struct dns_record *name_next;
+    unsigned char *answers;        /* wire format answers minus the owner name, one per value */
+    DNSRecordText *text;
+    uint32_t answers_len;
     int num_values;
-    UT_hash_handle hh;
+    unsigned short type_code;
+    unsigned char scope;
+    unsigned char deleted;         /* overlay tombstone hiding a compiled record */
+    uint16_t glue_len;             /* bytes of glue after the answers */
 } DNSRecord;
 
-extern DNSRecord *dns_records;
+/*
+ * the ttl a zone of the mappings file gives its records, its own "ttl" or
+ * the default. kept with the loaded records so an rrset added later to a
+ * name of the zone gets it too. apexes are lowercased and sorted.
+ */
+typedef struct
+{
+    const char *apex;
+    uint32_t ttl;
+} DNSZoneTtl;
+
+struct dns_name_node;
+struct dns_compiled_zone;
+
+/*
+ * one immutable version of the record set. queries read the current table
+ * inside an epoch read section without taking any lock; writers hold
+ * dns_records_mutex, modify a private copy and publish it, and the old
+ * version is freed once no reader can still reference it. everything a
+ * version owns is allocated from its arena and freed together with it,
+ * except a compiled zone or a base, which versions share by reference.
+ *
+ * a table loaded from the mappings file is flat, its records and names
+ * hold the whole zone. the first write after that makes it the base of
+ * the new version, and every later write copies only the overlay of
+ * records added, replaced or deleted (tombstones) since, until the
+ * overlay is merged into a new flat table.
+ */
+typedef struct dns_record_table
+{
+    DNSRecordMap records;
+    struct dns_name_node *names;
+    struct dns_compiled_zone *compiled;   /* shared read-only zone, records and names are its overlay */
+    struct dns_record_table *base;        /* shared flat table, records and names are its overlay */
+    DNSNameFilter filter;                 /* over names, built before the table is published */
+    const DNSZoneTtl *zone_ttls;          /* of the loaded zones, shared like the compiled zone or base */
+    uint32_t zone_ttl_count;
+    DNSArena arena;
+    DNSInternTable intern;                /* strings of the arena, until the table is published */
+    unsigned long generation;
+    uint64_t retire_epoch;
+    struct dns_record_table *next_retired;
+    int refs;                             /* the owner's, plus one per version it is the base of */
+} DNSRecordTable;
+
 extern pthread_mutex_t dns_records_mutex;
 
 void init_dns_records(void);
 
-void add_record_to_hash(const char *domain, const char *type, cJSON *values, const char *scope);
+DNSRecordTable *create_record_table(void);
+
+DNSRecordTable *clone_record_table(DNSRecordTable *src);
+
+/* drops a reference, a table is freed with the last version it is the base of */
+void free_record_table(DNSRecordTable *table);
+
+DNSRecord *copy_dns_record(DNSArena *arena, DNSInternTable *intern, const DNSRecord *src);
+
+/* like copy_dns_record() into a record and text the caller provides, -1 on allocation failure */
+int copy_dns_record_to(DNSArena *arena, DNSInternTable *intern, DNSRecord *record, DNSRecordText *text,
+                       const DNSRecord *src);
+
+/* copies zone ttls and their apexes into arena. NULL for no zones or on allocation failure */
+DNSZoneTtl *copy_zone_ttls(DNSArena *arena, const DNSZoneTtl *zone_ttls, uint32_t count);
+
+unsigned int record_table_count(const DNSRecordTable *table);
+
+DNSRecordTable *current_record_table(void);
+
+void publish_record_table(DNSRecordTable *table);
+
+unsigned long dns_records_generation(void);
+
+void reclaim_record_tables_locked(void);
+
+void reclaim_record_tables(void);
+
+const DNSRecordTable *dns_table_read_lock(void);
+
+void dns_table_read_unlock(void);
+
+int add_record_to_hash(DNSRecordTable *table, const char *domain, const char *type, cJSON *values, const char *scope,
+                       uint32_t ttl);
+
+/* the ttl encoded in the record's answers, which all answers of an rrset share */
+uint32_t dns_record_ttl(const DNSRecord *record);
 
 int loadDNSMappings(const char *filename);
 
-DNSRecord *resolveRecord(const char *domain, const char *type);
+/* parses the mappings file into a compiled zone and writes it out as a zone image */
+int compile_zone_image(const char *filename, const char *path);
+
+int dns_scope_from_string(const char *scope);
+
+int record_table_may_hold(const DNSRecordTable *table, const char *domain);
+
+const DNSRecord *resolveRecord(const DNSRecordTable *table, const char *domain, unsigned short type);
 
 void cleanup_dns_records(void);
 
-int add_single_record(const char *domain, const char *type, const char *scope, const char *value);
+/*
+ * ttl < 0 keeps the ttl of the rrset the value replaces. a new rrset gets
+ * the ttl of the deepest loaded zone the domain is in, config.default_ttl
+ * if it is in none.
+ */
+int add_single_record(const char *domain, const char *type, const char *scope, const char *value, long ttl);
 
 int delete_record(const char *domain, const char *type, const char *scope);
 
@@ -16,7 +16,6 @@
 #include <ctype.h>
 
 #include "cJSON.h"
-#include "uthash.h"
 
 typedef enum {
     LOG_DEBUG,
@@ -25,6 +24,21 @@ typedef enum {
     LOG_ERROR
 } LogLevel;
 
+typedef enum {
+    IO_BACKEND_EPOLL,
+    IO_BACKEND_URING
+} IOBackend;
+
+typedef enum {
+    ZONE_INDEX_TREE,
+    ZONE_INDEX_COMPILED
+} ZoneIndex;
+
+typedef enum {
+    DNS_TRANSPORT_UDP,
+    DNS_TRANSPORT_TCP
+} DNSTransport;
+
 typedef struct {
     int dns_port;
     int mgmt_port;
@@ -32,6 +46,16 @@ typedef struct {
     int default_ttl;
     char *auth_token;
     int verbose;
+    int batch_size;
+    int workers;
+    IOBackend io_backend;
+    size_t cache_size;
+    ZoneIndex zone_index;
+    char *zone_image;              /* mapped instead of parsing mappings_file, NULL to parse */
+    int edns_payload;              /* udp payload size advertised in OPT and the most a response is sized to */
+    int tcp_connections;           /* open tcp connections over all workers, 0 disables tcp */
+    int tcp_idle_timeout;          /* seconds */
+    int tcp_reuseport;             /* a tcp listener per worker instead of one shared by all */
 } DNSServerConfig;
 
 extern DNSServerConfig config;
@@ -40,9 +64,27 @@ extern volatile sig_atomic_t running;
 #define DEFAULT_DNS_PORT 2053
 #define DEFAULT_MGMT_PORT 8053
 #define DEFAULT_MAPPINGS_FILE "dns_mappings.json"
-#define DEFAULT_TTL 3600
+#define DEFAULT_TTL 3600   /* for rrsets whose zone sets no ttl */
+#define MAX_TTL 2147483647   /* rfc 2181 8, the largest ttl a record may carry */
 #define DEFAULT_AUTH_TOKEN "123456"
-#define DEFAULT_BUFFER_SIZE 512
+#define DEFAULT_BUFFER_SIZE 512   /* a query, and a udp response to a client without EDNS */
+#define DEFAULT_EDNS_PAYLOAD 1232   /* avoids ip fragmentation on any common path */
+#define MAX_EDNS_PAYLOAD 4096
+#define DNS_RESPONSE_BUFFER_SIZE MAX_EDNS_PAYLOAD
+#define DEFAULT_BATCH_SIZE 32
+#define MAX_BATCH_SIZE 1024
+#define DEFAULT_WORKERS 1
+#define MAX_WORKERS 256
+#define DEFAULT_IO_BACKEND IO_BACKEND_EPOLL
+#define DEFAULT_STATS_INTERVAL 10
+#define RECLAIM_INTERVAL_MS 1000
+#define DEFAULT_CACHE_SIZE_MB 16
+#define MAX_CACHE_SIZE_MB 65536
+#define DEFAULT_ZONE_INDEX ZONE_INDEX_TREE
+#define DEFAULT_TCP_CONNECTIONS 1024
+#define MAX_TCP_CONNECTIONS 65536
+#define DEFAULT_TCP_IDLE_TIMEOUT 10
+#define MAX_TCP_IDLE_TIMEOUT 3600
 
 typedef struct
 {
@@ -68,6 +110,7 @@ typedef struct
 #define DNS_TYPE_TXT   16
 #define DNS_TYPE_AAAA  28
 #define DNS_TYPE_SRV   33
+#define DNS_TYPE_OPT   41
 
 #define DNS_RCODE_NOERROR   0
 #define DNS_RCODE_FORMERR   1
@@ -75,10 +118,16 @@ typedef struct
 #define DNS_RCODE_NXDOMAIN  3
 #define DNS_RCODE_NOTIMP    4
 #define DNS_RCODE_REFUSED   5
+#define DNS_RCODE_BADVERS   16   /* extended, its upper bits travel in the OPT record */
 
 void init_config(void);
 int init_dns_server(void);
-void process_dns_query(int sock_fd, unsigned char *buffer, int len, 
+struct dns_worker;
+
+int build_dns_response(struct dns_worker *worker, const unsigned char *buffer, int len, 
+                       unsigned char *response, size_t response_size, DNSTransport transport);
+void process_dns_query(struct dns_worker *worker, int sock_fd, unsigned char *buffer, int len, 
+                      unsigned char *response, size_t response_size,
                       struct sockaddr_in *client_addr, socklen_t addr_len);
 void *management_thread(void *arg);
 void log_message(LogLevel level, const char *format, ...);
@@ -87,5 +136,6 @@ void handle_add_command(int client_fd, char *input);
 void handle_delete_command(int client_fd, char *input);
 void handle_list_command(int client_fd);
 void handle_reload_command(int client_fd);
+void handle_stats_command(int client_fd);
 
 #endif
\ No newline at end of file
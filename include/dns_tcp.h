@@ -0,0 +1,45 @@
+#ifndef DNS_TCP_H
+#define DNS_TCP_H
+
+#include "dns_worker.h"
+
+#define DNS_TCP_BACKLOG 128
+#define DNS_TCP_READ_SIZE 4096                   /* per connection, room for many pipelined queries */
+#define DNS_TCP_MAX_QUERY DEFAULT_BUFFER_SIZE    /* same as over udp, a longer query closes the connection */
+#define DNS_TCP_RESPONSE_SIZE 65535              /* what the two byte length prefix allows */
+#define DNS_TCP_MAX_PENDING (128 * 1024)         /* unsent bytes before a connection stops being read */
+#define DNS_TCP_SWEEP_INTERVAL_MS 1000
+
+/*
+ * dns over tcp (rfc 7766). every worker accepts connections on the dns
+ * port and serves them from its own event loop next to its udp socket, so
+ * a connection always stays on one worker and uses that worker's cache.
+ * sockets are non-blocking: queries are read as they arrive, several per
+ * read when the client pipelines them, and each is answered as soon as it
+ * is complete. responses a slow client hasn't taken yet are queued on its
+ * connection, and one that falls DNS_TCP_MAX_PENDING bytes behind is not
+ * read again until it catches up, so it never stalls the worker.
+ * connections idle for config.tcp_idle_timeout seconds are closed, and
+ * ones past config.tcp_connections over all workers are refused.
+ */
+typedef struct dns_tcp_stats
+{
+    unsigned long long open;
+    unsigned long long accepted;
+    unsigned long long refused;
+    unsigned long long timed_out;
+    unsigned long long queries;
+} DNSTcpStats;
+
+/* a listening socket on the dns port, with SO_REUSEPORT so every worker can bind its own */
+int dns_tcp_listen(int reuseport);
+
+/* serves listen_fd from the worker's event loop, -1 binds a listener of the worker's own */
+int dns_tcp_init(DNSWorker *worker, int listen_fd);
+
+/* closes every connection of the worker and its own listener */
+void dns_tcp_destroy(DNSWorker *worker);
+
+void dns_tcp_add_stats(const DNSWorker *worker, DNSTcpStats *stats);
+
+#endif
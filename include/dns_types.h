@@ -0,0 +1,36 @@
+#ifndef DNS_TYPES_H
+#define DNS_TYPES_H
+
+#include <stddef.h>
+#include "cJSON.h"
+
+/*
+ * what the server knows about one record type. parse turns a value from
+ * the mappings file into the presentation string a record keeps, either
+ * the item's own string or one formatted into buf, and the caller copies
+ * it. encode turns that string into wire format rdata. encode is also the
+ * validator: a value is valid exactly when it encodes, so nothing can be
+ * accepted that the query path would then fail to answer.
+ */
+typedef struct
+{
+    unsigned short code;
+    const char *name;
+    const char *(*parse)(const cJSON *item, char *buf, size_t size);   /* NULL if item is not a value of this type */
+    int (*encode)(const char *value, unsigned char *rdata, size_t rdata_size);   /* rdata length or -1 */
+    int name_offset;               /* of a name in the rdata that may be compressed, -1 for none */
+    int glue_offset;               /* of a target whose addresses go in the additional section, -1 for none */
+} DNSTypeInfo;
+
+/* NULL for a type the server holds no records of */
+const DNSTypeInfo *dns_type_info(unsigned short code);
+
+const DNSTypeInfo *dns_type_by_name(const char *name);
+
+/* the mnemonic, "UNKNOWN" for an unsupported type */
+const char *dns_type_name(unsigned short code);
+
+/* 0 if value is a valid value of type code */
+int dns_type_validate(unsigned short code, const char *value);
+
+#endif
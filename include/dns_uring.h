@@ -0,0 +1,19 @@
+#ifndef DNS_URING_H
+#define DNS_URING_H
+
+#include "dns_worker.h"
+
+#define URING_QUEUE_DEPTH 256
+#define URING_CQ_DEPTH 4096
+#define URING_BUFFER_COUNT 1024
+#define URING_SEND_SLOTS 256
+
+int dns_uring_supported(void);
+
+int dns_uring_init(DNSWorker *worker);
+
+void dns_uring_run(DNSWorker *worker);
+
+void dns_uring_destroy(DNSWorker *worker);
+
+#endif
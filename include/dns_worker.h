@@ -0,0 +1,47 @@
+#ifndef DNS_WORKER_H
+#define DNS_WORKER_H
+
+#include "dns_server.h"
+#include "dns_event.h"
+#include "dns_cache.h"
+
+struct dns_uring;
+struct dns_tcp;
+struct dns_tcp_stats;
+
+typedef struct dns_worker
+{
+    int id;
+    int udp_socket;
+    pthread_t thread;
+    int started;
+    DNSEventLoop loop;
+    int loop_ready;
+    struct dns_uring *uring;
+    struct dns_tcp *tcp;
+    DNSResponseCache *cache;
+
+    struct mmsghdr *rx_msgs;
+    struct mmsghdr *tx_msgs;
+    struct iovec *rx_iovs;
+    struct iovec *tx_iovs;
+    struct sockaddr_in *client_addrs;
+    unsigned char (*buffers)[DEFAULT_BUFFER_SIZE];
+    unsigned char (*responses)[DNS_RESPONSE_BUFFER_SIZE];
+
+    unsigned long long batch_calls;
+    unsigned long long batch_packets;
+    unsigned long long filtered;   /* queries answered NXDOMAIN by the name filter */
+} DNSWorker;
+
+int start_dns_workers(int count);
+
+void stop_dns_workers(void);
+
+void get_cache_stats(DNSCacheStats *stats);
+
+unsigned long long get_filtered_queries(void);
+
+void get_tcp_stats(struct dns_tcp_stats *stats);
+
+#endif
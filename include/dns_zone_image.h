@@ -0,0 +1,80 @@
+#ifndef DNS_ZONE_IMAGE_H
+#define DNS_ZONE_IMAGE_H
+
+#include "dns_compiled_zone.h"
+
+#define ZONE_IMAGE_MAGIC "DNSZIMG"   /* 8 bytes with the nul */
+#define ZONE_IMAGE_VERSION 4
+#define ZONE_IMAGE_ALIGN 64          /* every section starts on a cache line */
+
+/*
+ * a compiled zone written out flat, so a server can map it read-only and
+ * serve from it without parsing or encoding anything. the perfect hash
+ * pilots, the slot array, the owner names and the name filter are used in
+ * place; only the record headers pointing into the image are built at load
+ * time. processes mapping the same image share its pages through the page
+ * cache. all offsets are from the start of the image, integers are in host
+ * byte order, and the image is only valid on the architecture that wrote it.
+ */
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t size;                 /* of the whole image */
+    uint64_t checksum;             /* phash_hash() of everything after the header */
+    
+    uint64_t phash_seed;
+    uint32_t key_count;
+    uint32_t slot_count;
+    uint32_t bucket_count;
+    uint32_t name_count;
+    uint32_t record_count;
+    uint32_t wildcard_count;
+    uint32_t filter_blocks;        /* 0 if the zone has no name filter */
+    uint32_t filter_names;
+    uint32_t names_size;           /* owner names at the start of the string pool */
+    uint32_t value_count;
+    uint32_t zone_count;
+    uint32_t reserved;
+    
+    uint64_t pilots;               /* bucket_count uint16_t */
+    uint64_t entries;              /* slot_count DNSCompiledEntry */
+    uint64_t filter;               /* filter_blocks blocks of the name filter */
+    uint64_t records;              /* record_count DNSZoneImageRecord */
+    uint64_t values;               /* value_count string pool offsets */
+    uint64_t strings;              /* nul terminated strings, owner names first, each stored once */
+    uint64_t strings_size;
+    uint64_t answers;              /* pre-encoded answers and glue of every record, records with the same answers share them */
+    uint64_t answers_size;
+    uint64_t zones;                /* zone_count DNSZoneImageZone, sorted by apex */
+} DNSZoneImageHeader;
+
+typedef struct
+{
+    uint32_t domain;               /* string pool offset */
+    uint32_t values;               /* index of the record's first value offset */
+    uint32_t num_values;
+    uint32_t answers;              /* offset into the answers section */
+    uint32_t answers_len;
+    uint32_t next;                 /* index + 1 of the owner's next record in this scope, 0 for none */
+    uint16_t type_code;
+    uint8_t scope;
+    uint8_t reserved;
+    uint32_t glue_len;             /* glue stored right after the answers */
+} DNSZoneImageRecord;
+
+/* the ttl of a zone of the mappings file, for rrsets added to it while the image is served */
+typedef struct
+{
+    uint32_t apex;                 /* string pool offset */
+    uint32_t ttl;
+} DNSZoneImageZone;
+
+/* writes the zone to path through a temporary file, so a running server never maps half an image */
+int zone_image_write(const DNSCompiledZone *zone, const char *path);
+
+/* maps an image and checks it end to end, NULL if it can't be used */
+DNSCompiledZone *zone_image_load(const char *path);
+
+#endif
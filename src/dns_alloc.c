@@ -0,0 +1,69 @@
+#include "dns_server.h"
+#include "dns_alloc.h"
+
+#ifdef DNS_ALLOC_CHECK
+
+#include <malloc.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+__thread unsigned long dns_alloc_count = 0;
+
+void *malloc(size_t size)
+{
+    dns_alloc_count++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    dns_alloc_count++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    dns_alloc_count++;
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    dns_alloc_count++;
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    dns_alloc_count++;
+    void *ptr = __libc_memalign(alignment, size);
+    if (ptr == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    dns_alloc_count++;
+    return __libc_memalign(alignment, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+void dns_alloc_check_failed(const char *where, unsigned long allocations)
+{
+    log_message(LOG_ERROR, "Hot path allocation check failed: %lu heap allocation(s) in %s", 
+              allocations, where);
+    abort();
+}
+
+#endif
@@ -0,0 +1,97 @@
+#include "dns_arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 8
+
+void arena_init(DNSArena *arena)
+{
+    arena->chunks = NULL;
+    arena->allocated = 0;
+}
+
+static DNSArenaChunk *add_chunk(DNSArena *arena, size_t min_size)
+{
+    size_t size = min_size > ARENA_CHUNK_SIZE ? min_size : ARENA_CHUNK_SIZE;
+    
+    DNSArenaChunk *chunk = malloc(sizeof(DNSArenaChunk) + size);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    
+    chunk->size = size;
+    chunk->used = 0;
+    
+    /* oversized allocations go behind the current chunk so it keeps filling */
+    if (size > ARENA_CHUNK_SIZE && arena->chunks != NULL) {
+        chunk->next = arena->chunks->next;
+        arena->chunks->next = chunk;
+    } else {
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+    
+    arena->allocated += size;
+    return chunk;
+}
+
+void *arena_alloc(DNSArena *arena, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size == 0) {
+        size = ARENA_ALIGN;
+    }
+    
+    DNSArenaChunk *chunk = arena->chunks;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        chunk = add_chunk(arena, size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+    }
+    
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+void *arena_calloc(DNSArena *arena, size_t count, size_t size)
+{
+    if (size != 0 && count > (size_t)-1 / size) {
+        return NULL;
+    }
+    
+    void *ptr = arena_alloc(arena, count * size);
+    if (ptr != NULL) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+char *arena_strdup(DNSArena *arena, const char *str)
+{
+    return arena_memdup(arena, str, strlen(str) + 1);
+}
+
+void *arena_memdup(DNSArena *arena, const void *data, size_t size)
+{
+    void *ptr = arena_alloc(arena, size);
+    if (ptr != NULL) {
+        memcpy(ptr, data, size);
+    }
+    return ptr;
+}
+
+void arena_free(DNSArena *arena)
+{
+    DNSArenaChunk *chunk = arena->chunks;
+    
+    while (chunk != NULL) {
+        DNSArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    
+    arena->chunks = NULL;
+    arena->allocated = 0;
+}
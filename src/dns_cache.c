@@ -0,0 +1,198 @@
+#include "dns_cache.h"
+#include "dns_parser.h"
+
+/* counters have a single writer, relaxed stores let other threads read them */
+#define CACHE_COUNT(counter) __atomic_store_n(&(counter), (counter) + 1, __ATOMIC_RELAXED)
+
+DNSResponseCache *response_cache_create(size_t max_bytes)
+{
+    size_t sets = max_bytes / (sizeof(DNSCacheEntry) * CACHE_WAYS);
+    if (sets == 0) {
+        return NULL;
+    }
+    
+    /* round down to a power of two so the set index is a mask */
+    size_t pow2 = 1;
+    while (pow2 * 2 <= sets) {
+        pow2 *= 2;
+    }
+    
+    DNSResponseCache *cache = calloc(1, sizeof(DNSResponseCache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    
+    cache->entries = calloc(pow2 * CACHE_WAYS, sizeof(DNSCacheEntry));
+    if (cache->entries == NULL) {
+        free(cache);
+        return NULL;
+    }
+    
+    cache->set_mask = pow2 - 1;
+    return cache;
+}
+
+void response_cache_destroy(DNSResponseCache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+    
+    free(cache->entries);
+    free(cache);
+}
+
+/*
+ * builds the key from the raw question: qname labels lowercased, followed by
+ * qtype and qclass. only plain single-question queries are cached.
+ */
+int response_cache_key(const unsigned char *query, int len, DNSCacheKey *key)
+{
+    if (len < (int)sizeof(DNSHeader) + 5) {
+        return -1;
+    }
+    
+    const DNSHeader *header = (const DNSHeader *)query;
+    if (header->qr || header->opcode != 0 || ntohs(header->qdcount) != 1) {
+        return -1;
+    }
+    
+    int offset = sizeof(DNSHeader);
+    int key_len = 0;
+    uint32_t hash = 2166136261u;
+    
+    for (;;) {
+        if (offset >= len) {
+            return -1;
+        }
+        
+        int label_len = query[offset];
+        if (label_len > 63 || offset + 1 + label_len > len || key_len + 1 + label_len > 255) {
+            return -1;
+        }
+        
+        key->data[key_len] = (unsigned char)label_len;
+        if (dns_normalize_label((char *)key->data + key_len + 1, query + offset + 1, label_len) != 0) {
+            return -1;
+        }
+        
+        for (int i = 0; i <= label_len; i++) {
+            hash = (hash ^ key->data[key_len++]) * 16777619u;
+        }
+        offset += 1 + label_len;
+        
+        if (label_len == 0) {
+            break;
+        }
+    }
+    
+    if (offset + 4 > len) {
+        return -1;
+    }
+    
+    for (int i = 0; i < 4; i++) {
+        key->data[key_len++] = query[offset + i];
+        hash = (hash ^ query[offset + i]) * 16777619u;
+    }
+    
+    key->len = key_len;
+    key->question_len = offset + 4 - sizeof(DNSHeader);
+    key->hash = hash;
+    return 0;
+}
+
+void response_cache_key_variant(DNSCacheKey *key, unsigned short variant)
+{
+    unsigned char bytes[2] = { variant >> 8, variant & 0xFF };
+    
+    for (int i = 0; i < 2; i++) {
+        key->data[key->len++] = bytes[i];
+        key->hash = (key->hash ^ bytes[i]) * 16777619u;
+    }
+}
+
+static DNSCacheEntry *find_entry(DNSResponseCache *cache, const DNSCacheKey *key)
+{
+    DNSCacheEntry *set = cache->entries + (size_t)(key->hash & cache->set_mask) * CACHE_WAYS;
+    
+    for (int way = 0; way < CACHE_WAYS; way++) {
+        DNSCacheEntry *entry = &set[way];
+        if (entry->response_len != 0 && entry->hash == key->hash && entry->key_len == key->len &&
+            memcmp(entry->key, key->data, key->len) == 0) {
+            return entry;
+        }
+    }
+    
+    return NULL;
+}
+
+/*
+ * copies a cached response for the question and patches in the transaction
+ * id, the rd bit and the question exactly as the client sent it, so the
+ * client sees its own letter case. returns the length, or -1 on a miss.
+ */
+int response_cache_lookup(DNSResponseCache *cache, const DNSCacheKey *key, unsigned long generation,
+                          const unsigned char *query, unsigned char *response, size_t response_size)
+{
+    DNSCacheEntry *entry = find_entry(cache, key);
+    
+    if (entry == NULL || entry->generation != generation || entry->response_len > response_size) {
+        CACHE_COUNT(cache->misses);
+        return -1;
+    }
+    
+    memcpy(response, entry->response, entry->response_len);
+    
+    DNSHeader *header = (DNSHeader *)response;
+    const DNSHeader *request = (const DNSHeader *)query;
+    header->id = request->id;
+    header->rd = request->rd;
+    memcpy(response + sizeof(DNSHeader), query + sizeof(DNSHeader), key->question_len);
+    
+    entry->last_used = ++cache->tick;
+    CACHE_COUNT(cache->hits);
+    return entry->response_len;
+}
+
+void response_cache_store(DNSResponseCache *cache, const DNSCacheKey *key, unsigned long generation,
+                          const unsigned char *response, int response_len)
+{
+    if (response_len <= 0 || response_len > DEFAULT_BUFFER_SIZE) {
+        return;
+    }
+    
+    DNSCacheEntry *entry = find_entry(cache, key);
+    
+    if (entry == NULL) {
+        /* take a free way, or evict the least recently used one */
+        DNSCacheEntry *set = cache->entries + (size_t)(key->hash & cache->set_mask) * CACHE_WAYS;
+        entry = &set[0];
+        for (int way = 1; way < CACHE_WAYS && entry->response_len != 0; way++) {
+            if (set[way].response_len == 0 || set[way].last_used < entry->last_used) {
+                entry = &set[way];
+            }
+        }
+        
+        if (entry->response_len != 0) {
+            CACHE_COUNT(cache->evictions);
+        }
+        
+        entry->hash = key->hash;
+        entry->key_len = key->len;
+        memcpy(entry->key, key->data, key->len);
+    }
+    
+    entry->generation = generation;
+    entry->response_len = response_len;
+    entry->last_used = ++cache->tick;
+    memcpy(entry->response, response, response_len);
+}
+
+void response_cache_add_stats(const DNSResponseCache *cache, DNSCacheStats *stats)
+{
+    stats->hits += __atomic_load_n(&cache->hits, __ATOMIC_RELAXED);
+    stats->misses += __atomic_load_n(&cache->misses, __ATOMIC_RELAXED);
+    stats->evictions += __atomic_load_n(&cache->evictions, __ATOMIC_RELAXED);
+    stats->entries += (size_t)(cache->set_mask + 1) * CACHE_WAYS;
+    stats->bytes += (size_t)(cache->set_mask + 1) * CACHE_WAYS * sizeof(DNSCacheEntry);
+}
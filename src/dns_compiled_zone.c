@@ -0,0 +1,352 @@
+#include "dns_compiled_zone.h"
+#include "dns_name_tree.h"
+#include <sys/mman.h>
+
+typedef struct
+{
+    const char **names;
+    size_t *lens;
+    const DNSNameNode **nodes;
+    uint32_t count;
+    uint32_t records;
+    size_t names_size;
+    char *pool;
+} OwnerList;
+
+static int has_records(const DNSNameNode *node)
+{
+    for (int scope = 0; scope < DNS_SCOPE_COUNT; scope++) {
+        if (node->records[scope] != NULL) {
+            return 1;
+        }
+    }
+    
+    return 0;
+}
+
+static void count_owner(const char *name, size_t len, const DNSNameNode *node, void *arg)
+{
+    (void)name;
+    OwnerList *owners = (OwnerList *)arg;
+    
+    if (!has_records(node)) {
+        return;
+    }
+    
+    owners->count++;
+    owners->names_size += len + 1;
+    for (int scope = 0; scope < DNS_SCOPE_COUNT; scope++) {
+        for (const DNSRecord *record = node->records[scope]; record != NULL; record = record->name_next) {
+            owners->records += !record->deleted;
+        }
+    }
+}
+
+/* owner names are packed one after the other into the zone's name pool */
+static void collect_owner(const char *name, size_t len, const DNSNameNode *node, void *arg)
+{
+    OwnerList *owners = (OwnerList *)arg;
+    
+    if (!has_records(node)) {
+        return;
+    }
+    
+    char *copy = owners->pool + owners->names_size;
+    memcpy(copy, name, len + 1);
+    owners->names_size += len + 1;
+    
+    owners->names[owners->count] = copy;
+    owners->lens[owners->count] = len;
+    owners->nodes[owners->count] = node;
+    owners->count++;
+}
+
+/* copies a name's records into the zone's record array, keeping their order */
+static int copy_records(DNSCompiledZone *zone, DNSInternTable *intern, DNSCompiledEntry *entry,
+                        const DNSNameNode *node)
+{
+    for (int scope = 0; scope < DNS_SCOPE_COUNT; scope++) {
+        DNSRecord *last = NULL;
+        
+        for (const DNSRecord *record = node->records[scope]; record != NULL; record = record->name_next) {
+            if (record->deleted) {
+                continue;
+            }
+            
+            DNSRecord *copy = &zone->records[zone->record_count];
+            if (copy_dns_record_to(&zone->arena, intern, copy, &zone->texts[zone->record_count], record) != 0) {
+                return -1;
+            }
+            
+            zone->record_count++;
+            if (last != NULL) {
+                last->name_next = copy;
+            } else {
+                entry->records[scope] = zone->record_count;
+            }
+            last = copy;
+            zone->wildcard_count += scope == DNS_SCOPE_WILDCARD;
+        }
+    }
+    
+    return 0;
+}
+
+DNSCompiledZone *compiled_zone_build(const DNSRecordTable *src)
+{
+    DNSCompiledZone *zone = calloc(1, sizeof(DNSCompiledZone));
+    if (zone == NULL) {
+        log_message(LOG_ERROR, "failed to allocate compiled zone: %s", strerror(errno));
+        return NULL;
+    }
+    
+    zone->refs = 1;
+    arena_init(&zone->arena);
+    
+    OwnerList owners = { 0 };
+    DNSInternTable intern;
+    uint32_t *slots = NULL;
+    intern_init(&intern, src->intern.seed);
+    name_tree_walk(src->names, count_owner, &owners);
+    
+    if (owners.names_size > UINT32_MAX) {
+        log_message(LOG_ERROR, "owner names of the zone exceed %u bytes", UINT32_MAX);
+        goto fail;
+    }
+    
+    uint32_t count = owners.count;
+    uint32_t record_count = owners.records;
+    zone->names_size = (uint32_t)owners.names_size;
+    
+    owners.names = malloc(((size_t)count + 1) * sizeof(char *));
+    owners.lens = malloc(((size_t)count + 1) * sizeof(size_t));
+    owners.nodes = malloc(((size_t)count + 1) * sizeof(DNSNameNode *));
+    owners.pool = arena_alloc(&zone->arena, owners.names_size + 1);
+    slots = malloc(((size_t)count + 1) * sizeof(uint32_t));
+    
+    if (owners.names == NULL || owners.lens == NULL || owners.nodes == NULL || owners.pool == NULL ||
+        slots == NULL) {
+        log_message(LOG_ERROR, "failed to allocate owner names: %s", strerror(errno));
+        goto fail;
+    }
+    
+    owners.count = 0;
+    owners.names_size = 0;
+    name_tree_walk(src->names, collect_owner, &owners);
+    zone->names = owners.pool;
+    
+    if (phash_build(&zone->phash, owners.names, owners.lens, owners.count, slots) != 0) {
+        log_message(LOG_ERROR, "failed to build perfect hash over %u names", owners.count);
+        goto fail;
+    }
+    
+    DNSCompiledEntry *entries = arena_calloc(&zone->arena, zone->phash.slot_count, sizeof(DNSCompiledEntry));
+    zone->records = arena_calloc(&zone->arena, (size_t)record_count + 1, sizeof(DNSRecord));
+    zone->texts = arena_calloc(&zone->arena, (size_t)record_count + 1, sizeof(DNSRecordText));
+    if (entries == NULL || zone->records == NULL || zone->texts == NULL) {
+        log_message(LOG_ERROR, "failed to allocate compiled zone slots: %s", strerror(errno));
+        goto fail;
+    }
+    zone->entries = entries;
+    
+    /* a record whose domain is its owner's name points into the names pool instead of a copy */
+    for (uint32_t i = 0; i < owners.count; i++) {
+        if (intern_add(&intern, owners.names[i], owners.lens[i] + 1) != 0) {
+            log_message(LOG_ERROR, "failed to index owner names: %s", strerror(errno));
+            goto fail;
+        }
+    }
+    
+    for (uint32_t i = 0; i < owners.count; i++) {
+        DNSCompiledEntry *entry = &entries[slots[i]];
+        entry->hash = phash_hash(zone->phash.seed, owners.names[i], owners.lens[i]);
+        entry->name = (uint32_t)(owners.names[i] - zone->names);
+        entry->name_len = (uint32_t)owners.lens[i];
+        
+        if (copy_records(zone, &intern, entry, owners.nodes[i]) != 0) {
+            log_message(LOG_ERROR, "failed to copy records of %s: %s", owners.names[i], strerror(errno));
+            goto fail;
+        }
+    }
+    zone->name_count = owners.count;
+    
+    zone->zone_ttls = copy_zone_ttls(&zone->arena, src->zone_ttls, src->zone_ttl_count);
+    zone->zone_ttl_count = src->zone_ttl_count;
+    if (zone->zone_ttl_count != 0 && zone->zone_ttls == NULL) {
+        log_message(LOG_ERROR, "failed to copy zone ttls: %s", strerror(errno));
+        goto fail;
+    }
+    
+    /* without a filter every miss takes the full lookup, the zone still works */
+    if (name_filter_build(&zone->filter, &zone->arena, src->names) != 0) {
+        log_message(LOG_WARNING, "failed to build name filter for compiled zone: %s", strerror(errno));
+    }
+    
+    free(owners.names);
+    free(owners.lens);
+    free(owners.nodes);
+    free(slots);
+    intern_free(&intern);
+    return zone;
+
+fail:
+    intern_free(&intern);
+    free(owners.names);
+    free(owners.lens);
+    free(owners.nodes);
+    free(slots);
+    compiled_zone_release(zone);
+    return NULL;
+}
+
+/* table versions sharing a zone are freed by the management thread and at shutdown */
+DNSCompiledZone *compiled_zone_retain(DNSCompiledZone *zone)
+{
+    if (zone != NULL) {
+        __atomic_add_fetch(&zone->refs, 1, __ATOMIC_RELAXED);
+    }
+    return zone;
+}
+
+void compiled_zone_release(DNSCompiledZone *zone)
+{
+    if (zone == NULL || __atomic_sub_fetch(&zone->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    
+    /* a mapped zone's pilots are part of the image */
+    if (zone->image != NULL) {
+        munmap((void *)zone->image, zone->image_size);
+    } else {
+        phash_free(&zone->phash);
+    }
+    arena_free(&zone->arena);
+    free(zone);
+}
+
+const DNSCompiledEntry *compiled_zone_find(const DNSCompiledZone *zone, const char *name, size_t len)
+{
+    if (zone == NULL || len == 0) {
+        return NULL;
+    }
+    
+    uint64_t hash = phash_hash(zone->phash.seed, name, len);
+    const DNSCompiledEntry *entry = &zone->entries[phash_slot(&zone->phash, hash)];
+    
+    if (entry->hash != hash || entry->name_len != len || memcmp(zone->names + entry->name, name, len) != 0) {
+        return NULL;
+    }
+    
+    return entry;
+}
+
+const DNSRecord *compiled_zone_find_record(const DNSCompiledZone *zone, const char *domain, int scope,
+                                           unsigned short type)
+{
+    if (zone == NULL) {
+        return NULL;
+    }
+    
+    const char *owner = domain;
+    if (scope == DNS_SCOPE_WILDCARD) {
+        if (strncmp(domain, "*.", 2) != 0) {
+            return NULL;
+        }
+        owner = domain + 2;
+    }
+    
+    char lower[DNS_NAME_WALK_SIZE];
+    size_t len = strlen(owner);
+    if (len > 0 && owner[len - 1] == '.') {
+        len--;
+    }
+    if (len >= sizeof(lower)) {
+        return NULL;
+    }
+    
+    for (size_t i = 0; i < len; i++) {
+        lower[i] = tolower((unsigned char)owner[i]);
+    }
+    
+    const DNSCompiledEntry *entry = compiled_zone_find(zone, lower, len);
+    if (entry == NULL) {
+        return NULL;
+    }
+    
+    for (const DNSRecord *record = compiled_entry_records(zone, entry, scope); record != NULL; record = record->name_next) {
+        if (record->type_code == type && strcmp(record->text->domain, domain) == 0) {
+            return record;
+        }
+    }
+    
+    return NULL;
+}
+
+static const DNSRecord *find_type(const DNSRecord *records, unsigned short type)
+{
+    for (; records != NULL; records = records->name_next) {
+        if (records->type_code == type) {
+            return records;
+        }
+    }
+    
+    return NULL;
+}
+
+/* the overlay wins for every owner, scope and type it holds, and a tombstone hides the compiled record */
+static const DNSRecord *owner_record(const DNSRecordTable *table, const DNSCompiledEntry *entry,
+                                     const char *owner, int scope, unsigned short type)
+{
+    if (table->records.count != 0) {
+        const DNSRecord *record = name_tree_find(table->names, owner, scope, type);
+        if (record != NULL) {
+            return record->deleted ? NULL : record;
+        }
+    }
+    
+    return entry != NULL ? find_type(compiled_entry_records(table->compiled, entry, scope), type) : NULL;
+}
+
+const DNSRecord *compiled_zone_lookup(const DNSRecordTable *table, const char *name, unsigned short type, int *scope)
+{
+    const DNSCompiledZone *zone = table->compiled;
+    const DNSRecord *record;
+    size_t len = strlen(name);
+    
+    if (len > 0 && name[len - 1] == '.') {
+        len--;
+    }
+    
+    const DNSCompiledEntry *entry = compiled_zone_find(zone, name, len);
+    
+    if ((record = owner_record(table, entry, name, DNS_SCOPE_BASE, type)) != NULL) {
+        *scope = DNS_SCOPE_BASE;
+        return record;
+    }
+    if ((record = owner_record(table, entry, name, DNS_SCOPE_SUBDOMAIN, type)) != NULL) {
+        *scope = DNS_SCOPE_SUBDOMAIN;
+        return record;
+    }
+    
+    /* closest enclosing wildcard first, the root never holds one */
+    *scope = DNS_SCOPE_WILDCARD;
+    if (zone->wildcard_count == 0 && table->records.count == 0) {
+        return NULL;
+    }
+    
+    const char *end = name + len;
+    
+    for (const char *dot = memchr(name, '.', len); dot != NULL; dot = memchr(dot + 1, '.', end - dot - 1)) {
+        const char *suffix = dot + 1;
+        if (suffix >= end) {
+            break;
+        }
+        
+        entry = compiled_zone_find(zone, suffix, end - suffix);
+        if ((record = owner_record(table, entry, suffix, DNS_SCOPE_WILDCARD, type)) != NULL) {
+            return record;
+        }
+    }
+    
+    return NULL;
+}
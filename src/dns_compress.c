@@ -0,0 +1,192 @@
+#include "dns_compress.h"
+#include "dns_records.h"
+
+static inline unsigned char lower(unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+/* whether the uncompressed name equals the name at offset in the message, which may end in a pointer */
+static int suffix_matches(const unsigned char *message, size_t offset, const unsigned char *name)
+{
+    for (;;) {
+        unsigned char len = message[offset];
+        
+        /* every pointer in the table leads to an earlier name, so this can't loop */
+        if ((len & 0xC0) == 0xC0) {
+            offset = ((size_t)(len & 0x3F) << 8) | message[offset + 1];
+            continue;
+        }
+        
+        if (len != *name) {
+            return 0;
+        }
+        if (len == 0) {
+            return 1;
+        }
+        
+        for (unsigned char i = 1; i <= len; i++) {
+            if (lower(message[offset + i]) != lower(name[i])) {
+                return 0;
+            }
+        }
+        offset += len + 1;
+        name += len + 1;
+    }
+}
+
+static int find_suffix(const DNSCompressor *compressor, const unsigned char *name, size_t length)
+{
+    for (int i = 0; i < compressor->count; i++) {
+        const DNSCompressSuffix *suffix = &compressor->suffixes[i];
+        if (suffix->length == length && suffix_matches(compressor->message, suffix->offset, name)) {
+            return suffix->offset;
+        }
+    }
+    return -1;
+}
+
+/*
+ * adds every suffix of the name at offset that is written out, up to its
+ * end or a pointer. length is the whole name's, uncompressed.
+ */
+static void add_suffixes(DNSCompressor *compressor, size_t offset, size_t length)
+{
+    const unsigned char *message = compressor->message;
+    
+    while (message[offset] != 0 && (message[offset] & 0xC0) == 0 && offset <= DNS_COMPRESS_MAX_OFFSET &&
+           compressor->count < DNS_COMPRESS_MAX_SUFFIXES) {
+        DNSCompressSuffix *suffix = &compressor->suffixes[compressor->count++];
+        suffix->offset = (uint16_t)offset;
+        suffix->length = (uint16_t)length;
+        length -= message[offset] + 1;
+        offset += message[offset] + 1;
+    }
+}
+
+/* length of the uncompressed name at name, -1 if it runs past size bytes */
+static int name_length(const unsigned char *name, size_t size)
+{
+    size_t offset = 0;
+    
+    while (offset < size && name[offset] != 0) {
+        if (name[offset] > 63) {
+            return -1;
+        }
+        offset += name[offset] + 1;
+    }
+    return offset < size ? (int)offset + 1 : -1;
+}
+
+/* the question name was checked by parseDNSQuery(), it has no pointers and ends inside the message */
+void dns_compress_init(DNSCompressor *compressor, const unsigned char *message, size_t name_offset)
+{
+    int length = name_length(message + name_offset, DNS_MAX_NAME_WIRE_SIZE);
+    
+    compressor->message = message;
+    compressor->count = 0;
+    if (length > 0) {
+        add_suffixes(compressor, name_offset, length);
+    }
+}
+
+/* writes name at message + *len, ending in a pointer to the longest suffix already in the message */
+static int compress_name(DNSCompressor *compressor, unsigned char *message, size_t *len, size_t size,
+                         const unsigned char *name, size_t name_len)
+{
+    const unsigned char *label = name;
+    size_t rest = name_len;
+    int suffix = -1;
+    
+    while (*label != 0 && (suffix = find_suffix(compressor, label, rest)) < 0) {
+        rest -= *label + 1;
+        label += *label + 1;
+    }
+    
+    /* the labels ahead of the suffix go out in one copy, the whole name with its root if there is none */
+    size_t literal = suffix >= 0 ? (size_t)(label - name) : name_len;
+    size_t offset = *len;
+    if (offset + literal + (suffix >= 0 ? 2 : 0) > size) {
+        return -1;
+    }
+    
+    memcpy(message + offset, name, literal);
+    offset += literal;
+    if (suffix >= 0) {
+        message[offset++] = 0xC0 | (suffix >> 8);
+        message[offset++] = suffix & 0xFF;
+    }
+    
+    add_suffixes(compressor, *len, name_len);
+    *len = offset;
+    return 0;
+}
+
+int dns_compress_answer(DNSCompressor *compressor, unsigned char *message, size_t *len, size_t size,
+                        const unsigned char *answer, size_t answer_len, int name_offset)
+{
+    size_t rdata_len = answer_len - DNS_ANSWER_FIXED_SIZE;
+    int name_len = name_offset >= 0 && (size_t)name_offset < rdata_len ?
+        name_length(answer + DNS_ANSWER_FIXED_SIZE + name_offset, rdata_len - name_offset) : -1;
+    
+    if (name_len < 0) {
+        if (*len + answer_len > size) {
+            return -1;
+        }
+        memcpy(message + *len, answer, answer_len);
+        *len += answer_len;
+        return 0;
+    }
+    
+    /* the fixed fields and whatever comes before the name, then the name, then the rest of the rdata */
+    size_t head = DNS_ANSWER_FIXED_SIZE + name_offset;
+    size_t tail = rdata_len - name_offset - name_len;
+    size_t offset = *len;
+    int count = compressor->count;
+    
+    if (offset + head > size) {
+        return -1;
+    }
+    memcpy(message + offset, answer, head);
+    offset += head;
+    
+    /* a name written past the end of what is kept must not be pointed at */
+    if (compress_name(compressor, message, &offset, size, answer + head, name_len) != 0 || offset + tail > size) {
+        compressor->count = count;
+        return -1;
+    }
+    memcpy(message + offset, answer + head + name_len, tail);
+    offset += tail;
+    
+    unsigned short rdlength = htons(offset - *len - DNS_ANSWER_FIXED_SIZE);
+    memcpy(message + *len + 8, &rdlength, 2);
+    *len = offset;
+    return 0;
+}
+
+int dns_compress_record(DNSCompressor *compressor, unsigned char *message, size_t *len, size_t size,
+                        const unsigned char *record, size_t record_size)
+{
+    int name_len = name_length(record, record_size);
+    
+    if (name_len < 0 || (size_t)name_len + DNS_ANSWER_FIXED_SIZE > record_size) {
+        return -1;
+    }
+    
+    unsigned short rdlength;
+    memcpy(&rdlength, record + name_len + 8, 2);
+    size_t rest = DNS_ANSWER_FIXED_SIZE + ntohs(rdlength);
+    size_t offset = *len;
+    int count = compressor->count;
+    
+    if ((size_t)name_len + rest > record_size) {
+        return -1;
+    }
+    if (compress_name(compressor, message, &offset, size, record, name_len) != 0 || offset + rest > size) {
+        compressor->count = count;
+        return -1;
+    }
+    memcpy(message + offset, record + name_len, rest);
+    *len = offset + rest;
+    return name_len + rest;
+}
@@ -0,0 +1,97 @@
+#include "dns_server.h"
+#include "dns_epoch.h"
+
+typedef struct
+{
+    uint64_t epoch;
+    int in_use;
+    char pad[64 - sizeof(uint64_t) - sizeof(int)];
+} __attribute__((aligned(64))) EpochSlot;
+
+static EpochSlot epoch_slots[EPOCH_MAX_READERS];
+static uint64_t global_epoch = 1;
+static int epoch_slot_count = 0;
+
+static pthread_once_t epoch_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t epoch_key;
+static __thread EpochSlot *thread_slot = NULL;
+
+static void release_epoch_slot(void *arg)
+{
+    EpochSlot *slot = (EpochSlot *)arg;
+    __atomic_store_n(&slot->epoch, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&slot->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void create_epoch_key(void)
+{
+    pthread_key_create(&epoch_key, release_epoch_slot);
+}
+
+static EpochSlot *acquire_epoch_slot(void)
+{
+    pthread_once(&epoch_key_once, create_epoch_key);
+    
+    /* reuse slots released by exited threads before growing the table */
+    int count = __atomic_load_n(&epoch_slot_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&epoch_slots[i].in_use, &expected, 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            pthread_setspecific(epoch_key, &epoch_slots[i]);
+            return &epoch_slots[i];
+        }
+    }
+    
+    int index = __atomic_fetch_add(&epoch_slot_count, 1, __ATOMIC_ACQ_REL);
+    if (index >= EPOCH_MAX_READERS) {
+        __atomic_fetch_sub(&epoch_slot_count, 1, __ATOMIC_ACQ_REL);
+        log_message(LOG_ERROR, "Out of epoch reader slots (max %d)", EPOCH_MAX_READERS);
+        return NULL;
+    }
+    
+    __atomic_store_n(&epoch_slots[index].in_use, 1, __ATOMIC_RELEASE);
+    pthread_setspecific(epoch_key, &epoch_slots[index]);
+    return &epoch_slots[index];
+}
+
+int epoch_enter(void)
+{
+    if (thread_slot == NULL) {
+        thread_slot = acquire_epoch_slot();
+        if (thread_slot == NULL) {
+            return -1;
+        }
+    }
+    
+    uint64_t epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&thread_slot->epoch, epoch, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+void epoch_exit(void)
+{
+    __atomic_store_n(&thread_slot->epoch, 0, __ATOMIC_RELEASE);
+}
+
+uint64_t epoch_advance(void)
+{
+    return __atomic_add_fetch(&global_epoch, 1, __ATOMIC_SEQ_CST);
+}
+
+int epoch_safe(uint64_t retire_epoch)
+{
+    int count = __atomic_load_n(&epoch_slot_count, __ATOMIC_ACQUIRE);
+    if (count > EPOCH_MAX_READERS) {
+        count = EPOCH_MAX_READERS;
+    }
+    
+    for (int i = 0; i < count; i++) {
+        uint64_t epoch = __atomic_load_n(&epoch_slots[i].epoch, __ATOMIC_SEQ_CST);
+        if (epoch != 0 && epoch < retire_epoch) {
+            return 0;
+        }
+    }
+    
+    return 1;
+}
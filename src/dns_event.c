@@ -0,0 +1,327 @@
+#include "dns_event.h"
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#define EVENT_LOOP_MAX_EVENTS 64
+
+int shutdown_event_fd = -1;
+
+int init_shutdown_event(void)
+{
+    shutdown_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shutdown_event_fd < 0) {
+        log_message(LOG_ERROR, "eventfd error: %s", strerror(errno));
+        return -1;
+    }
+    
+    return 0;
+}
+
+/*
+ * async-signal-safe. the shutdown eventfd is never read, so it stays readable
+ * and wakes every event loop that registered it.
+ */
+void signal_shutdown(void)
+{
+    running = 0;
+    
+    if (shutdown_event_fd >= 0) {
+        uint64_t one = 1;
+        ssize_t n = write(shutdown_event_fd, &one, sizeof(one));
+        (void)n;
+    }
+}
+
+void cleanup_shutdown_event(void)
+{
+    if (shutdown_event_fd >= 0) {
+        close(shutdown_event_fd);
+        shutdown_event_fd = -1;
+    }
+}
+
+static void handle_shutdown_event(DNSEventLoop *loop, int fd, uint32_t events, void *arg)
+{
+    (void)fd;
+    (void)events;
+    (void)arg;
+    loop->stop = 1;
+}
+
+static DNSEventSource *find_source(DNSEventLoop *loop, int fd)
+{
+    return fd >= 0 && fd < loop->by_fd_size ? loop->by_fd[fd] : NULL;
+}
+
+/* grows the fd index to hold fd, doubling so a loop filling up with connections reallocates rarely */
+static int index_fd(DNSEventLoop *loop, int fd)
+{
+    if (fd < loop->by_fd_size) {
+        return 0;
+    }
+    
+    int size = loop->by_fd_size > 0 ? loop->by_fd_size : 64;
+    while (size <= fd) {
+        size *= 2;
+    }
+    
+    DNSEventSource **by_fd = realloc(loop->by_fd, (size_t)size * sizeof(DNSEventSource *));
+    if (by_fd == NULL) {
+        log_message(LOG_ERROR, "Failed to grow event source index: %s", strerror(errno));
+        return -1;
+    }
+    
+    memset(by_fd + loop->by_fd_size, 0, (size_t)(size - loop->by_fd_size) * sizeof(DNSEventSource *));
+    loop->by_fd = by_fd;
+    loop->by_fd_size = size;
+    return 0;
+}
+
+static DNSEventSource *add_source(DNSEventLoop *loop, int fd, int internal, uint32_t events,
+                                  dns_event_handler handler, void *arg)
+{
+    if (fd < 0 || index_fd(loop, fd) != 0) {
+        return NULL;
+    }
+    
+    DNSEventSource *source = calloc(1, sizeof(DNSEventSource));
+    if (source == NULL) {
+        log_message(LOG_ERROR, "Failed to allocate event source: %s", strerror(errno));
+        return NULL;
+    }
+    
+    source->fd = fd;
+    source->internal = internal;
+    source->handler = handler;
+    source->arg = arg;
+    
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = source;
+    
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        log_message(LOG_ERROR, "epoll_ctl add error for fd %d: %s", fd, strerror(errno));
+        free(source);
+        return NULL;
+    }
+    
+    source->next = loop->sources;
+    if (loop->sources != NULL) {
+        loop->sources->prev = source;
+    }
+    loop->sources = source;
+    loop->by_fd[fd] = source;
+    return source;
+}
+
+static void handle_notify_event(DNSEventLoop *loop, int fd, uint32_t events, void *arg)
+{
+    (void)loop;
+    (void)fd;
+    (void)events;
+    (void)arg;
+}
+
+int event_loop_init(DNSEventLoop *loop, dns_event_handler notify_handler, void *arg)
+{
+    memset(loop, 0, sizeof(*loop));
+    loop->notify_fd = -1;
+    
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        log_message(LOG_ERROR, "epoll_create1 error: %s", strerror(errno));
+        return -1;
+    }
+    
+    if (shutdown_event_fd >= 0 &&
+        add_source(loop, shutdown_event_fd, 0, EPOLLIN, handle_shutdown_event, NULL) == NULL) {
+        event_loop_destroy(loop);
+        return -1;
+    }
+    
+    loop->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->notify_fd < 0) {
+        log_message(LOG_ERROR, "eventfd error: %s", strerror(errno));
+        event_loop_destroy(loop);
+        return -1;
+    }
+    
+    DNSEventSource *notify = add_source(loop, loop->notify_fd, 1, EPOLLIN,
+                                        notify_handler != NULL ? notify_handler : handle_notify_event, arg);
+    if (notify == NULL) {
+        close(loop->notify_fd);
+        loop->notify_fd = -1;
+        event_loop_destroy(loop);
+        return -1;
+    }
+    
+    return 0;
+}
+
+int event_loop_add(DNSEventLoop *loop, int fd, uint32_t events, dns_event_handler handler, void *arg)
+{
+    return add_source(loop, fd, 0, events, handler, arg) != NULL ? 0 : -1;
+}
+
+int event_loop_modify(DNSEventLoop *loop, int fd, uint32_t events)
+{
+    DNSEventSource *source = find_source(loop, fd);
+    if (source == NULL) {
+        return -1;
+    }
+    
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = source;
+    
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+        log_message(LOG_ERROR, "epoll_ctl mod error for fd %d: %s", fd, strerror(errno));
+        return -1;
+    }
+    
+    return 0;
+}
+
+/*
+ * the source is only unlinked after the current dispatch round, so handlers
+ * may remove any fd, including ones with events still pending in this round.
+ */
+int event_loop_remove(DNSEventLoop *loop, int fd)
+{
+    DNSEventSource *source = find_source(loop, fd);
+    if (source == NULL) {
+        return -1;
+    }
+    
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    source->removed = 1;
+    loop->by_fd[fd] = NULL;
+    
+    if (source->prev != NULL) {
+        source->prev->next = source->next;
+    } else {
+        loop->sources = source->next;
+    }
+    if (source->next != NULL) {
+        source->next->prev = source->prev;
+    }
+    source->next = loop->removed;
+    loop->removed = source;
+    
+    if (source->internal) {
+        close(source->fd);
+    }
+    
+    return 0;
+}
+
+int event_loop_add_timer(DNSEventLoop *loop, int interval_ms, dns_event_handler handler, void *arg)
+{
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        log_message(LOG_ERROR, "timerfd_create error: %s", strerror(errno));
+        return -1;
+    }
+    
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = interval_ms / 1000;
+    spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+    spec.it_value = spec.it_interval;
+    
+    if (timerfd_settime(timer_fd, 0, &spec, NULL) < 0) {
+        log_message(LOG_ERROR, "timerfd_settime error: %s", strerror(errno));
+        close(timer_fd);
+        return -1;
+    }
+    
+    if (add_source(loop, timer_fd, 1, EPOLLIN, handler, arg) == NULL) {
+        close(timer_fd);
+        return -1;
+    }
+    
+    return timer_fd;
+}
+
+void event_loop_notify(DNSEventLoop *loop)
+{
+    uint64_t one = 1;
+    ssize_t n = write(loop->notify_fd, &one, sizeof(one));
+    (void)n;
+}
+
+static void free_sources(DNSEventSource *source)
+{
+    while (source != NULL) {
+        DNSEventSource *next = source->next;
+        free(source);
+        source = next;
+    }
+}
+
+int event_loop_dispatch(DNSEventLoop *loop, int timeout_ms)
+{
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    
+    int n = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, timeout_ms);
+    
+    if (n < 0) {
+        if (errno != EINTR) {
+            log_message(LOG_ERROR, "epoll_wait error: %s", strerror(errno));
+        }
+        return 0;
+    }
+    
+    for (int i = 0; i < n; i++) {
+        DNSEventSource *source = (DNSEventSource *)events[i].data.ptr;
+        
+        if (source->removed) {
+            continue;
+        }
+        
+        if (source->internal) {
+            /* timerfd and notify eventfd must be drained or they stay readable */
+            uint64_t count;
+            while (read(source->fd, &count, sizeof(count)) > 0) {
+            }
+        }
+        
+        source->handler(loop, source->fd, events[i].events, source->arg);
+    }
+    
+    free_sources(loop->removed);
+    loop->removed = NULL;
+    
+    return n;
+}
+
+void event_loop_run(DNSEventLoop *loop)
+{
+    while (running && !loop->stop) {
+        event_loop_dispatch(loop, -1);
+    }
+}
+
+void event_loop_destroy(DNSEventLoop *loop)
+{
+    for (DNSEventSource *source = loop->sources; source != NULL; source = source->next) {
+        if (source->internal) {
+            close(source->fd);
+        }
+    }
+    
+    free_sources(loop->sources);
+    free_sources(loop->removed);
+    free(loop->by_fd);
+    loop->sources = NULL;
+    loop->removed = NULL;
+    loop->by_fd = NULL;
+    loop->by_fd_size = 0;
+    loop->notify_fd = -1;
+    
+    if (loop->epoll_fd >= 0) {
+        close(loop->epoll_fd);
+        loop->epoll_fd = -1;
+    }
+}
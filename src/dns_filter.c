@@ -0,0 +1,172 @@
+#include "dns_filter.h"
+#include "dns_name_tree.h"
+#include "dns_phash.h"
+
+#define FILTER_ROOT_SEED 0x6a09e667f3bcc908ULL
+#define FILTER_WILDCARD_SALT 0xbb67ae8584caa73bULL
+
+static const uint32_t filter_salts[FILTER_BLOCK_WORDS] = {
+    0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du,
+    0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u
+};
+
+/* a wildcard apex goes in under a different key than the same name as an owner */
+static uint64_t wildcard_key(uint64_t hash)
+{
+    return phash_mix(hash ^ FILTER_WILDCARD_SALT);
+}
+
+/* the block comes from the high half of the hash, one bit per word from the low half */
+static void filter_set(DNSNameFilter *filter, uint64_t hash)
+{
+    uint32_t *block = filter->blocks[(uint32_t)(hash >> 32) & filter->block_mask];
+    
+    for (int i = 0; i < FILTER_BLOCK_WORDS; i++) {
+        block[i] |= 1u << (((uint32_t)hash * filter_salts[i]) >> 27);
+    }
+}
+
+static int filter_test(const DNSNameFilter *filter, uint64_t hash)
+{
+    const uint32_t *block = filter->blocks[(uint32_t)(hash >> 32) & filter->block_mask];
+    uint32_t missing = 0;
+    
+    for (int i = 0; i < FILTER_BLOCK_WORDS; i++) {
+        missing |= ~block[i] & (1u << (((uint32_t)hash * filter_salts[i]) >> 27));
+    }
+    
+    return missing == 0;
+}
+
+/*
+ * names are hashed label by label from the right, every label seeded with
+ * the hash of the name it belongs to, so one pass over a query yields the
+ * hash of each of its suffixes.
+ */
+static const char *label_start(const char *name, const char *end)
+{
+    while (end > name && end[-1] != '.') {
+        end--;
+    }
+    return end;
+}
+
+static uint64_t name_key(const char *name, size_t len, int wildcard)
+{
+    uint64_t hash = FILTER_ROOT_SEED;
+    const char *end = name + len;
+    
+    while (end > name) {
+        const char *start = label_start(name, end);
+        hash = phash_hash(hash, start, end - start);
+        end = start > name ? start - 1 : name;
+    }
+    
+    return wildcard ? wildcard_key(hash) : hash;
+}
+
+void name_filter_add(DNSNameFilter *filter, const char *name, size_t len, int wildcard)
+{
+    filter_set(filter, name_key(name, len, wildcard));
+}
+
+int name_filter_contains(const DNSNameFilter *filter, const char *name, size_t len, int wildcard)
+{
+    return filter->blocks == NULL || filter_test(filter, name_key(name, len, wildcard));
+}
+
+int name_filter_check(const DNSNameFilter *filter, const char *name, size_t len)
+{
+    if (filter->blocks == NULL) {
+        return 1;
+    }
+    
+    if (len > 0 && name[len - 1] == '.') {
+        len--;
+    }
+    if (len == 0) {
+        return 1;
+    }
+    
+    uint64_t hash = FILTER_ROOT_SEED;
+    const char *end = name + len;
+    
+    for (;;) {
+        const char *start = label_start(name, end);
+        hash = phash_hash(hash, start, end - start);
+        
+        if (start == name) {
+            return filter_test(filter, hash);
+        }
+        
+        /* every proper suffix may own a wildcard covering the name */
+        if (filter_test(filter, wildcard_key(hash))) {
+            return 1;
+        }
+        end = start - 1;
+    }
+}
+
+static void count_names(const char *name, size_t len, const DNSNameNode *node, void *arg)
+{
+    (void)name;
+    uint32_t *count = (uint32_t *)arg;
+    
+    if (len == 0) {
+        return;
+    }
+    
+    *count += node->records[DNS_SCOPE_BASE] != NULL || node->records[DNS_SCOPE_SUBDOMAIN] != NULL;
+    *count += node->records[DNS_SCOPE_WILDCARD] != NULL;
+}
+
+static void add_names(const char *name, size_t len, const DNSNameNode *node, void *arg)
+{
+    DNSNameFilter *filter = (DNSNameFilter *)arg;
+    
+    if (len == 0) {
+        return;
+    }
+    
+    if (node->records[DNS_SCOPE_BASE] != NULL || node->records[DNS_SCOPE_SUBDOMAIN] != NULL) {
+        name_filter_add(filter, name, len, 0);
+    }
+    if (node->records[DNS_SCOPE_WILDCARD] != NULL) {
+        name_filter_add(filter, name, len, 1);
+    }
+}
+
+/* blocks are aligned to their size so a check never straddles two cache lines */
+int name_filter_init(DNSNameFilter *filter, DNSArena *arena, uint32_t names)
+{
+    const size_t block_size = sizeof(filter->blocks[0]);
+    
+    uint64_t bits = (uint64_t)names * FILTER_BITS_PER_NAME;
+    uint32_t block_count = 1;
+    while ((uint64_t)block_count * block_size * 8 < bits) {
+        block_count <<= 1;
+    }
+    
+    unsigned char *memory = arena_calloc(arena, 1, (size_t)block_count * block_size + block_size - 1);
+    if (memory == NULL) {
+        return -1;
+    }
+    
+    filter->blocks = (void *)(((uintptr_t)memory + block_size - 1) & ~(uintptr_t)(block_size - 1));
+    filter->block_mask = block_count - 1;
+    filter->names = names;
+    return 0;
+}
+
+int name_filter_build(DNSNameFilter *filter, DNSArena *arena, const DNSNameNode *root)
+{
+    uint32_t names = 0;
+    
+    name_tree_walk(root, count_names, &names);
+    if (name_filter_init(filter, arena, names) != 0) {
+        return -1;
+    }
+    
+    name_tree_walk(root, add_names, filter);
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "dns_intern.h"
+#include "dns_phash.h"
+#include <stdlib.h>
+#include <string.h>
+
+void intern_init(DNSInternTable *intern, uint64_t seed)
+{
+    memset(intern, 0, sizeof(*intern));
+    intern->seed = seed;
+}
+
+static uint32_t find_slot(const DNSInternSlot *slots, uint32_t capacity, const void *data, size_t len,
+                          uint32_t hash)
+{
+    uint32_t mask = capacity - 1;
+    uint32_t i = hash & mask;
+    
+    while (slots[i].data != NULL &&
+           (slots[i].hash != hash || slots[i].len != len || memcmp(slots[i].data, data, len) != 0)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+const void *intern_find(const DNSInternTable *intern, const void *data, size_t len)
+{
+    if (intern->count == 0 || len > UINT32_MAX) {
+        return NULL;
+    }
+    
+    uint32_t hash = (uint32_t)phash_hash(intern->seed, data, len);
+    return intern->slots[find_slot(intern->slots, intern->capacity, data, len, hash)].data;
+}
+
+/* kept at most three quarters full, so probes stay short */
+static int grow(DNSInternTable *intern)
+{
+    uint32_t capacity = intern->capacity == 0 ? INTERN_MIN_CAPACITY : intern->capacity * 2;
+    if (capacity == 0) {
+        return -1;
+    }
+    
+    DNSInternSlot *slots = calloc(capacity, sizeof(DNSInternSlot));
+    if (slots == NULL) {
+        return -1;
+    }
+    
+    for (uint32_t i = 0; i < intern->capacity; i++) {
+        const DNSInternSlot *slot = &intern->slots[i];
+        if (slot->data != NULL) {
+            slots[find_slot(slots, capacity, slot->data, slot->len, slot->hash)] = *slot;
+        }
+    }
+    
+    free(intern->slots);
+    intern->slots = slots;
+    intern->capacity = capacity;
+    return 0;
+}
+
+int intern_add(DNSInternTable *intern, const void *data, size_t len)
+{
+    if (len > UINT32_MAX || (intern->count >= intern->capacity - intern->capacity / 4 && grow(intern) != 0)) {
+        return -1;
+    }
+    
+    uint32_t hash = (uint32_t)phash_hash(intern->seed, data, len);
+    DNSInternSlot *slot = &intern->slots[find_slot(intern->slots, intern->capacity, data, len, hash)];
+    
+    if (slot->data == NULL) {
+        slot->hash = hash;
+        slot->data = data;
+        slot->len = (uint32_t)len;
+        intern->count++;
+    }
+    return 0;
+}
+
+const void *intern_memdup(DNSInternTable *intern, DNSArena *arena, const void *data, size_t len)
+{
+    const void *copy = intern_find(intern, data, len);
+    if (copy != NULL) {
+        return copy;
+    }
+    
+    copy = arena_memdup(arena, data, len);
+    if (copy == NULL) {
+        return NULL;
+    }
+    
+    /* a copy that could not be indexed is still a valid copy, it just isn't shared */
+    intern_add(intern, copy, len);
+    return copy;
+}
+
+char *intern_strdup(DNSInternTable *intern, DNSArena *arena, const char *str)
+{
+    return (char *)intern_memdup(intern, arena, str, strlen(str) + 1);
+}
+
+void intern_free(DNSInternTable *intern)
+{
+    free(intern->slots);
+    intern->slots = NULL;
+    intern->capacity = 0;
+    intern->count = 0;
+}
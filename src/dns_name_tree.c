@@ -0,0 +1,400 @@
+#include "dns_name_tree.h"
+#include "dns_parser.h"
+
+/* nodes and child tables come from the record table's arena and are freed with it */
+static DNSNameNode *create_node(DNSArena *arena, const unsigned char *label, size_t label_len)
+{
+    DNSNameNode *node = arena_calloc(arena, 1, sizeof(DNSNameNode) + label_len);
+    if (node == NULL) {
+        return NULL;
+    }
+    
+    memcpy(node->label, label, label_len);
+    return node;
+}
+
+DNSNameNode *name_tree_create(DNSArena *arena)
+{
+    static const unsigned char root_label[1] = { 0 };
+    return create_node(arena, root_label, sizeof(root_label));
+}
+
+/* fnv-1a over the wire format label */
+static uint32_t label_hash(const unsigned char *key)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i <= key[0]; i++) {
+        hash = (hash ^ key[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static DNSNameNode *find_child(const DNSNameNode *node, const unsigned char *key, uint32_t hash)
+{
+    if (node->children == NULL) {
+        return NULL;
+    }
+    
+    for (uint32_t i = hash & node->child_mask; node->children[i].node != NULL; i = (i + 1) & node->child_mask) {
+        if (node->children[i].hash == hash &&
+            memcmp(node->children[i].node->label, key, key[0] + 1) == 0) {
+            return node->children[i].node;
+        }
+    }
+    
+    return NULL;
+}
+
+static void place_child(DNSNameSlot *slots, uint32_t mask, uint32_t hash, DNSNameNode *child)
+{
+    uint32_t i = hash & mask;
+    while (slots[i].node != NULL) {
+        i = (i + 1) & mask;
+    }
+    
+    slots[i].hash = hash;
+    slots[i].node = child;
+}
+
+/*
+ * keeps the child table at most three quarters full. an outgrown table stays
+ * in the arena, which bounds the waste to the size of the final table.
+ */
+static int add_child(DNSArena *arena, DNSNameNode *node, uint32_t hash, DNSNameNode *child)
+{
+    uint32_t capacity = node->children != NULL ? node->child_mask + 1 : 0;
+    
+    if ((node->child_count + 1) * 4 > capacity * 3) {
+        uint32_t new_capacity = capacity ? capacity * 2 : 4;
+        DNSNameSlot *slots = arena_calloc(arena, new_capacity, sizeof(DNSNameSlot));
+        if (slots == NULL) {
+            return -1;
+        }
+        
+        for (uint32_t i = 0; i < capacity; i++) {
+            if (node->children[i].node != NULL) {
+                place_child(slots, new_capacity - 1, node->children[i].hash, node->children[i].node);
+            }
+        }
+        
+        node->children = slots;
+        node->child_mask = new_capacity - 1;
+    }
+    
+    place_child(node->children, node->child_mask, hash, child);
+    node->child_count++;
+    return 0;
+}
+
+/*
+ * copies the label ending at end (exclusive) into key in wire format,
+ * lowercased since names compare case-insensitively, and returns its start,
+ * or NULL if the label is empty or too long.
+ */
+static const char *wire_label(const char *name, const char *end, unsigned char *key)
+{
+    const char *start = end;
+    while (start > name && start[-1] != '.') {
+        start--;
+    }
+    
+    size_t len = end - start;
+    if (len == 0 || len > DNS_MAX_LABEL_LEN) {
+        return NULL;
+    }
+    
+    key[0] = (unsigned char)len;
+    dns_normalize_label((char *)key + 1, (const unsigned char *)start, len);
+    return start;
+}
+
+static const char *skip_trailing_dot(const char *name, const char *end)
+{
+    return (end > name && end[-1] == '.') ? end - 1 : end;
+}
+
+/* walks down from the root, creating missing nodes for every label of name */
+static DNSNameNode *find_or_create_node(DNSArena *arena, DNSNameNode *root, const char *name)
+{
+    unsigned char key[DNS_MAX_LABEL_LEN + 1];
+    DNSNameNode *node = root;
+    const char *end = skip_trailing_dot(name, name + strlen(name));
+    
+    while (end > name) {
+        const char *start = wire_label(name, end, key);
+        if (start == NULL) {
+            return NULL;
+        }
+        
+        uint32_t hash = label_hash(key);
+        DNSNameNode *child = find_child(node, key, hash);
+        
+        if (child == NULL) {
+            child = create_node(arena, key, key[0] + 1);
+            if (child == NULL || add_child(arena, node, hash, child) != 0) {
+                return NULL;
+            }
+        }
+        
+        node = child;
+        end = start > name ? start - 1 : name;
+    }
+    
+    return node;
+}
+
+/*
+ * wildcard records are stored on the node of the name they cover, so
+ * "*.example.com" lives on "example.com". returns the name to index the
+ * record under, or NULL if a wildcard record does not start with "*.".
+ */
+static const char *index_name(const DNSRecord *record)
+{
+    const char *domain = record->text->domain;
+    
+    if (record->scope != DNS_SCOPE_WILDCARD) {
+        return domain;
+    }
+    
+    if (strncmp(domain, "*.", 2) != 0 || domain[2] == '\0') {
+        return NULL;
+    }
+    
+    return domain + 2;
+}
+
+int name_tree_insert(DNSArena *arena, DNSNameNode *root, DNSRecord *record)
+{
+    const char *name = index_name(record);
+    if (name == NULL) {
+        return -1;
+    }
+    
+    DNSNameNode *node = find_or_create_node(arena, root, name);
+    if (node == NULL) {
+        return -1;
+    }
+    
+    record->name_next = node->records[record->scope];
+    node->records[record->scope] = record;
+    return 0;
+}
+
+static DNSNameNode *find_node(const DNSNameNode *root, const char *name)
+{
+    unsigned char key[DNS_MAX_LABEL_LEN + 1];
+    const DNSNameNode *node = root;
+    const char *end = skip_trailing_dot(name, name + strlen(name));
+    
+    while (end > name && node != NULL) {
+        const char *start = wire_label(name, end, key);
+        if (start == NULL) {
+            return NULL;
+        }
+        
+        node = find_child(node, key, label_hash(key));
+        end = start > name ? start - 1 : name;
+    }
+    
+    return (DNSNameNode *)node;
+}
+
+/* empty nodes are left in place, the next table version is built without them */
+void name_tree_remove(DNSNameNode *root, DNSRecord *record)
+{
+    const char *name = index_name(record);
+    if (name == NULL) {
+        return;
+    }
+    
+    DNSNameNode *node = find_node(root, name);
+    if (node == NULL) {
+        return;
+    }
+    
+    for (DNSRecord **link = &node->records[record->scope]; *link != NULL; link = &(*link)->name_next) {
+        if (*link == record) {
+            *link = record->name_next;
+            record->name_next = NULL;
+            return;
+        }
+    }
+}
+
+static const DNSRecord *find_type(const DNSRecord *records, unsigned short type)
+{
+    for (; records != NULL; records = records->name_next) {
+        if (records->type_code == type) {
+            return records;
+        }
+    }
+    
+    return NULL;
+}
+
+const DNSRecord *name_tree_find(const DNSNameNode *root, const char *name, int scope, unsigned short type)
+{
+    const DNSNameNode *node = find_node(root, name);
+    if (node == NULL || node == root) {
+        return NULL;
+    }
+    
+    return find_type(node->records[scope], type);
+}
+
+/* the name is built right to left in buf, ending at buf + DNS_NAME_WALK_SIZE - 1 */
+static void walk_node(const DNSNameNode *node, char *buf, size_t pos, dns_name_walk_fn fn, void *arg)
+{
+    const size_t end = DNS_NAME_WALK_SIZE - 1;
+    
+    if (pos < end) {
+        fn(buf + pos, end - pos, node, arg);
+    }
+    
+    if (node->children == NULL) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i <= node->child_mask; i++) {
+        const DNSNameNode *child = node->children[i].node;
+        if (child == NULL) {
+            continue;
+        }
+        
+        size_t label_len = child->label[0];
+        size_t needed = label_len + (pos < end ? 1 : 0);
+        if (needed > pos) {
+            continue;
+        }
+        
+        size_t child_pos = pos - needed;
+        memcpy(buf + child_pos, child->label + 1, label_len);
+        if (pos < end) {
+            buf[child_pos + label_len] = '.';
+        }
+        walk_node(child, buf, child_pos, fn, arg);
+    }
+}
+
+void name_tree_walk(const DNSNameNode *root, dns_name_walk_fn fn, void *arg)
+{
+    char buf[DNS_NAME_WALK_SIZE];
+    buf[DNS_NAME_WALK_SIZE - 1] = '\0';
+    walk_node(root, buf, DNS_NAME_WALK_SIZE - 1, fn, arg);
+}
+
+/*
+ * one walk from the root: remembers the closest enclosing wildcard of the
+ * requested type on the way down, and on reaching the node for name returns
+ * its base record, then its subdomain record, before falling back to that
+ * wildcard. the query path calls this, so it never allocates.
+ */
+const DNSRecord *name_tree_lookup(const DNSNameNode *root, const char *name, unsigned short type, int *scope)
+{
+    unsigned char key[DNS_MAX_LABEL_LEN + 1];
+    const DNSNameNode *node = root;
+    const DNSRecord *wildcard = NULL;
+    const DNSRecord *record;
+    const char *end = skip_trailing_dot(name, name + strlen(name));
+    
+    while (end > name) {
+        if (node != root && (record = find_type(node->records[DNS_SCOPE_WILDCARD], type)) != NULL) {
+            wildcard = record;
+        }
+        
+        const char *start = wire_label(name, end, key);
+        if (start == NULL) {
+            break;
+        }
+        
+        DNSNameNode *child = find_child(node, key, label_hash(key));
+        if (child == NULL) {
+            break;
+        }
+        
+        node = child;
+        end = start > name ? start - 1 : name;
+    }
+    
+    if (end == name && node != root) {
+        if ((record = find_type(node->records[DNS_SCOPE_BASE], type)) != NULL) {
+            *scope = DNS_SCOPE_BASE;
+            return record;
+        }
+        if ((record = find_type(node->records[DNS_SCOPE_SUBDOMAIN], type)) != NULL) {
+            *scope = DNS_SCOPE_SUBDOMAIN;
+            return record;
+        }
+    }
+    
+    *scope = DNS_SCOPE_WILDCARD;
+    return wildcard;
+}
+
+/* the overlay's record of type in records if it has one, a tombstone included, otherwise the base's */
+static const DNSRecord *overlay_type(const DNSNameNode *base, const DNSNameNode *overlay, int scope,
+                                     unsigned short type)
+{
+    const DNSRecord *record = overlay != NULL ? find_type(overlay->records[scope], type) : NULL;
+    
+    if (record == NULL && base != NULL) {
+        record = find_type(base->records[scope], type);
+    }
+    return record;
+}
+
+/*
+ * the same walk as name_tree_lookup(), taken down both trees side by side.
+ * at every name and scope the overlay's record wins, and a tombstone there
+ * counts as no record, so the search goes on as if the base had none.
+ */
+const DNSRecord *name_tree_lookup_overlay(const DNSNameNode *base, const DNSNameNode *overlay, const char *name,
+                                          unsigned short type, int *scope)
+{
+    unsigned char key[DNS_MAX_LABEL_LEN + 1];
+    const DNSNameNode *base_node = base;
+    const DNSNameNode *overlay_node = overlay;
+    const DNSRecord *wildcard = NULL;
+    const DNSRecord *record;
+    const char *end = skip_trailing_dot(name, name + strlen(name));
+    int depth = 0;
+    
+    while (end > name) {
+        if (depth > 0 && (record = overlay_type(base_node, overlay_node, DNS_SCOPE_WILDCARD, type)) != NULL) {
+            wildcard = record->deleted ? wildcard : record;
+        }
+        
+        const char *start = wire_label(name, end, key);
+        if (start == NULL) {
+            break;
+        }
+        
+        uint32_t hash = label_hash(key);
+        const DNSNameNode *base_child = base_node != NULL ? find_child(base_node, key, hash) : NULL;
+        const DNSNameNode *overlay_child = overlay_node != NULL ? find_child(overlay_node, key, hash) : NULL;
+        if (base_child == NULL && overlay_child == NULL) {
+            break;
+        }
+        
+        base_node = base_child;
+        overlay_node = overlay_child;
+        depth++;
+        end = start > name ? start - 1 : name;
+    }
+    
+    if (end == name && depth > 0) {
+        record = overlay_type(base_node, overlay_node, DNS_SCOPE_BASE, type);
+        if (record != NULL && !record->deleted) {
+            *scope = DNS_SCOPE_BASE;
+            return record;
+        }
+        record = overlay_type(base_node, overlay_node, DNS_SCOPE_SUBDOMAIN, type);
+        if (record != NULL && !record->deleted) {
+            *scope = DNS_SCOPE_SUBDOMAIN;
+            return record;
+        }
+    }
+    
+    *scope = DNS_SCOPE_WILDCARD;
+    return wildcard;
+}
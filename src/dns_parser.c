@@ -1,12 +1,67 @@
 #include "dns_parser.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+/*
+ * lowercases 16 bytes from src into dst and returns a bitmask of the bytes
+ * that are '.' or NUL. 'A'..'Z' is shifted to the bottom of the signed
+ * range so one signed compare finds the uppercase letters.
+ */
+static inline int normalize_block(unsigned char *dst, const unsigned char *src)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)src);
+    __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8((char)('A' + 128)));
+    __m128i upper = _mm_cmplt_epi8(shifted, _mm_set1_epi8(-128 + 26));
+    __m128i bad = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')),
+                               _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    
+    _mm_storeu_si128((__m128i *)dst, _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20))));
+    return _mm_movemask_epi8(bad);
+}
+#endif
+
+static inline int normalize_scalar(char *dst, const unsigned char *src, size_t len)
+{
+    int bad = 0;
+    
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = src[i];
+        bad |= c == '.' || c == 0;
+        dst[i] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+    return bad;
+}
+
+int dns_normalize_label(char *dst, const unsigned char *src, size_t len)
+{
+#ifdef __SSE2__
+    /* short labels gain nothing from a vector pass and can't be read as one block */
+    if (len < 16) {
+        return normalize_scalar(dst, src, len) ? -1 : 0;
+    }
+    
+    int bad = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        bad |= normalize_block((unsigned char *)dst + i, src + i);
+    }
+    
+    /* the tail is one last block overlapping bytes already done, which is harmless */
+    if (i < len) {
+        bad |= normalize_block((unsigned char *)dst + len - 16, src + len - 16);
+    }
+    return bad ? -1 : 0;
+#else
+    return normalize_scalar(dst, src, len) ? -1 : 0;
+#endif
+}
+
 int parseDNSQuery(const unsigned char *buffer, size_t buffer_size, 
                  char *domain, size_t domain_size, 
-                 unsigned short *queryType, char *typeString, size_t typeString_size, 
-                 int *query_len)
+                 unsigned short *queryType, int *query_len)
 {
-    if (buffer == NULL || domain == NULL || queryType == NULL || 
-        typeString == NULL || query_len == NULL) {
+    if (buffer == NULL || domain == NULL || queryType == NULL || query_len == NULL) {
         return -1;
     }
 
@@ -17,7 +72,7 @@ int parseDNSQuery(const unsigned char *buffer, size_t buffer_size,
         return -1;
     }
 
-    while (i < buffer_size && buffer[i] != 0 && j < domain_size - 1)
+    while (i < buffer_size && buffer[i] != 0)
     {
         int len = buffer[i];
         i++;
@@ -26,18 +81,17 @@ int parseDNSQuery(const unsigned char *buffer, size_t buffer_size,
             return -1;
         }
         
-        if (i + len > buffer_size) {
+        if (i + len > buffer_size || j + len + 1 > domain_size) {
             return -1;
         }
         
-        for (int k = 0; k < len && j < domain_size - 2; k++)
-        {
-            domain[j++] = buffer[i++];
-        }
-        
-        if (j < domain_size - 1) {
-            domain[j++] = '.';
+        /* names are matched case-insensitively, the question is echoed from the packet as sent */
+        if (dns_normalize_label(domain + j, buffer + i, len) != 0) {
+            return -1;
         }
+        i += len;
+        j += len;
+        domain[j++] = '.';
     }
     
     if (j > 0 && j < domain_size) {
@@ -60,33 +114,6 @@ int parseDNSQuery(const unsigned char *buffer, size_t buffer_size,
 
     *query_len = i - 12;
 
-    switch (*queryType)
-    {
-    case DNS_TYPE_A:
-        snprintf(typeString, typeString_size, "A");
-        break;
-    case DNS_TYPE_AAAA:
-        snprintf(typeString, typeString_size, "AAAA");
-        break;
-    case DNS_TYPE_NS:
-        snprintf(typeString, typeString_size, "NS");
-        break;
-    case DNS_TYPE_CNAME:
-        snprintf(typeString, typeString_size, "CNAME");
-        break;
-    case DNS_TYPE_MX:
-        snprintf(typeString, typeString_size, "MX");
-        break;
-    case DNS_TYPE_TXT:
-        snprintf(typeString, typeString_size, "TXT");
-        break;
-    case DNS_TYPE_SRV:
-        snprintf(typeString, typeString_size, "SRV");
-        break;
-    default:
-        snprintf(typeString, typeString_size, "TYPE%d", *queryType);
-    }
-
     return 0;
 }
 
@@ -130,16 +157,83 @@ int domainToDNSFormat(const char *domain, unsigned char *dns_format, size_t max_
     return -1;
 }
 
-const char *getRecordTypeString(unsigned short type)
+/* offset just past the name at offset, which may end in a pointer, -1 if it runs off the message */
+static long skip_name(const unsigned char *buffer, size_t buffer_size, size_t offset)
+{
+    while (offset < buffer_size) {
+        unsigned char len = buffer[offset];
+        
+        if ((len & 0xC0) == 0xC0) {
+            return offset + 2 <= buffer_size ? (long)offset + 2 : -1;
+        }
+        if (len > 63) {
+            return -1;
+        }
+        
+        offset += len + 1;
+        if (len == 0) {
+            return offset;
+        }
+    }
+    return -1;
+}
+
+int dns_parse_edns(const unsigned char *buffer, size_t buffer_size, size_t offset, DNSEdns *edns)
 {
-    switch (type) {
-        case DNS_TYPE_A:     return "A";
-        case DNS_TYPE_NS:    return "NS";
-        case DNS_TYPE_CNAME: return "CNAME";
-        case DNS_TYPE_MX:    return "MX";
-        case DNS_TYPE_TXT:   return "TXT";
-        case DNS_TYPE_AAAA:  return "AAAA";
-        case DNS_TYPE_SRV:   return "SRV";
-        default:             return "UNKNOWN";
+    const DNSHeader *header = (const DNSHeader *)buffer;
+    int before = ntohs(header->ancount) + ntohs(header->nscount);
+    int records = before + ntohs(header->arcount);
+    
+    memset(edns, 0, sizeof(*edns));
+    
+    for (int i = 0; i < records; i++) {
+        size_t owner = offset;
+        long end = skip_name(buffer, buffer_size, offset);
+        if (end < 0 || (size_t)end + 10 > buffer_size) {
+            return -1;
+        }
+        offset = end;
+        
+        unsigned short type = (buffer[offset] << 8) | buffer[offset + 1];
+        unsigned short rdlength = (buffer[offset + 8] << 8) | buffer[offset + 9];
+        
+        if (type == DNS_TYPE_OPT) {
+            /* only one OPT, in the additional section, owned by the root */
+            if (i < before || edns->present || buffer[owner] != 0) {
+                return -1;
+            }
+            
+            edns->present = 1;
+            edns->payload = (buffer[offset + 2] << 8) | buffer[offset + 3];
+            edns->version = buffer[offset + 5];
+        }
+        
+        offset += 10 + rdlength;
+        if (offset > buffer_size) {
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+int dns_write_opt(unsigned char *response, size_t offset, size_t response_size, unsigned short payload, int rcode)
+{
+    if (offset + DNS_OPT_SIZE > response_size) {
+        return -1;
     }
-}
\ No newline at end of file
+    
+    unsigned char *opt = response + offset;
+    opt[0] = 0;
+    opt[1] = DNS_TYPE_OPT >> 8;
+    opt[2] = DNS_TYPE_OPT & 0xFF;
+    opt[3] = payload >> 8;         /* class is the udp payload size */
+    opt[4] = payload & 0xFF;
+    opt[5] = rcode >> 4;           /* ttl is the upper 8 bits of the extended rcode, version and flags */
+    opt[6] = 0;
+    opt[7] = 0;
+    opt[8] = 0;
+    opt[9] = 0;                    /* no options */
+    opt[10] = 0;
+    return offset + DNS_OPT_SIZE;
+}
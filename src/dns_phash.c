@@ -0,0 +1,166 @@
+#include "dns_phash.h"
+#include <stdlib.h>
+#include <string.h>
+
+uint64_t phash_hash(uint64_t seed, const char *key, size_t len)
+{
+    uint64_t hash = seed ^ (len * 0x9e3779b97f4a7c15ULL);
+    uint64_t word;
+    
+    while (len >= 8) {
+        memcpy(&word, key, 8);
+        hash = (hash ^ phash_mix(word)) * 0x9e3779b97f4a7c15ULL;
+        key += 8;
+        len -= 8;
+    }
+    
+    word = 0;
+    memcpy(&word, key, len);
+    hash = (hash ^ phash_mix(word)) * 0x9e3779b97f4a7c15ULL;
+    return phash_mix(hash);
+}
+
+/* places every bucket, largest first, at the first pilot whose slots are all free */
+static int place_buckets(DNSPerfectHash *phash, const uint64_t *hashes, uint32_t *slots)
+{
+    uint32_t count = phash->key_count;
+    uint32_t bucket_count = phash->bucket_count;
+    int result = -1;
+    
+    uint32_t *bucket_start = calloc((size_t)bucket_count + 1, sizeof(uint32_t));
+    uint32_t *bucket_keys = malloc(((size_t)count + 1) * sizeof(uint32_t));
+    uint32_t *order = malloc((size_t)bucket_count * sizeof(uint32_t));
+    uint8_t *taken = calloc(phash->slot_count, 1);
+    uint32_t *size_start = NULL;
+    
+    if (bucket_start == NULL || bucket_keys == NULL || order == NULL || taken == NULL) {
+        goto out;
+    }
+    
+    /* group keys by bucket */
+    for (uint32_t i = 0; i < count; i++) {
+        bucket_start[(uint32_t)(((hashes[i] >> 32) * bucket_count) >> 32) + 1]++;
+    }
+    uint32_t max_size = 0;
+    for (uint32_t b = 0; b < bucket_count; b++) {
+        if (bucket_start[b + 1] > max_size) {
+            max_size = bucket_start[b + 1];
+        }
+        bucket_start[b + 1] += bucket_start[b];
+    }
+    
+    /* order doubles as the fill cursor per bucket until the buckets are sorted */
+    uint32_t *fill = order;
+    memcpy(fill, bucket_start, (size_t)bucket_count * sizeof(uint32_t));
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t bucket = (uint32_t)(((hashes[i] >> 32) * bucket_count) >> 32);
+        bucket_keys[fill[bucket]++] = i;
+    }
+    
+    /* counting sort of the buckets by descending size */
+    size_start = calloc((size_t)max_size + 2, sizeof(uint32_t));
+    if (size_start == NULL) {
+        goto out;
+    }
+    for (uint32_t b = 0; b < bucket_count; b++) {
+        size_start[max_size - (bucket_start[b + 1] - bucket_start[b]) + 1]++;
+    }
+    for (uint32_t s = 0; s <= max_size; s++) {
+        size_start[s + 1] += size_start[s];
+    }
+    for (uint32_t b = 0; b < bucket_count; b++) {
+        order[size_start[max_size - (bucket_start[b + 1] - bucket_start[b])]++] = b;
+    }
+    
+    for (uint32_t i = 0; i < bucket_count; i++) {
+        uint32_t b = order[i];
+        uint32_t first = bucket_start[b];
+        uint32_t size = bucket_start[b + 1] - first;
+        
+        if (size == 0) {
+            break;
+        }
+        
+        uint32_t pilot;
+        for (pilot = 0; pilot <= PHASH_MAX_PILOT; pilot++) {
+            uint32_t placed;
+            phash->pilots[b] = (uint16_t)pilot;
+            
+            for (placed = 0; placed < size; placed++) {
+                uint32_t key = bucket_keys[first + placed];
+                uint32_t slot = phash_slot(phash, hashes[key]);
+                if (taken[slot]) {
+                    break;
+                }
+                taken[slot] = 1;
+                slots[key] = slot;
+            }
+            
+            if (placed == size) {
+                break;
+            }
+            
+            /* undo the partial placement, including a clash within the bucket */
+            for (uint32_t k = 0; k < placed; k++) {
+                taken[slots[bucket_keys[first + k]]] = 0;
+            }
+        }
+        
+        if (pilot > PHASH_MAX_PILOT) {
+            goto out;
+        }
+    }
+    
+    result = 0;
+
+out:
+    free(bucket_start);
+    free(bucket_keys);
+    free(order);
+    free(taken);
+    free(size_start);
+    return result;
+}
+
+int phash_build(DNSPerfectHash *phash, const char *const *keys, const size_t *lens, uint32_t count,
+                uint32_t *slots)
+{
+    memset(phash, 0, sizeof(*phash));
+    
+    phash->key_count = count;
+    phash->slot_count = (uint32_t)((uint64_t)count * 100 / PHASH_SLOT_LOAD) + 1;
+    phash->bucket_count = count / PHASH_BUCKET_KEYS + 1;
+    phash->pilots = calloc(phash->bucket_count, sizeof(uint16_t));
+    
+    uint64_t *hashes = malloc(((size_t)count + 1) * sizeof(uint64_t));
+    if (phash->pilots == NULL || hashes == NULL) {
+        free(hashes);
+        phash_free(phash);
+        return -1;
+    }
+    
+    /* a failed placement almost always means two keys share a full hash, so try another seed */
+    for (uint64_t seed = 0; seed < PHASH_MAX_SEEDS; seed++) {
+        phash->seed = phash_mix(seed + 0x9e3779b97f4a7c15ULL);
+        
+        for (uint32_t i = 0; i < count; i++) {
+            hashes[i] = phash_hash(phash->seed, keys[i], lens[i]);
+        }
+        
+        if (place_buckets(phash, hashes, slots) == 0) {
+            free(hashes);
+            return 0;
+        }
+        memset(phash->pilots, 0, (size_t)phash->bucket_count * sizeof(uint16_t));
+    }
+    
+    free(hashes);
+    phash_free(phash);
+    return -1;
+}
+
+void phash_free(DNSPerfectHash *phash)
+{
+    free(phash->pilots);
+    phash->pilots = NULL;
+}
@@ -0,0 +1,374 @@
+#include "dns_record_map.h"
+#include "dns_records.h"
+#include "dns_phash.h"
+#include <sys/mman.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* empty is the zero byte, so a freshly mapped array starts out empty without being written */
+#define CTRL_EMPTY 0x00
+#define CTRL_DELETED 0x01
+#define CTRL_FULL 0x80
+
+#define RECORD_MAP_RELEASE_BYTES (1024 * 1024)   /* a multiple of any page size */
+
+static uint8_t hash_tag(uint64_t hash)
+{
+    return (uint8_t)(CTRL_FULL | (hash & 0x7f));
+}
+
+/* bit i is set if control byte i of the group equals tag */
+static uint32_t group_match(const uint8_t *ctrl, uint8_t tag)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_load_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag)));
+#else
+    uint32_t match = 0;
+    for (int i = 0; i < RECORD_MAP_GROUP; i++) {
+        match |= (uint32_t)(ctrl[i] == tag) << i;
+    }
+    return match;
+#endif
+}
+
+/* empty and deleted bytes are the only ones without the high bit set */
+static uint32_t group_match_free(const uint8_t *ctrl)
+{
+#ifdef __SSE2__
+    return ~(uint32_t)_mm_movemask_epi8(_mm_load_si128((const __m128i *)ctrl)) & 0xffff;
+#else
+    uint32_t match = 0;
+    for (int i = 0; i < RECORD_MAP_GROUP; i++) {
+        match |= (uint32_t)!(ctrl[i] & CTRL_FULL) << i;
+    }
+    return match;
+#endif
+}
+
+/* scope and type pick the seed, so one owner's records hash apart from each other */
+static uint64_t key_hash(const DNSRecordMap *map, const char *domain, int scope, unsigned short type)
+{
+    uint64_t key_seed = map->seed ^ (((uint64_t)scope << 16 | type) * 0x9e3779b97f4a7c15ULL);
+    return map->hash(key_seed, domain, strlen(domain));
+}
+
+static int key_matches(const DNSRecord *record, const char *domain, int scope, unsigned short type)
+{
+    return record->type_code == type && record->scope == scope && strcmp(record->text->domain, domain) == 0;
+}
+
+static uint32_t max_load(uint32_t capacity)
+{
+    return (uint32_t)((uint64_t)capacity * RECORD_MAP_LOAD_NUM / RECORD_MAP_LOAD_DEN);
+}
+
+void record_map_init(DNSRecordMap *map, dns_hash_fn hash, uint64_t seed)
+{
+    memset(map, 0, sizeof(*map));
+    map->hash = hash != NULL ? hash : phash_hash;
+    map->seed = seed;
+}
+
+/*
+ * groups are visited in triangular order, which reaches every group of a
+ * power of two sized table before repeating one.
+ */
+static uint32_t find_free(const uint8_t *ctrl, uint32_t capacity, uint64_t hash)
+{
+    uint32_t mask = capacity / RECORD_MAP_GROUP - 1;
+    uint32_t group = (uint32_t)(hash >> 7) & mask;
+    
+    for (uint32_t step = 1;; step++) {
+        uint32_t free_slots = group_match_free(ctrl + group * RECORD_MAP_GROUP);
+        if (free_slots != 0) {
+            return group * RECORD_MAP_GROUP + __builtin_ctz(free_slots);
+        }
+        group = (group + step) & mask;
+    }
+}
+
+static int find_slot(const DNSRecordSlot *slots, const uint8_t *ctrl, uint32_t capacity, const char *domain,
+                     int scope, unsigned short type, uint64_t hash, uint32_t *index)
+{
+    uint32_t mask = capacity / RECORD_MAP_GROUP - 1;
+    uint32_t group = (uint32_t)(hash >> 7) & mask;
+    uint8_t tag = hash_tag(hash);
+    
+    for (uint32_t step = 1;; step++) {
+        const uint8_t *group_ctrl = ctrl + group * RECORD_MAP_GROUP;
+        
+        for (uint32_t match = group_match(group_ctrl, tag); match != 0; match &= match - 1) {
+            uint32_t i = group * RECORD_MAP_GROUP + __builtin_ctz(match);
+            if (slots[i].hash == hash && key_matches(slots[i].record, domain, scope, type)) {
+                *index = i;
+                return 0;
+            }
+        }
+        
+        /* a key is never placed past a group that still had an empty slot */
+        if (group_match(group_ctrl, CTRL_EMPTY) != 0) {
+            return -1;
+        }
+        group = (group + step) & mask;
+    }
+}
+
+/*
+ * slot arrays are mapped directly: freeing arrays this large through
+ * malloc raises its mmap threshold, which leaves later zone allocations on
+ * the heap, where a freed generation stays resident. the pages are only
+ * faulted in as inserts reach them.
+ */
+static DNSRecordSlot *map_slots(uint32_t capacity)
+{
+    DNSRecordSlot *slots = mmap(NULL, (size_t)capacity * (sizeof(DNSRecordSlot) + 1), PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return slots != MAP_FAILED ? slots : NULL;
+}
+
+/*
+ * the slots of a moved record are never read again, only the control bytes
+ * still are, so the old array's slot pages are handed back as the rehash
+ * passes them, RECORD_MAP_RELEASE_BYTES at a time. this is everything below
+ * migrate_pos, rounded down to that.
+ */
+static size_t old_released(const DNSRecordMap *map)
+{
+    return (size_t)map->migrate_pos * sizeof(DNSRecordSlot) / RECORD_MAP_RELEASE_BYTES * RECORD_MAP_RELEASE_BYTES;
+}
+
+static void unmap_old(DNSRecordMap *map)
+{
+    size_t released = old_released(map);
+    
+    if (map->old_slots != NULL) {
+        munmap((uint8_t *)map->old_slots + released,
+               (size_t)map->old_capacity * (sizeof(DNSRecordSlot) + 1) - released);
+    }
+}
+
+/* room for every record in the old array was set aside in growth_left when the rehash began */
+static void migrate(DNSRecordMap *map, uint32_t slots)
+{
+    if (map->old_slots == NULL) {
+        return;
+    }
+    
+    size_t released = old_released(map);
+    uint32_t end = map->old_capacity - map->migrate_pos > slots ? map->migrate_pos + slots : map->old_capacity;
+    
+    for (; map->migrate_pos < end; map->migrate_pos++) {
+        uint32_t i = map->migrate_pos;
+        if (!(map->old_ctrl[i] & CTRL_FULL)) {
+            continue;
+        }
+        
+        uint32_t index = find_free(map->ctrl, map->capacity, map->old_slots[i].hash);
+        map->ctrl[index] = map->old_ctrl[i];
+        map->slots[index] = map->old_slots[i];
+        map->old_ctrl[i] = CTRL_DELETED;
+    }
+    
+    if (old_released(map) > released) {
+        munmap((uint8_t *)map->old_slots + released, old_released(map) - released);
+    }
+    
+    if (map->migrate_pos == map->old_capacity) {
+        unmap_old(map);
+        map->old_slots = NULL;
+        map->old_ctrl = NULL;
+        map->old_capacity = 0;
+        map->migrate_pos = 0;
+    }
+}
+
+/*
+ * starts moving every record into a fresh array of capacity slots, dropping
+ * deleted ones as they go. a rehash leaves at least 7/16 of the new array
+ * to inserts, far more than the operations it takes to drain the old one,
+ * so the previous rehash is always done by the time the next one starts.
+ */
+static int resize(DNSRecordMap *map, uint32_t capacity)
+{
+    migrate(map, UINT32_MAX);
+    
+    DNSRecordSlot *slots = map_slots(capacity);
+    if (slots == NULL) {
+        return -1;
+    }
+    
+    map->old_slots = map->slots;
+    map->old_ctrl = map->ctrl;
+    map->old_capacity = map->capacity;
+    map->migrate_pos = 0;
+    
+    map->slots = slots;
+    map->ctrl = (uint8_t *)slots + (size_t)capacity * sizeof(DNSRecordSlot);
+    map->capacity = capacity;
+    map->growth_left = max_load(capacity) - map->count;
+    return 0;
+}
+
+int record_map_reserve(DNSRecordMap *map, uint32_t count)
+{
+    uint32_t capacity = RECORD_MAP_GROUP;
+    
+    while (max_load(capacity) < count) {
+        if (capacity > UINT32_MAX / 4) {
+            return -1;
+        }
+        capacity *= 2;
+    }
+    
+    if (capacity > map->capacity && resize(map, capacity) != 0) {
+        return -1;
+    }
+    
+    migrate(map, UINT32_MAX);
+    return 0;
+}
+
+DNSRecord *record_map_find(const DNSRecordMap *map, const char *domain, int scope, unsigned short type)
+{
+    uint32_t index;
+    
+    if (map->count == 0) {
+        return NULL;
+    }
+    
+    uint64_t hash = key_hash(map, domain, scope, type);
+    if (find_slot(map->slots, map->ctrl, map->capacity, domain, scope, type, hash, &index) == 0) {
+        return map->slots[index].record;
+    }
+    if (map->old_slots != NULL &&
+        find_slot(map->old_slots, map->old_ctrl, map->old_capacity, domain, scope, type, hash, &index) == 0) {
+        return map->old_slots[index].record;
+    }
+    
+    return NULL;
+}
+
+int record_map_insert(DNSRecordMap *map, DNSRecord *record)
+{
+    /* grow once half the usable slots hold records, below that just drop the deleted ones */
+    if (map->growth_left == 0) {
+        uint32_t capacity = map->capacity == 0 ? RECORD_MAP_GROUP : map->capacity;
+        if (map->count >= max_load(capacity) / 2) {
+            if (capacity > UINT32_MAX / 4) {
+                return -1;
+            }
+            capacity *= 2;
+        }
+        if (resize(map, capacity) != 0) {
+            return -1;
+        }
+    }
+    migrate(map, RECORD_MAP_MIGRATE_SLOTS);
+    
+    uint64_t hash = key_hash(map, record->text->domain, record->scope, record->type_code);
+    uint32_t index = find_free(map->ctrl, map->capacity, hash);
+    
+    map->growth_left -= map->ctrl[index] == CTRL_EMPTY;
+    map->ctrl[index] = hash_tag(hash);
+    map->slots[index].hash = hash;
+    map->slots[index].record = record;
+    map->count++;
+    return 0;
+}
+
+int record_map_put(DNSRecordMap *map, DNSRecord *record)
+{
+    const char *domain = record->text->domain;
+    uint32_t index;
+    
+    if (map->count != 0) {
+        uint64_t hash = key_hash(map, domain, record->scope, record->type_code);
+        if (find_slot(map->slots, map->ctrl, map->capacity, domain, record->scope, record->type_code, hash,
+                      &index) == 0) {
+            map->slots[index].record = record;
+            return 0;
+        }
+        if (map->old_slots != NULL &&
+            find_slot(map->old_slots, map->old_ctrl, map->old_capacity, domain, record->scope, record->type_code,
+                      hash, &index) == 0) {
+            map->old_slots[index].record = record;
+            return 0;
+        }
+    }
+    
+    return record_map_insert(map, record);
+}
+
+DNSRecord *record_map_remove(DNSRecordMap *map, const char *domain, int scope, unsigned short type)
+{
+    DNSRecord *record;
+    uint32_t index;
+    
+    if (map->count == 0) {
+        return NULL;
+    }
+    
+    uint64_t hash = key_hash(map, domain, scope, type);
+    if (find_slot(map->slots, map->ctrl, map->capacity, domain, scope, type, hash, &index) == 0) {
+        /* no probe ever went past a group with an empty slot, so the slot can simply be emptied */
+        uint8_t *group = map->ctrl + index / RECORD_MAP_GROUP * RECORD_MAP_GROUP;
+        if (group_match(group, CTRL_EMPTY) != 0) {
+            map->ctrl[index] = CTRL_EMPTY;
+            map->growth_left++;
+        } else {
+            map->ctrl[index] = CTRL_DELETED;
+        }
+        record = map->slots[index].record;
+    } else if (map->old_slots != NULL &&
+               find_slot(map->old_slots, map->old_ctrl, map->old_capacity, domain, scope, type, hash, &index) == 0) {
+        /* nothing is inserted into the old array again */
+        map->old_ctrl[index] = CTRL_DELETED;
+        record = map->old_slots[index].record;
+    } else {
+        return NULL;
+    }
+    
+    map->count--;
+    migrate(map, RECORD_MAP_MIGRATE_SLOTS);
+    return record;
+}
+
+/* positions past the new array walk what is left of the old one */
+DNSRecord *record_map_next(const DNSRecordMap *map, uint32_t *pos)
+{
+    while (*pos < map->capacity) {
+        uint32_t i = (*pos)++;
+        if (map->ctrl[i] & CTRL_FULL) {
+            return map->slots[i].record;
+        }
+    }
+    
+    while (*pos - map->capacity < map->old_capacity) {
+        uint32_t i = (*pos)++ - map->capacity;
+        if (map->old_ctrl[i] & CTRL_FULL) {
+            return map->old_slots[i].record;
+        }
+    }
+    
+    return NULL;
+}
+
+void record_map_free(DNSRecordMap *map)
+{
+    if (map->slots != NULL) {
+        munmap(map->slots, (size_t)map->capacity * (sizeof(DNSRecordSlot) + 1));
+    }
+    unmap_old(map);
+    map->slots = NULL;
+    map->ctrl = NULL;
+    map->capacity = 0;
+    map->count = 0;
+    map->growth_left = 0;
+    map->old_slots = NULL;
+    map->old_ctrl = NULL;
+    map->old_capacity = 0;
+    map->migrate_pos = 0;
+}
@@ -1,7 +1,21 @@
 #include "dns_records.h"
+#include "dns_types.h"
+#include "dns_event.h"
+#include "dns_epoch.h"
+#include "dns_name_tree.h"
+#include "dns_compiled_zone.h"
+#include "dns_zone_image.h"
+#include "dns_parser.h"
+#include "dns_worker.h"
+#include "dns_tcp.h"
 #include <stdarg.h>
+#include <limits.h>
+#include <sys/random.h>
 
-DNSRecord *dns_records = NULL;
+static DNSRecordTable *dns_table = NULL;
+static DNSRecordTable *retired_tables = NULL;
+static unsigned long published_generation = 0;
+static uint64_t record_hash_seed = 0;
 pthread_mutex_t dns_records_mutex = PTHREAD_MUTEX_INITIALIZER;
 DNSServerConfig config;
 volatile sig_atomic_t running = 1;
@@ -14,119 +28,759 @@ void init_config(void)
     config.default_ttl = DEFAULT_TTL;
     config.auth_token = strdup(DEFAULT_AUTH_TOKEN);
     config.verbose = 0;
+    config.batch_size = DEFAULT_BATCH_SIZE;
+    config.workers = DEFAULT_WORKERS;
+    config.io_backend = DEFAULT_IO_BACKEND;
+    config.cache_size = (size_t)DEFAULT_CACHE_SIZE_MB * 1024 * 1024;
+    config.zone_index = DEFAULT_ZONE_INDEX;
+    config.zone_image = NULL;
+    config.edns_payload = DEFAULT_EDNS_PAYLOAD;
+    config.tcp_connections = DEFAULT_TCP_CONNECTIONS;
+    config.tcp_idle_timeout = DEFAULT_TCP_IDLE_TIMEOUT;
+    config.tcp_reuseport = 0;
 }
 
+/*
+ * every record a lookup can find in the published table, keyed like the
+ * record maps: the compiled zone or base as amended by the overlay. it is
+ * built on the first write that needs it, sized for the table, and from
+ * then on brought up to date in place by every publish, so new owners grow
+ * it one insert at a time and its rehashes are spread over the writes that
+ * follow. only writers use it, under dns_records_mutex.
+ */
+static DNSRecordMap record_index;
+static int record_index_ready = 0;
+
 void init_dns_records(void)
 {
+    /* a per process seed keeps record keys from being picked to collide */
+    if (getrandom(&record_hash_seed, sizeof(record_hash_seed), 0) != sizeof(record_hash_seed)) {
+        record_hash_seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    }
+    
     pthread_mutex_init(&dns_records_mutex, NULL);
-    dns_records = NULL;
+    record_map_init(&record_index, NULL, record_hash_seed);
+    dns_table = create_record_table();
+}
+
+/*
+ * the targets of every record with glue in the compiled zone or base the
+ * writers work on, each as a name and each of its proper suffixes as the
+ * apex of a wildcard that covers it. an A or AAAA write to a name that
+ * isn't in it changes no glue down there, and skips the scan of the
+ * shared records. the filter holds a reference to the records it was
+ * built from and is only used by writers, under dns_records_mutex.
+ */
+static DNSNameFilter glue_targets;
+static DNSArena glue_targets_arena;
+static DNSRecordTable *glue_targets_base = NULL;
+static DNSCompiledZone *glue_targets_zone = NULL;
+
+static void drop_glue_targets(void)
+{
+    arena_free(&glue_targets_arena);
+    memset(&glue_targets, 0, sizeof(glue_targets));
+    free_record_table(glue_targets_base);
+    compiled_zone_release(glue_targets_zone);
+    glue_targets_base = NULL;
+    glue_targets_zone = NULL;
 }
 
 void cleanup_dns_records(void)
 {
     pthread_mutex_lock(&dns_records_mutex);
     
-    DNSRecord *current, *tmp;
-    HASH_ITER(hh, dns_records, current, tmp) {
-        HASH_DEL(dns_records, current);
-        
-        if (current->domain) free(current->domain);
-        if (current->type) free(current->type);
-        if (current->key) free(current->key);
-        
-        if (current->values) {
-            for (int i = 0; i < current->num_values; i++) {
-                if (current->values[i]) free(current->values[i]);
-            }
-            free(current->values);
-        }
-        
-        free(current);
+    /* all readers are gone by now, so nothing needs a grace period */
+    drop_glue_targets();
+    record_map_free(&record_index);
+    free_record_table(dns_table);
+    dns_table = NULL;
+    
+    while (retired_tables != NULL) {
+        DNSRecordTable *next = retired_tables->next_retired;
+        free_record_table(retired_tables);
+        retired_tables = next;
     }
     
     pthread_mutex_unlock(&dns_records_mutex);
     pthread_mutex_destroy(&dns_records_mutex);
 }
 
-void free_dns_record(DNSRecord *record) {
-    if (record == NULL) {
+DNSRecordTable *create_record_table(void)
+{
+    DNSRecordTable *table = calloc(1, sizeof(DNSRecordTable));
+    if (table == NULL) {
+        log_message(LOG_ERROR, "failed to allocate record table: %s", strerror(errno));
+        return NULL;
+    }
+    
+    table->refs = 1;
+    arena_init(&table->arena);
+    intern_init(&table->intern, record_hash_seed);
+    record_map_init(&table->records, NULL, record_hash_seed);
+    
+    table->names = name_tree_create(&table->arena);
+    if (table->names == NULL) {
+        log_message(LOG_ERROR, "failed to allocate name tree: %s", strerror(errno));
+        arena_free(&table->arena);
+        free(table);
+        return NULL;
+    }
+    
+    return table;
+}
+
+/* versions sharing a base are freed by the management thread and at shutdown */
+static DNSRecordTable *retain_record_table(DNSRecordTable *table)
+{
+    if (table != NULL) {
+        __atomic_add_fetch(&table->refs, 1, __ATOMIC_RELAXED);
+    }
+    return table;
+}
+
+/*
+ * records, their strings and the name tree all live in the table's arena,
+ * so only the record map and the arena chunks need to be released.
+ */
+void free_record_table(DNSRecordTable *table)
+{
+    if (table == NULL || __atomic_sub_fetch(&table->refs, 1, __ATOMIC_ACQ_REL) != 0) {
         return;
     }
     
-    for (int i = 0; i < record->num_values; i++) {
-        if (record->values != NULL && record->values[i] != NULL) {
-            free(record->values[i]);
+    record_map_free(&table->records);
+    intern_free(&table->intern);
+    compiled_zone_release(table->compiled);
+    free_record_table(table->base);
+    arena_free(&table->arena);
+    free(table);
+}
+
+int copy_dns_record_to(DNSArena *arena, DNSInternTable *intern, DNSRecord *record, DNSRecordText *text,
+                       const DNSRecord *src)
+{
+    const DNSRecordText *src_text = src->text;
+    size_t answers_len = src->answers_len + src->glue_len;   /* the glue comes along with the answers */
+    
+    text->domain = intern_strdup(intern, arena, src_text->domain);
+    text->values = arena_calloc(arena, src->num_values, sizeof(char *));
+    record->text = text;
+    record->num_values = src->num_values;
+    record->scope = src->scope;
+    record->deleted = src->deleted;
+    record->type_code = src->type_code;
+    record->answers = src->answers != NULL ? (unsigned char *)intern_memdup(intern, arena, src->answers, answers_len) : NULL;
+    record->answers_len = src->answers_len;
+    record->glue_len = src->glue_len;
+    record->name_next = NULL;
+    
+    /* tombstones carry no values or answers */
+    if (text->domain == NULL || 
+        (!record->deleted && (text->values == NULL || record->answers == NULL))) {
+        return -1;
+    }
+    
+    for (int i = 0; i < src->num_values; i++) {
+        text->values[i] = intern_strdup(intern, arena, src_text->values[i]);
+        if (text->values[i] == NULL) {
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+DNSRecord *copy_dns_record(DNSArena *arena, DNSInternTable *intern, const DNSRecord *src)
+{
+    DNSRecord *record = arena_calloc(arena, 1, sizeof(DNSRecord));
+    DNSRecordText *text = arena_calloc(arena, 1, sizeof(DNSRecordText));
+    if (record == NULL || text == NULL || copy_dns_record_to(arena, intern, record, text, src) != 0) {
+        return NULL;
+    }
+    
+    return record;
+}
+
+DNSZoneTtl *copy_zone_ttls(DNSArena *arena, const DNSZoneTtl *zone_ttls, uint32_t count)
+{
+    DNSZoneTtl *copy = count != 0 ? arena_calloc(arena, count, sizeof(DNSZoneTtl)) : NULL;
+    if (copy == NULL) {
+        return NULL;
+    }
+    
+    for (uint32_t i = 0; i < count; i++) {
+        copy[i].apex = arena_strdup(arena, zone_ttls[i].apex);
+        copy[i].ttl = zone_ttls[i].ttl;
+        if (copy[i].apex == NULL) {
+            return NULL;
+        }
+    }
+    
+    return copy;
+}
+
+static int add_record_copy(DNSRecordTable *table, const DNSRecord *record)
+{
+    DNSRecord *copy = copy_dns_record(&table->arena, &table->intern, record);
+    if (copy == NULL) {
+        log_message(LOG_ERROR, "failed to copy %s record %s: %s", dns_type_name(record->type_code),
+                  record->text->domain, strerror(errno));
+        return -1;
+    }
+    
+    if (record_map_insert(&table->records, copy) != 0) {
+        log_message(LOG_ERROR, "failed to index %s record %s: %s", dns_type_name(record->type_code),
+                  record->text->domain, strerror(errno));
+        return -1;
+    }
+    
+    name_tree_insert(&table->arena, table->names, copy);
+    return 0;
+}
+
+/*
+ * published tables are never modified, so every write starts from a private
+ * copy of the current table. a compiled zone or a base is shared and only
+ * the overlay on top of it is copied, and a flat table is shared as it is,
+ * as the base of the copy.
+ */
+DNSRecordTable *clone_record_table(DNSRecordTable *src)
+{
+    DNSRecordTable *table = create_record_table();
+    if (table == NULL || src == NULL) {
+        return table;
+    }
+    
+    table->generation = src->generation;
+    table->compiled = compiled_zone_retain(src->compiled);
+    table->zone_ttls = src->zone_ttls;
+    table->zone_ttl_count = src->zone_ttl_count;
+    
+    if (src->compiled == NULL) {
+        table->base = retain_record_table(src->base != NULL ? src->base : src);
+        if (src->base == NULL) {
+            return table;
+        }
+    }
+    
+    if (record_map_reserve(&table->records, src->records.count) != 0) {
+        log_message(LOG_ERROR, "failed to size record map: %s", strerror(errno));
+        free_record_table(table);
+        return NULL;
+    }
+    
+    const DNSRecord *record;
+    for (uint32_t pos = 0; (record = record_map_next(&src->records, &pos)) != NULL;) {
+        if (add_record_copy(table, record) != 0) {
+            free_record_table(table);
+            return NULL;
+        }
+    }
+    
+    return table;
+}
+
+/* replaces src by a table holding the same records as a compiled zone with an empty overlay */
+static DNSRecordTable *compile_record_table(DNSRecordTable *src)
+{
+    DNSRecordTable *table = create_record_table();
+    if (table == NULL) {
+        free_record_table(src);
+        return NULL;
+    }
+    
+    table->generation = src->generation;
+    table->compiled = compiled_zone_build(src);
+    free_record_table(src);
+    
+    if (table->compiled == NULL) {
+        free_record_table(table);
+        return NULL;
+    }
+    table->zone_ttls = table->compiled->zone_ttls;
+    table->zone_ttl_count = table->compiled->zone_ttl_count;
+    
+    log_message(LOG_INFO, "compiled zone with %u names and %u records into %u slots",
+              table->compiled->name_count, table->compiled->record_count, table->compiled->phash.slot_count);
+    return table;
+}
+
+/* records of the compiled zone or base under the overlay, 0 for a flat table */
+static uint32_t shared_record_count(const DNSRecordTable *table)
+{
+    if (table->compiled != NULL) {
+        return table->compiled->record_count;
+    }
+    return table->base != NULL ? table->base->records.count : 0;
+}
+
+/* the next record of the compiled zone or base from *pos on, start at 0. NULL at the end */
+static const DNSRecord *shared_record_next(const DNSRecordTable *table, uint32_t *pos)
+{
+    if (table->compiled != NULL) {
+        return *pos < table->compiled->record_count ? &table->compiled->records[(*pos)++] : NULL;
+    }
+    return table->base != NULL ? record_map_next(&table->base->records, pos) : NULL;
+}
+
+/* the record of the compiled zone or base with exactly this key, whatever the overlay holds */
+static const DNSRecord *shared_record(const DNSRecordTable *table, const char *domain, int scope,
+                                      unsigned short type)
+{
+    if (table->base != NULL) {
+        return record_map_find(&table->base->records, domain, scope, type);
+    }
+    return compiled_zone_find_record(table->compiled, domain, scope, type);
+}
+
+/*
+ * folds the overlay and the compiled zone or base under it into a new
+ * table once the overlay has grown past ZONE_OVERLAY_MAX: a compiled zone
+ * is compiled again, a base becomes a flat table. keeps the table as it
+ * is if the rebuild fails, it is still complete, only slower to search
+ * and to copy.
+ */
+static DNSRecordTable *merge_overlay(DNSRecordTable *table)
+{
+    if ((table->compiled == NULL && table->base == NULL) || table->records.count <= ZONE_OVERLAY_MAX) {
+        return table;
+    }
+    
+    DNSRecordTable *flat = create_record_table();
+    if (flat == NULL) {
+        return table;
+    }
+    flat->generation = table->generation;
+    flat->zone_ttls = copy_zone_ttls(&flat->arena, table->zone_ttls, table->zone_ttl_count);
+    flat->zone_ttl_count = table->zone_ttl_count;
+    
+    if ((flat->zone_ttl_count != 0 && flat->zone_ttls == NULL) ||
+        record_map_reserve(&flat->records, shared_record_count(table) + table->records.count) != 0) {
+        free_record_table(flat);
+        return table;
+    }
+    
+    const DNSRecord *record;
+    for (uint32_t pos = 0; (record = shared_record_next(table, &pos)) != NULL;) {
+        if (record_map_find(&table->records, record->text->domain, record->scope, record->type_code) == NULL &&
+            add_record_copy(flat, record) != 0) {
+            free_record_table(flat);
+            return table;
+        }
+    }
+    
+    for (uint32_t pos = 0; (record = record_map_next(&table->records, &pos)) != NULL;) {
+        if (!record->deleted && add_record_copy(flat, record) != 0) {
+            free_record_table(flat);
+            return table;
+        }
+    }
+    
+    DNSRecordTable *merged = table->compiled != NULL ? compile_record_table(flat) : flat;
+    if (merged == NULL) {
+        log_message(LOG_WARNING, "failed to merge %u overlay records, keeping the overlay",
+                  table->records.count);
+        return table;
+    }
+    
+    free_record_table(table);
+    return merged;
+}
+
+/* records a lookup can find, the compiled zone or base as amended by the overlay */
+unsigned int record_table_count(const DNSRecordTable *table)
+{
+    if (table->compiled == NULL && table->base == NULL) {
+        return table->records.count;
+    }
+    
+    unsigned int count = shared_record_count(table);
+    const DNSRecord *record;
+    
+    for (uint32_t pos = 0; (record = record_map_next(&table->records, &pos)) != NULL;) {
+        int shadows = shared_record(table, record->text->domain, record->scope, record->type_code) != NULL;
+        
+        if (record->deleted) {
+            count -= shadows;
+        } else {
+            count += !shadows;
         }
     }
     
-    if (record->values != NULL) free(record->values);
-    if (record->key != NULL) free(record->key);
-    if (record->type != NULL) free(record->type);
-    if (record->domain != NULL) free(record->domain);
-    free(record);
+    return count;
+}
+
+/* a table without a filter is still correct, it just looks up every name */
+static void build_name_filter(DNSRecordTable *table)
+{
+    if (table->filter.blocks == NULL &&
+        name_filter_build(&table->filter, &table->arena, table->names) != 0) {
+        log_message(LOG_WARNING, "failed to build name filter: %s", strerror(errno));
+    }
+}
+
+/*
+ * 0 if the filters rule out every record and wildcard for domain. with a
+ * compiled zone or a base the table's own filter only covers the overlay.
+ */
+int record_table_may_hold(const DNSRecordTable *table, const char *domain)
+{
+    size_t len = strlen(domain);
+    const DNSNameFilter *shared = table->compiled != NULL ? &table->compiled->filter
+        : table->base != NULL ? &table->base->filter : NULL;
+    
+    if (shared == NULL) {
+        return name_filter_check(&table->filter, domain, len);
+    }
+    
+    if (name_filter_check(shared, domain, len)) {
+        return 1;
+    }
+    return table->records.count != 0 && name_filter_check(&table->filter, domain, len);
+}
+
+/* caller holds dns_records_mutex */
+DNSRecordTable *current_record_table(void)
+{
+    return dns_table;
+}
+
+/* the record a lookup of exactly this key finds in the table, NULL if there is none or it was deleted */
+static const DNSRecord *visible_record(const DNSRecordTable *table, const char *domain, int scope,
+                                       unsigned short type)
+{
+    const DNSRecord *record = record_map_find(&table->records, domain, scope, type);
+    
+    if (record != NULL) {
+        return record->deleted ? NULL : record;
+    }
+    if (table->compiled == NULL && table->base == NULL) {
+        return NULL;
+    }
+    return shared_record(table, domain, scope, type);
 }
 
-DNSRecord* create_dns_record(const char *domain, const char *type, const char *scope) {
+/* calls visit for every record a lookup can find in the table, stopping at the first that fails */
+static int walk_visible_records(const DNSRecordTable *table,
+                                int (*visit)(const DNSRecord *record, const DNSRecordTable *arg),
+                                const DNSRecordTable *arg)
+{
+    const DNSRecord *record;
+    
+    for (uint32_t pos = 0; (record = shared_record_next(table, &pos)) != NULL;) {
+        if (record_map_find(&table->records, record->text->domain, record->scope, record->type_code) == NULL &&
+            visit(record, arg) != 0) {
+            return -1;
+        }
+    }
+    
+    for (uint32_t pos = 0; (record = record_map_next(&table->records, &pos)) != NULL;) {
+        if (!record->deleted && visit(record, arg) != 0) {
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+static int index_record(const DNSRecord *record, const DNSRecordTable *table)
+{
+    (void)table;
+    return record_map_put(&record_index, (DNSRecord *)record);
+}
+
+/* drops a record of the old table from the index if the new table no longer has its key */
+static int unindex_hidden_record(const DNSRecord *record, const DNSRecordTable *table)
+{
+    if (visible_record(table, record->text->domain, record->scope, record->type_code) == NULL) {
+        record_map_remove(&record_index, record->text->domain, record->scope, record->type_code);
+    }
+    return 0;
+}
+
+static int build_record_index(void)
+{
+    if (record_index_ready) {
+        return 0;
+    }
+    
+    record_map_free(&record_index);
+    if (record_map_reserve(&record_index, record_table_count(dns_table)) != 0 ||
+        walk_visible_records(dns_table, index_record, NULL) != 0) {
+        log_message(LOG_ERROR, "failed to build the record index: %s", strerror(errno));
+        record_map_free(&record_index);
+        return -1;
+    }
+    
+    record_index_ready = 1;
+    return 0;
+}
+
+/*
+ * a table that shares the compiled zone or base of the old one, or has
+ * the old flat table as its base, differs from it only in the two
+ * overlays: keys the old overlay held fall back to the shared records,
+ * then the new overlay is applied. anything else, a fold or a reload, is
+ * walked in full and the index itself is kept. a fold hides no key, so
+ * the old table is only walked for keys to drop when the index ends up
+ * with more of them than the new table.
+ */
+static int update_record_index(const DNSRecordTable *old, const DNSRecordTable *table)
+{
+    const DNSRecord *record;
+    
+    if (!((table->compiled != NULL && table->compiled == old->compiled) ||
+          (table->base != NULL && (table->base == old->base || table->base == old)))) {
+        if (walk_visible_records(table, index_record, NULL) != 0) {
+            return -1;
+        }
+        if (record_index.count != record_table_count(table)) {
+            walk_visible_records(old, unindex_hidden_record, table);
+        }
+        return 0;
+    }
+    
+    /* the records of a flat old table are the base of the new one and stay where they are */
+    if (old->compiled != NULL || old->base != NULL) {
+        for (uint32_t pos = 0; (record = record_map_next(&old->records, &pos)) != NULL;) {
+            const char *domain = record->text->domain;
+            if (record_map_find(&table->records, domain, record->scope, record->type_code) != NULL) {
+                continue;
+            }
+            
+            const DNSRecord *shared = shared_record(table, domain, record->scope, record->type_code);
+            if (shared == NULL) {
+                record_map_remove(&record_index, domain, record->scope, record->type_code);
+            } else if (record_map_put(&record_index, (DNSRecord *)shared) != 0) {
+                return -1;
+            }
+        }
+    }
+    
+    for (uint32_t pos = 0; (record = record_map_next(&table->records, &pos)) != NULL;) {
+        if (record->deleted) {
+            record_map_remove(&record_index, record->text->domain, record->scope, record->type_code);
+        } else if (record_map_put(&record_index, (DNSRecord *)record) != 0) {
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
+/*
+ * swaps in a new table for readers. the caller holds dns_records_mutex. the
+ * previous table is retired and freed once every reader that could still see
+ * it has left its read section.
+ */
+void publish_record_table(DNSRecordTable *table)
+{
+    DNSRecordTable *old = dns_table;
+    
+    /* nothing is added to a published table, its strings no longer need to be found */
+    intern_free(&table->intern);
+    build_name_filter(table);
+    table->generation = (old != NULL ? old->generation : 0) + 1;
+    __atomic_store_n(&dns_table, table, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&published_generation, table->generation, __ATOMIC_RELEASE);
+    
+    /* an index that couldn't follow is built again by the next write */
+    if (record_index_ready && update_record_index(old, table) != 0) {
+        log_message(LOG_WARNING, "failed to update the record index: %s", strerror(errno));
+        record_index_ready = 0;
+    }
+    
+    /* the next write works on the compiled zone or base of this table, or on the table itself */
+    if (glue_targets_zone != table->compiled ||
+        glue_targets_base != (table->compiled != NULL ? NULL : table->base != NULL ? table->base : table)) {
+        drop_glue_targets();
+    }
+    
+    if (old != NULL) {
+        old->retire_epoch = epoch_advance();
+        old->next_retired = retired_tables;
+        retired_tables = old;
+    }
+}
+
+void reclaim_record_tables_locked(void)
+{
+    DNSRecordTable **link = &retired_tables;
+    
+    while (*link != NULL) {
+        DNSRecordTable *table = *link;
+        if (epoch_safe(table->retire_epoch)) {
+            *link = table->next_retired;
+            free_record_table(table);
+        } else {
+            link = &table->next_retired;
+        }
+    }
+}
+
+void reclaim_record_tables(void)
+{
+    pthread_mutex_lock(&dns_records_mutex);
+    reclaim_record_tables_locked();
+    pthread_mutex_unlock(&dns_records_mutex);
+}
+
+/*
+ * bumped by every ADD, DELETE and RELOAD. cached responses carry the
+ * generation they were built from and are only served while it is current.
+ */
+unsigned long dns_records_generation(void)
+{
+    return __atomic_load_n(&published_generation, __ATOMIC_ACQUIRE);
+}
+
+const DNSRecordTable *dns_table_read_lock(void)
+{
+    if (epoch_enter() != 0) {
+        return NULL;
+    }
+    
+    const DNSRecordTable *table = __atomic_load_n(&dns_table, __ATOMIC_SEQ_CST);
+    if (table == NULL) {
+        epoch_exit();
+    }
+    return table;
+}
+
+void dns_table_read_unlock(void)
+{
+    epoch_exit();
+}
+
+int dns_scope_from_string(const char *scope) {
+    if (strcmp(scope, "base") == 0) {
+        return DNS_SCOPE_BASE;
+    } else if (strcmp(scope, "subdomain") == 0) {
+        return DNS_SCOPE_SUBDOMAIN;
+    } else if (strcmp(scope, "wildcard") == 0) {
+        return DNS_SCOPE_WILDCARD;
+    }
+    return -1;
+}
+
+DNSRecord* create_dns_record(DNSRecordTable *table, const char *domain, const char *type, const char *scope) {
     if (domain == NULL || type == NULL || scope == NULL) {
         log_message(LOG_ERROR, "create_dns_record: null parameters provided");
         return NULL;
     }
+    
+    int scope_id = dns_scope_from_string(scope);
+    if (scope_id < 0) {
+        log_message(LOG_ERROR, "unknown record scope: %s", scope);
+        return NULL;
+    }
+    
+    const DNSTypeInfo *type_info = dns_type_by_name(type);
+    if (type_info == NULL) {
+        log_message(LOG_ERROR, "unsupported record type %s for %s", type, domain);
+        return NULL;
+    }
 
-    DNSRecord *record = (DNSRecord *)malloc(sizeof(DNSRecord));
-    if (record == NULL) {
+    DNSRecord *record = (DNSRecord *)arena_alloc(&table->arena, sizeof(DNSRecord));
+    DNSRecordText *text = (DNSRecordText *)arena_alloc(&table->arena, sizeof(DNSRecordText));
+    if (record == NULL || text == NULL) {
         log_message(LOG_ERROR, "failed to allocate memory for dns record: %s", strerror(errno));
         return NULL;
     }
     
-    record->domain = NULL;
-    record->type = NULL;
-    record->key = NULL;
-    record->values = NULL;
+    text->domain = NULL;
+    text->values = NULL;
+    record->text = text;
     record->num_values = 0;
-    
-    record->domain = strdup(domain);
-    if (record->domain == NULL) {
+    record->scope = scope_id;
+    record->deleted = 0;
+    record->type_code = type_info->code;
+    record->answers = NULL;
+    record->answers_len = 0;
+    record->glue_len = 0;
+    record->name_next = NULL;
+    
+    text->domain = intern_strdup(&table->intern, &table->arena, domain);
+    if (text->domain == NULL) {
         log_message(LOG_ERROR, "failed to duplicate domain: %s", strerror(errno));
-        free_dns_record(record);
         return NULL;
     }
     
-    record->type = strdup(type);
-    if (record->type == NULL) {
-        log_message(LOG_ERROR, "failed to duplicate type: %s", strerror(errno));
-        free_dns_record(record);
-        return NULL;
+    return record;
+}
+
+/*
+ * converts every value into a ready to copy answer (type, class, ttl,
+ * rdlength and rdata), so the query path only has to prepend the owner name.
+ * the rrset's ttl is written here once, a query never looks at it.
+ */
+static int encode_record_answers(DNSRecordTable *table, DNSRecord *record, uint32_t rrset_ttl) {
+    DNSRecordText *text = record->text;
+    const DNSTypeInfo *type_info = dns_type_info(record->type_code);
+    
+    unsigned char *answers = malloc(record->num_values * (DNS_ANSWER_FIXED_SIZE + DNS_MAX_RDATA_SIZE));
+    if (answers == NULL) {
+        log_message(LOG_ERROR, "failed to allocate memory for answers: %s", strerror(errno));
+        return 0;
     }
     
-    if (asprintf(&(record->key), "%s_%s_%s", scope, domain, type) == -1) {
-        log_message(LOG_ERROR, "failed to create key: %s", strerror(errno));
-        free_dns_record(record);
-        return NULL;
+    unsigned short type = htons(record->type_code);
+    unsigned short class = htons(1);
+    unsigned int ttl = htonl(rrset_ttl);
+    size_t offset = 0;
+    
+    for (int i = 0; i < record->num_values; i++) {
+        unsigned char *answer = answers + offset;
+        int rdata_len = type_info->encode(text->values[i], answer + DNS_ANSWER_FIXED_SIZE, DNS_MAX_RDATA_SIZE);
+        if (rdata_len < 0) {
+            log_message(LOG_ERROR, "invalid %s value for %s: %s", type_info->name, text->domain, text->values[i]);
+            free(answers);
+            return 0;
+        }
+        
+        unsigned short rdlength = htons(rdata_len);
+        memcpy(answer, &type, 2);
+        memcpy(answer + 2, &class, 2);
+        memcpy(answer + 4, &ttl, 4);
+        memcpy(answer + 8, &rdlength, 2);
+        offset += DNS_ANSWER_FIXED_SIZE + rdata_len;
     }
     
-    return record;
+    record->answers = (unsigned char *)intern_memdup(&table->intern, &table->arena, answers, offset);
+    record->answers_len = offset;
+    free(answers);
+    
+    if (record->answers == NULL) {
+        log_message(LOG_ERROR, "failed to allocate memory for answers: %s", strerror(errno));
+        return 0;
+    }
+    return 1;
 }
 
-int parse_values_to_record(DNSRecord *record, cJSON *values) {
+int parse_values_to_record(DNSRecordTable *table, DNSRecord *record, cJSON *values, uint32_t ttl) {
     if (record == NULL || values == NULL) {
         log_message(LOG_ERROR, "parse_values_to_record: null parameters provided");
         return 0;
     }
+    
+    DNSRecordText *text = record->text;
+    const DNSTypeInfo *type_info = dns_type_info(record->type_code);
 
     record->num_values = cJSON_GetArraySize(values);
     if (record->num_values <= 0) {
-        log_message(LOG_ERROR, "no values provided for %s %s", record->domain, record->type);
+        log_message(LOG_ERROR, "no values provided for %s %s", text->domain, type_info->name);
         return 0;
     }
     
-    record->values = (char **)malloc(record->num_values * sizeof(char *));
-    if (record->values == NULL) {
+    text->values = (char **)arena_alloc(&table->arena, record->num_values * sizeof(char *));
+    if (text->values == NULL) {
         log_message(LOG_ERROR, "failed to allocate memory for values: %s", strerror(errno));
         return 0;
     }
     
     for (int i = 0; i < record->num_values; i++) {
-        record->values[i] = NULL;
+        text->values[i] = NULL;
     }
     
     for (int i = 0; i < record->num_values; i++) {
@@ -136,72 +790,532 @@ int parse_values_to_record(DNSRecord *record, cJSON *values) {
             return 0;
         }
         
-        if (strcmp(record->type, "MX") == 0 && cJSON_IsObject(item)) {
-            cJSON *priority = cJSON_GetObjectItem(item, "priority");
-            cJSON *value = cJSON_GetObjectItem(item, "value");
-            
-            if (priority != NULL && value != NULL && 
-                cJSON_IsNumber(priority) && cJSON_IsString(value)) {
-                char mx_record[256];
-                snprintf(mx_record, sizeof(mx_record), "%d %s", priority->valueint, value->valuestring);
-                record->values[i] = strdup(mx_record);
-            } else {
-                log_message(LOG_ERROR, "invalid mx record format");
-                return 0;
-            }
-        } else if (cJSON_IsString(item)) {
-            record->values[i] = strdup(item->valuestring);
-        } else {
-            log_message(LOG_ERROR, "invalid record value format at index %d", i);
+        char buf[DNS_MAX_VALUE_SIZE];
+        const char *value = type_info->parse(item, buf, sizeof(buf));
+        if (value == NULL) {
+            log_message(LOG_ERROR, "invalid %s value at index %d for %s", type_info->name, i, text->domain);
             return 0;
         }
         
-        if (record->values[i] == NULL) {
-            log_message(LOG_ERROR, "failed to duplicate value: %s", strerror(errno));
+        text->values[i] = intern_strdup(&table->intern, &table->arena, value);
+        if (text->values[i] == NULL) {
+            log_message(LOG_ERROR, "failed to allocate memory for value: %s", strerror(errno));
             return 0;
         }
     }
     
-    return 1;
+    return encode_record_answers(table, record, ttl);
+}
+
+uint32_t dns_record_ttl(const DNSRecord *record)
+{
+    uint32_t ttl = 0;
+    
+    if (record->answers != NULL) {
+        memcpy(&ttl, record->answers + 4, 4);
+    }
+    return ntohl(ttl);
 }
 
-void add_record_to_hash(const char *domain, const char *type, cJSON *values, const char *scope) {
-    if (domain == NULL || type == NULL || values == NULL || scope == NULL) {
+int add_record_to_hash(DNSRecordTable *table, const char *domain, const char *type, cJSON *values, const char *scope,
+                       uint32_t ttl) {
+    if (table == NULL || domain == NULL || type == NULL || values == NULL || scope == NULL) {
         log_message(LOG_ERROR, "add_record_to_hash: invalid parameters");
-        return;
+        return -1;
     }
     
     log_message(LOG_INFO, "adding records for domain: %s, type: %s", domain, type);
     
-    DNSRecord *record = create_dns_record(domain, type, scope);
+    /* anything left behind by a failed add is released with the table's arena */
+    DNSRecord *record = create_dns_record(table, domain, type, scope);
     if (record == NULL) {
-        return; 
+        return -1; 
+    }
+    
+    if (parse_values_to_record(table, record, values, ttl) == 0) {
+        return -1;
+    }
+    
+    DNSRecord *existing_record = record_map_remove(&table->records, record->text->domain, record->scope,
+                                                   record->type_code);
+    if (existing_record != NULL) {
+        name_tree_remove(table->names, existing_record);
+    }
+    
+    if (record_map_insert(&table->records, record) != 0) {
+        log_message(LOG_ERROR, "failed to index %s record for %s: %s", type, domain, strerror(errno));
+        return -1;
+    }
+    
+    if (name_tree_insert(&table->arena, table->names, record) != 0) {
+        log_message(LOG_WARNING, "%s record for %s is not a resolvable name", type, domain);
+    }
+    log_message(LOG_INFO, "added %s record for %s with %d values, ttl %u", type, domain, record->num_values, ttl);
+    return 0;
+}
+
+/* one pre-encoded answer: the fixed fields and its rdata */
+static size_t answer_size(const unsigned char *answer)
+{
+    unsigned short rdlength;
+    memcpy(&rdlength, answer + 8, 2);
+    return DNS_ANSWER_FIXED_SIZE + ntohs(rdlength);
+}
+
+static size_t wire_name_size(const unsigned char *name)
+{
+    size_t len = 0;
+    
+    while (name[len] != 0) {
+        len += name[len] + 1;
+    }
+    return len + 1;
+}
+
+/* the dotted, lowercased form of an uncompressed wire name, -1 for the root or a name that doesn't fit */
+static int glue_target_name(const unsigned char *wire, char *name, size_t size)
+{
+    size_t len = 0;
+    
+    for (; *wire != 0; wire += *wire + 1) {
+        if (len + *wire + 1 > size || dns_normalize_label(name + len, wire + 1, *wire) != 0) {
+            return -1;
+        }
+        len += *wire;
+        name[len++] = '.';
+    }
+    
+    if (len == 0) {
+        return -1;
+    }
+    name[len - 1] = '\0';
+    return 0;
+}
+
+/* the target of the answer at index in the record's answers */
+static const unsigned char *glue_target(const DNSRecord *record, int index)
+{
+    const unsigned char *answer = record->answers;
+    
+    for (int i = 0; i < index; i++) {
+        answer += answer_size(answer);
+    }
+    return answer + DNS_ANSWER_FIXED_SIZE + dns_type_info(record->type_code)->glue_offset;
+}
+
+/* whether an answer ahead of index already names the same target, case aside */
+static int glue_target_seen(const DNSRecord *record, int index, const char *name)
+{
+    char seen[DNS_NAME_WALK_SIZE];
+    
+    for (int i = 0; i < index; i++) {
+        if (glue_target_name(glue_target(record, i), seen, sizeof(seen)) == 0 && strcmp(seen, name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* resolves name against the table's compiled zone, base or own names, with the overlay on top */
+static const DNSRecord *lookup_record(const DNSRecordTable *table, const char *name, unsigned short type,
+                                      int *scope)
+{
+    if (table->compiled != NULL) {
+        return compiled_zone_lookup(table, name, type, scope);
+    }
+    if (table->base == NULL || table->records.count == 0) {
+        return name_tree_lookup(table->base != NULL ? table->base->names : table->names, name, type, scope);
+    }
+    return name_tree_lookup_overlay(table->base->names, table->names, name, type, scope);
+}
+
+/* the records a query for name and type would be answered with, without logging it */
+static const DNSRecord *lookup_glue(const DNSRecordTable *table, const char *name, unsigned short type)
+{
+    int scope;
+    const DNSRecord *record = lookup_record(table, name, type, &scope);
+    
+    return record != NULL && !record->deleted ? record : NULL;
+}
+
+/*
+ * the glue the record should carry in the table as it is now: for every
+ * distinct target of its answers the target's A and then AAAA rrset, each
+ * answer with the target's name in front. an rrset that would take the
+ * glue past DNS_MAX_GLUE_SIZE is left out with everything after it.
+ */
+static size_t collect_glue(const DNSRecordTable *table, const DNSRecord *record, unsigned char *glue)
+{
+    static const unsigned short address_types[] = { DNS_TYPE_A, DNS_TYPE_AAAA };
+    size_t glue_len = 0;
+    
+    for (int i = 0; i < record->num_values; i++) {
+        const unsigned char *target = glue_target(record, i);
+        size_t target_size = wire_name_size(target);
+        char name[DNS_NAME_WALK_SIZE];
+        
+        if (glue_target_name(target, name, sizeof(name)) != 0 || glue_target_seen(record, i, name)) {
+            continue;
+        }
+        
+        for (size_t t = 0; t < sizeof(address_types) / sizeof(address_types[0]); t++) {
+            const DNSRecord *addresses = lookup_glue(table, name, address_types[t]);
+            const unsigned char *address = addresses != NULL ? addresses->answers : NULL;
+            size_t rrset_start = glue_len;
+            
+            for (int a = 0; addresses != NULL && a < addresses->num_values; a++) {
+                size_t size = answer_size(address);
+                if (glue_len + target_size + size > DNS_MAX_GLUE_SIZE) {
+                    return rrset_start;
+                }
+                
+                memcpy(glue + glue_len, target, target_size);
+                memcpy(glue + glue_len + target_size, address, size);
+                glue_len += target_size + size;
+                address += size;
+            }
+        }
+    }
+    
+    return glue_len;
+}
+
+/* puts glue after a copy of the record's answers, unless it already has exactly that glue */
+static int set_record_glue(DNSRecordTable *table, DNSRecord *record, const unsigned char *glue, size_t glue_len)
+{
+    if (glue_len == record->glue_len && memcmp(record->answers + record->answers_len, glue, glue_len) == 0) {
+        return 0;
+    }
+    
+    unsigned char *answers = malloc(record->answers_len + glue_len);
+    if (answers == NULL) {
+        log_message(LOG_ERROR, "failed to allocate memory for glue: %s", strerror(errno));
+        return -1;
+    }
+    
+    memcpy(answers, record->answers, record->answers_len);
+    memcpy(answers + record->answers_len, glue, glue_len);
+    const void *copy = intern_memdup(&table->intern, &table->arena, answers, record->answers_len + glue_len);
+    free(answers);
+    
+    if (copy == NULL) {
+        log_message(LOG_ERROR, "failed to allocate memory for glue: %s", strerror(errno));
+        return -1;
+    }
+    
+    record->answers = (unsigned char *)copy;
+    record->glue_len = (uint16_t)glue_len;
+    return 0;
+}
+
+static int refresh_record_glue(DNSRecordTable *table, DNSRecord *record)
+{
+    unsigned char glue[DNS_MAX_GLUE_SIZE];
+    size_t glue_len = collect_glue(table, record, glue);
+    
+    return set_record_glue(table, record, glue, glue_len);
+}
+
+/* gathers the glue of every NS, MX and SRV record once the whole file is loaded */
+static int attach_glue(DNSRecordTable *table)
+{
+    DNSRecord *record;
+    
+    for (uint32_t pos = 0; (record = record_map_next(&table->records, &pos)) != NULL;) {
+        if (dns_type_info(record->type_code)->glue_offset >= 0 && refresh_record_glue(table, record) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* whether a target of the record is domain, or lies below it when domain is a wildcard "*.<apex>" */
+static int glue_depends_on(const DNSRecord *record, const char *domain, int scope)
+{
+    if (record->deleted || dns_type_info(record->type_code)->glue_offset < 0) {
+        return 0;
     }
     
-    if (parse_values_to_record(record, values) == 0) {
-        free_dns_record(record);
+    if (scope == DNS_SCOPE_WILDCARD && strncmp(domain, "*.", 2) == 0) {
+        domain += 2;
+    }
+    size_t len = strlen(domain);
+    if (len > 0 && domain[len - 1] == '.') {
+        len--;
+    }
+    
+    for (int i = 0; i < record->num_values; i++) {
+        char name[DNS_NAME_WALK_SIZE];
+        if (glue_target_name(glue_target(record, i), name, sizeof(name)) != 0) {
+            continue;
+        }
+        
+        size_t name_len = strlen(name);
+        if (scope == DNS_SCOPE_WILDCARD) {
+            if (name_len > len + 1 && name[name_len - len - 1] == '.' &&
+                strncasecmp(name + name_len - len, domain, len) == 0) {
+                return 1;
+            }
+        } else if (name_len == len && strncasecmp(name, domain, len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* the number of keys the record's targets make, added to filter unless it is NULL */
+static uint32_t walk_glue_targets(const DNSRecord *record, DNSNameFilter *filter)
+{
+    uint32_t keys = 0;
+    
+    for (int i = 0; i < record->num_values; i++) {
+        char name[DNS_NAME_WALK_SIZE];
+        if (glue_target_name(glue_target(record, i), name, sizeof(name)) != 0) {
+            continue;
+        }
+        
+        size_t len = strlen(name);
+        const char *suffix = name;
+        keys++;
+        if (filter != NULL) {
+            name_filter_add(filter, name, len, 0);
+        }
+        
+        while ((suffix = strchr(suffix, '.')) != NULL) {
+            suffix++;
+            keys++;
+            if (filter != NULL) {
+                name_filter_add(filter, suffix, len - (size_t)(suffix - name), 1);
+            }
+        }
+    }
+    return keys;
+}
+
+/* builds the filter for the table's shared records unless it already covers them */
+static void load_glue_targets(const DNSRecordTable *table)
+{
+    if (table->base == glue_targets_base && table->compiled == glue_targets_zone) {
         return;
     }
     
-    DNSRecord *existing_record = NULL;
-    HASH_FIND_STR(dns_records, record->key, existing_record);
+    drop_glue_targets();
+    arena_init(&glue_targets_arena);
     
-    if (existing_record != NULL) {
-        HASH_DEL(dns_records, existing_record);
-        free_dns_record(existing_record);
+    const DNSRecord *record;
+    uint32_t keys = 0;
+    for (uint32_t pos = 0; (record = shared_record_next(table, &pos)) != NULL;) {
+        if (dns_type_info(record->type_code)->glue_offset >= 0) {
+            keys += walk_glue_targets(record, NULL);
+        }
+    }
+    
+    /* without a filter every write scans, as it would without the cache */
+    if (name_filter_init(&glue_targets, &glue_targets_arena, keys) != 0) {
+        memset(&glue_targets, 0, sizeof(glue_targets));
+        return;
     }
     
-    HASH_ADD_KEYPTR(hh, dns_records, record->key, strlen(record->key), record);
-    log_message(LOG_INFO, "added %s record for %s with %d values", type, domain, record->num_values);
+    for (uint32_t pos = 0; (record = shared_record_next(table, &pos)) != NULL;) {
+        if (dns_type_info(record->type_code)->glue_offset >= 0) {
+            walk_glue_targets(record, &glue_targets);
+        }
+    }
+    
+    glue_targets_base = retain_record_table(table->base);
+    glue_targets_zone = compiled_zone_retain(table->compiled);
 }
 
-int loadDNSMappings(const char *filename)
+/* 0 if no record of the compiled zone or base has a target that domain covers */
+static int shared_glue_depends_on(const DNSRecordTable *table, const char *domain, int scope)
+{
+    if (table->base == NULL && table->compiled == NULL) {
+        return 0;
+    }
+    load_glue_targets(table);
+    
+    if (scope == DNS_SCOPE_WILDCARD && strncmp(domain, "*.", 2) == 0) {
+        domain += 2;
+    }
+    
+    char name[DNS_NAME_WALK_SIZE];
+    size_t len = strlen(domain);
+    if (len >= sizeof(name)) {
+        return 1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        name[i] = (char)tolower((unsigned char)domain[i]);
+    }
+    if (len > 0 && name[len - 1] == '.') {
+        len--;
+    }
+    
+    return name_filter_contains(&glue_targets, name, len, scope == DNS_SCOPE_WILDCARD);
+}
+
+/*
+ * brings glue up to date after the rrset of type at domain was added or
+ * deleted in a private table: the rrset's own glue, and if its addresses
+ * changed the glue of every record with a target they cover. a record of
+ * the compiled zone or base whose glue changes is replaced through the
+ * overlay. those records are only scanned when glue_targets says one of
+ * them may have a target the write covers.
+ */
+static int update_glue(DNSRecordTable *table, const char *domain, int scope, unsigned short type)
+{
+    DNSRecord *record;
+    
+    if (dns_type_info(type)->glue_offset >= 0) {
+        record = record_map_find(&table->records, domain, scope, type);
+        if (record != NULL && !record->deleted && refresh_record_glue(table, record) != 0) {
+            return -1;
+        }
+    }
+    
+    if (type != DNS_TYPE_A && type != DNS_TYPE_AAAA) {
+        return 0;
+    }
+    
+    for (uint32_t pos = 0; (record = record_map_next(&table->records, &pos)) != NULL;) {
+        if (glue_depends_on(record, domain, scope) && refresh_record_glue(table, record) != 0) {
+            return -1;
+        }
+    }
+    
+    if (!shared_glue_depends_on(table, domain, scope)) {
+        return 0;
+    }
+    
+    const DNSRecord *shared;
+    unsigned char glue[DNS_MAX_GLUE_SIZE];
+    
+    for (uint32_t pos = 0; (shared = shared_record_next(table, &pos)) != NULL;) {
+        if (!glue_depends_on(shared, domain, scope) ||
+            record_map_find(&table->records, shared->text->domain, shared->scope, shared->type_code) != NULL) {
+            continue;
+        }
+        
+        size_t glue_len = collect_glue(table, shared, glue);
+        if (glue_len == shared->glue_len &&
+            memcmp(shared->answers + shared->answers_len, glue, glue_len) == 0) {
+            continue;
+        }
+        
+        record = copy_dns_record(&table->arena, &table->intern, shared);
+        if (record == NULL || set_record_glue(table, record, glue, glue_len) != 0 ||
+            record_map_insert(&table->records, record) != 0) {
+            log_message(LOG_ERROR, "failed to update glue of %s: %s", shared->text->domain, strerror(errno));
+            return -1;
+        }
+        name_tree_insert(&table->arena, table->names, record);
+    }
+    
+    return 0;
+}
+
+/* one record per type under a name, so the record map is sized once before loading */
+static uint32_t count_mapping_records(const cJSON *domains)
+{
+    uint32_t count = 0;
+    const cJSON *domain = NULL;
+    
+    cJSON_ArrayForEach(domain, domains) {
+        count += cJSON_GetArraySize(cJSON_GetObjectItem(domain, "records"));
+        count += cJSON_GetArraySize(cJSON_GetObjectItem(cJSON_GetObjectItem(domain, "wildcards"), "records"));
+        
+        const cJSON *subdomain = NULL;
+        cJSON_ArrayForEach(subdomain, cJSON_GetObjectItem(domain, "subdomains")) {
+            count += cJSON_GetArraySize(cJSON_GetObjectItem(subdomain, "records"));
+        }
+    }
+    
+    return count;
+}
+
+/* the "ttl" of a zone or rrset object, fallback if it has none. -1 if it isn't a valid ttl */
+static int mapping_ttl(const cJSON *object, const char *owner, uint32_t fallback, uint32_t *ttl)
+{
+    const cJSON *item = cJSON_GetObjectItem(object, "ttl");
+    
+    if (item == NULL) {
+        *ttl = fallback;
+        return 0;
+    }
+    
+    if (!cJSON_IsNumber(item) || item->valuedouble < 0 || item->valuedouble > MAX_TTL ||
+        item->valuedouble != (double)(uint32_t)item->valuedouble) {
+        log_message(LOG_ERROR, "invalid ttl for %s, expected whole seconds from 0 to %d", owner, MAX_TTL);
+        return -1;
+    }
+    
+    *ttl = (uint32_t)item->valuedouble;
+    return 0;
+}
+
+/* records the ttl of the zone at apex in the table's zone_ttls, which has room for every zone */
+static int add_zone_ttl(DNSRecordTable *table, DNSZoneTtl *zone_ttls, const char *apex, uint32_t ttl)
+{
+    char *name = arena_strdup(&table->arena, apex);
+    if (name == NULL) {
+        log_message(LOG_ERROR, "failed to copy zone name %s: %s", apex, strerror(errno));
+        return -1;
+    }
+    
+    size_t len = strlen(name);
+    for (size_t i = 0; i < len; i++) {
+        name[i] = (char)tolower((unsigned char)name[i]);
+    }
+    if (len > 0 && name[len - 1] == '.') {
+        name[len - 1] = '\0';
+    }
+    
+    zone_ttls[table->zone_ttl_count].apex = name;
+    zone_ttls[table->zone_ttl_count].ttl = ttl;
+    table->zone_ttl_count++;
+    return 0;
+}
+
+static int compare_zone_ttls(const void *a, const void *b)
+{
+    return strcmp(((const DNSZoneTtl *)a)->apex, ((const DNSZoneTtl *)b)->apex);
+}
+
+/*
+ * an rrset is either the array of its values, which takes the zone's ttl,
+ * or an object with "values" and a "ttl" of its own.
+ */
+static int add_mapping_rrset(DNSRecordTable *table, const char *owner, const char *type, cJSON *rrset,
+                             const char *scope, uint32_t zone_ttl)
+{
+    uint32_t ttl = zone_ttl;
+    cJSON *values = rrset;
+    
+    if (cJSON_IsObject(rrset)) {
+        values = cJSON_GetObjectItem(rrset, "values");
+        if (values == NULL) {
+            log_message(LOG_ERROR, "%s record for %s has no values", type, owner);
+            return -1;
+        }
+        if (mapping_ttl(rrset, owner, zone_ttl, &ttl) != 0) {
+            return -1;
+        }
+    }
+    
+    return add_record_to_hash(table, owner, type, values, scope, ttl);
+}
+
+/*
+ * parses and validates the mappings file into a new private table without
+ * taking any lock. returns NULL and leaves the published table untouched if
+ * anything in the file is invalid.
+ */
+static DNSRecordTable *build_record_table(const char *filename)
 {
     FILE *file = fopen(filename, "rb");
     if (file == NULL) {
         log_message(LOG_ERROR, "Failed to open DNS mappings file %s: %s", 
                   filename, strerror(errno));
-        return -1;
+        return NULL;
     }
     
     fseek(file, 0, SEEK_END);
@@ -211,14 +1325,14 @@ int loadDNSMappings(const char *filename)
     if (length <= 0) {
         log_message(LOG_ERROR, "Empty or invalid mappings file: %s", filename);
         fclose(file);
-        return -1;
+        return NULL;
     }
     
     char *data = (char *)malloc(length + 1);
     if (data == NULL) {
         log_message(LOG_ERROR, "Memory allocation error: %s", strerror(errno));
         fclose(file);
-        return -1;
+        return NULL;
     }
     
     size_t bytes_read = fread(data, 1, length, file);
@@ -227,7 +1341,7 @@ int loadDNSMappings(const char *filename)
     if (bytes_read != length) {
         log_message(LOG_ERROR, "Failed to read entire file: %s", strerror(errno));
         free(data);
-        return -1;
+        return NULL;
     }
     
     data[length] = '\0';
@@ -237,7 +1351,7 @@ int loadDNSMappings(const char *filename)
         log_message(LOG_ERROR, "JSON parsing error: %s", 
                   cJSON_GetErrorPtr() ? cJSON_GetErrorPtr() : "unknown error");
         free(data);
-        return -1;
+        return NULL;
     }
     
     cJSON *domains = cJSON_GetObjectItem(json, "domains");
@@ -245,15 +1359,39 @@ int loadDNSMappings(const char *filename)
         log_message(LOG_ERROR, "Invalid schema: 'domains' key missing or not an object");
         free(data);
         cJSON_Delete(json);
-        return -1;
+        return NULL;
     }
     
-    pthread_mutex_lock(&dns_records_mutex);
+    DNSRecordTable *table = create_record_table();
+    if (table == NULL) {
+        free(data);
+        cJSON_Delete(json);
+        return NULL;
+    }
+    
+    DNSZoneTtl *zone_ttls = arena_calloc(&table->arena, cJSON_GetArraySize(domains) + 1, sizeof(DNSZoneTtl));
+    if (zone_ttls == NULL || record_map_reserve(&table->records, count_mapping_records(domains)) != 0) {
+        log_message(LOG_ERROR, "failed to size record map: %s", strerror(errno));
+        free_record_table(table);
+        free(data);
+        cJSON_Delete(json);
+        return NULL;
+    }
     
     cJSON *domain = NULL;
     cJSON_ArrayForEach(domain, domains) {
         const char *domainName = domain->string;
         
+        /* a zone's ttl applies to its records, wildcards and subdomains */
+        uint32_t zone_ttl;
+        if (mapping_ttl(domain, domainName, config.default_ttl, &zone_ttl) != 0 ||
+            add_zone_ttl(table, zone_ttls, domainName, zone_ttl) != 0) {
+            free_record_table(table);
+            free(data);
+            cJSON_Delete(json);
+            return NULL;
+        }
+        
         cJSON *records = cJSON_GetObjectItem(domain, "records");
         if (records != NULL) {
             int has_cname = 0;
@@ -265,23 +1403,29 @@ int loadDNSMappings(const char *filename)
                 cJSON *values = cJSON_GetObjectItem(records, typeName);
                 
                 if (values != NULL) {
-                    if (strcmp(typeName, "CNAME") == 0) {
+                    const DNSTypeInfo *type_info = dns_type_by_name(typeName);
+                    if (type_info != NULL && type_info->code == DNS_TYPE_CNAME) {
                         has_cname = 1;
                     } else {
                         has_other_records = 1;
                     }
                     
-                    add_record_to_hash(domainName, typeName, values, "base");
+                    if (add_mapping_rrset(table, domainName, typeName, values, "base", zone_ttl) != 0) {
+                        free_record_table(table);
+                        free(data);
+                        cJSON_Delete(json);
+                        return NULL;
+                    }
                 }
             }
             
             if (has_cname && has_other_records) {
                 log_message(LOG_ERROR, "Configuration error: %s has CNAME and other records simultaneously", 
                           domainName);
-                pthread_mutex_unlock(&dns_records_mutex);
+                free_record_table(table);
                 free(data);
                 cJSON_Delete(json);
-                return -1;
+                return NULL;
             }
         }
         
@@ -298,7 +1442,12 @@ int loadDNSMappings(const char *filename)
                     if (values != NULL) {
                         char wildcardDomain[512];
                         snprintf(wildcardDomain, sizeof(wildcardDomain), "*.%s", domainName);
-                        add_record_to_hash(wildcardDomain, typeName, values, "wildcard");
+                        if (add_mapping_rrset(table, wildcardDomain, typeName, values, "wildcard", zone_ttl) != 0) {
+                            free_record_table(table);
+                            free(data);
+                            cJSON_Delete(json);
+                            return NULL;
+                        }
                     }
                 }
             }
@@ -321,7 +1470,13 @@ int loadDNSMappings(const char *filename)
                             char fullSubdomain[512];
                             snprintf(fullSubdomain, sizeof(fullSubdomain), "%s.%s", 
                                    subdomainName, domainName);
-                            add_record_to_hash(fullSubdomain, typeName, values, "subdomain");
+                            if (add_mapping_rrset(table, fullSubdomain, typeName, values, "subdomain",
+                                                  zone_ttl) != 0) {
+                                free_record_table(table);
+                                free(data);
+                                cJSON_Delete(json);
+                                return NULL;
+                            }
                         }
                     }
                 }
@@ -329,122 +1484,156 @@ int loadDNSMappings(const char *filename)
         }
     }
     
-    pthread_mutex_unlock(&dns_records_mutex);
-    
     free(data);
     cJSON_Delete(json);
-    return 0;
+    
+    qsort(zone_ttls, table->zone_ttl_count, sizeof(DNSZoneTtl), compare_zone_ttls);
+    table->zone_ttls = zone_ttls;
+    
+    /* targets can be defined anywhere in the file, so glue waits until every record is in */
+    if (attach_glue(table) != 0) {
+        free_record_table(table);
+        return NULL;
+    }
+    
+    if (config.zone_index == ZONE_INDEX_COMPILED) {
+        table = compile_record_table(table);
+    }
+    
+    /* built here so a reload keeps it out of the swap */
+    if (table != NULL) {
+        build_name_filter(table);
+    }
+    return table;
 }
 
-DNSRecord *resolveRecord(const char *domain, const char *type)
+/* a zone image is used in place, nothing is parsed or encoded */
+static DNSRecordTable *map_zone_image(const char *path)
 {
-    if (domain == NULL || type == NULL) {
+    DNSRecordTable *table = create_record_table();
+    if (table == NULL) {
         return NULL;
     }
     
-    DNSRecord *record = NULL;
-    char *key;
+    table->compiled = zone_image_load(path);
+    if (table->compiled == NULL) {
+        free_record_table(table);
+        return NULL;
+    }
+    table->zone_ttls = table->compiled->zone_ttls;
+    table->zone_ttl_count = table->compiled->zone_ttl_count;
     
-    if (asprintf(&key, "base_%s_%s", domain, type) != -1) {
-        HASH_FIND_STR(dns_records, key, record);
-        free(key);
-        
-        if (record) {
-            log_message(LOG_INFO, "Exact match found for domain %s and type %s", domain, type);
-            return record;
-        }
+    log_message(LOG_INFO, "mapped zone image %s with %u names and %u records",
+              path, table->compiled->name_count, table->compiled->record_count);
+    build_name_filter(table);
+    return table;
+}
+
+/* startup and RELOAD read the zone image if one was given, the mappings file otherwise */
+static DNSRecordTable *load_record_table(const char *filename)
+{
+    return config.zone_image != NULL ? map_zone_image(config.zone_image) : build_record_table(filename);
+}
+
+int compile_zone_image(const char *filename, const char *path)
+{
+    config.zone_index = ZONE_INDEX_COMPILED;
+    
+    DNSRecordTable *table = build_record_table(filename);
+    if (table == NULL) {
+        return -1;
     }
     
-    if (asprintf(&key, "subdomain_%s_%s", domain, type) != -1) {
-        HASH_FIND_STR(dns_records, key, record);
-        free(key);
-        
-        if (record) {
-            log_message(LOG_INFO, "Subdomain match found for domain %s and type %s", domain, type);
-            return record;
-        }
+    int result = zone_image_write(table->compiled, path);
+    free_record_table(table);
+    return result;
+}
+
+int loadDNSMappings(const char *filename)
+{
+    DNSRecordTable *table = load_record_table(filename);
+    if (table == NULL) {
+        return -1;
     }
     
-    char domain_copy[256];
-    strncpy(domain_copy, domain, sizeof(domain_copy) - 1);
-    domain_copy[sizeof(domain_copy) - 1] = '\0';
+    pthread_mutex_lock(&dns_records_mutex);
+    publish_record_table(table);
+    reclaim_record_tables_locked();
+    pthread_mutex_unlock(&dns_records_mutex);
+    
+    return 0;
+}
+
+const DNSRecord *resolveRecord(const DNSRecordTable *table, const char *domain, unsigned short type)
+{
+    if (table == NULL || domain == NULL) {
+        return NULL;
+    }
     
-    char *labels[10] = {NULL};
-    int label_count = 0;
+    int scope;
+    const DNSRecord *record = lookup_record(table, domain, type, &scope);
     
-    char *token = strtok(domain_copy, ".");
-    while (token != NULL && label_count < 10) {
-        labels[label_count++] = token;
-        token = strtok(NULL, ".");
+    if (record == NULL) {
+        log_message(LOG_INFO, "No match found for domain %s and type %s", domain, dns_type_name(type));
+    } else if (scope == DNS_SCOPE_BASE) {
+        log_message(LOG_INFO, "Exact match found for domain %s and type %s", domain, dns_type_name(type));
+    } else if (scope == DNS_SCOPE_SUBDOMAIN) {
+        log_message(LOG_INFO, "Subdomain match found for domain %s and type %s", domain, dns_type_name(type));
+    } else {
+        log_message(LOG_INFO, "Wildcard match found for domain %s and type %s", 
+                  record->text->domain, dns_type_name(type));
     }
     
-    for (int i = 1; i < label_count; i++) {
-        char wildcard_domain[256] = "*";
-        for (int j = i; j < label_count; j++) {
-            strcat(wildcard_domain, ".");
-            strcat(wildcard_domain, labels[j]);
-        }
-        
-        if (asprintf(&key, "wildcard_%s_%s", wildcard_domain, type) != -1) {
-            HASH_FIND_STR(dns_records, key, record);
-            free(key);
-            
-            if (record) {
-                log_message(LOG_INFO, "Wildcard match found for domain %s and type %s", 
-                          wildcard_domain, type);
-                return record;
-            }
-        }
+    return record;
+}
+
+/* the ttl of the deepest loaded zone domain is in, config.default_ttl if it is in none */
+static uint32_t zone_ttl(const DNSRecordTable *table, const char *domain)
+{
+    char name[DNS_NAME_WALK_SIZE];
+    size_t len = strlen(domain);
+    if (len >= sizeof(name) || table->zone_ttl_count == 0) {
+        return config.default_ttl;
     }
+    for (size_t i = 0; i < len; i++) {
+        name[i] = (char)tolower((unsigned char)domain[i]);
+    }
+    if (len > 0 && name[len - 1] == '.') {
+        len--;
+    }
+    name[len] = '\0';
+    
+    const char *suffix = name;
+    do {
+        DNSZoneTtl key = { suffix, 0 };
+        const DNSZoneTtl *zone = bsearch(&key, table->zone_ttls, table->zone_ttl_count, sizeof(DNSZoneTtl),
+                                         compare_zone_ttls);
+        if (zone != NULL) {
+            return zone->ttl;
+        }
+    } while ((suffix = strchr(suffix, '.')) != NULL && *++suffix != '\0');
     
-    log_message(LOG_INFO, "No match found for domain %s and type %s", domain, type);
-    return NULL;
+    return config.default_ttl;
 }
 
-int add_single_record(const char *domain, const char *type, const char *scope, const char *value)
+int add_single_record(const char *domain, const char *type, const char *scope, const char *value, long ttl)
 {
     if (domain == NULL || type == NULL || scope == NULL || value == NULL) {
         return -1;
     }
     
-    cJSON *values = cJSON_CreateArray();
-    if (values == NULL) {
+    /* a bad value is turned away before the whole table is copied for it */
+    const DNSTypeInfo *type_info = dns_type_by_name(type);
+    if (dns_scope_from_string(scope) < 0 || type_info == NULL || dns_type_validate(type_info->code, value) != 0) {
         return -1;
     }
     
-    cJSON *json_value = NULL;
-    
-    if (strcmp(type, "MX") == 0) {
-        int priority;
-        char mx_value[256];
-        
-        if (sscanf(value, "%d %255s", &priority, mx_value) != 2) {
-            cJSON_Delete(values);
-            return -1;
-        }
-        
-        cJSON *mx_obj = cJSON_CreateObject();
-        if (mx_obj == NULL) {
-            cJSON_Delete(values);
-            return -1;
-        }
-        
-        if (!cJSON_AddNumberToObject(mx_obj, "priority", priority) ||
-            !cJSON_AddStringToObject(mx_obj, "value", mx_value)) {
-            cJSON_Delete(mx_obj);
-            cJSON_Delete(values);
-            return -1;
-        }
-        
-        json_value = mx_obj;
-    } else {
-        json_value = cJSON_CreateString(value);
-        if (json_value == NULL) {
-            cJSON_Delete(values);
-            return -1;
-        }
+    cJSON *values = cJSON_CreateArray();
+    if (values == NULL) {
+        return -1;
     }
     
+    cJSON *json_value = cJSON_CreateString(value);
     if (!cJSON_AddItemToArray(values, json_value)) {
         cJSON_Delete(json_value);
         cJSON_Delete(values);
@@ -452,13 +1641,60 @@ int add_single_record(const char *domain, const char *type, const char *scope, c
     }
     
     pthread_mutex_lock(&dns_records_mutex);
-    add_record_to_hash(domain, type, values, scope);
+    
+    DNSRecordTable *table = build_record_index() == 0 ? clone_record_table(dns_table) : NULL;
+    if (table == NULL) {
+        pthread_mutex_unlock(&dns_records_mutex);
+        cJSON_Delete(values);
+        return -1;
+    }
+    
+    /*
+     * replacing an rrset without naming a ttl keeps the one it had, so a
+     * failover record stays short lived. a new one gets its zone's, like
+     * the zone's records loaded with it.
+     */
+    if (ttl < 0) {
+        const DNSRecord *existing = record_map_find(&record_index, domain, dns_scope_from_string(scope),
+                                                    type_info->code);
+        ttl = existing != NULL ? (long)dns_record_ttl(existing) : (long)zone_ttl(table, domain);
+    }
+    
+    if (add_record_to_hash(table, domain, type, values, scope, (uint32_t)ttl) != 0 ||
+        update_glue(table, domain, dns_scope_from_string(scope), type_info->code) != 0) {
+        free_record_table(table);
+        pthread_mutex_unlock(&dns_records_mutex);
+        cJSON_Delete(values);
+        return -1;
+    }
+    
+    table = merge_overlay(table);
+    publish_record_table(table);
+    reclaim_record_tables_locked();
+    
     pthread_mutex_unlock(&dns_records_mutex);
     
     cJSON_Delete(values);
     return 0;
 }
 
+/* hides a record of the compiled zone or base from lookups until the overlay is merged */
+static int add_tombstone(DNSRecordTable *table, const char *domain, const char *type, const char *scope)
+{
+    DNSRecord *record = create_dns_record(table, domain, type, scope);
+    if (record == NULL) {
+        return -1;
+    }
+    
+    record->deleted = 1;
+    if (record_map_insert(&table->records, record) != 0) {
+        return -1;
+    }
+    
+    name_tree_insert(&table->arena, table->names, record);
+    return 0;
+}
+
 int delete_record(const char *domain, const char *type, const char *scope)
 {
     if (domain == NULL || type == NULL || scope == NULL) {
@@ -469,101 +1705,123 @@ int delete_record(const char *domain, const char *type, const char *scope)
     pthread_mutex_lock(&dns_records_mutex);
     
     DNSRecord *record = NULL;
-    char *key;
+    int scope_id = dns_scope_from_string(scope);
+    const DNSTypeInfo *type_info = dns_type_by_name(type);
     
-    if (asprintf(&key, "%s_%s_%s", scope, domain, type) != -1) {
-        HASH_FIND_STR(dns_records, key, record);
+    if (scope_id >= 0 && type_info != NULL && build_record_index() == 0) {
+        unsigned short code = type_info->code;
         
-        if (record) {
-            HASH_DEL(dns_records, record);
+        if (record_map_find(&record_index, domain, scope_id, code) != NULL) {
+            DNSRecordTable *table = clone_record_table(dns_table);
             
-            free(record->domain);
-            free(record->type);
-            free(record->key);
-            
-            for (int i = 0; i < record->num_values; i++) {
-                free(record->values[i]);
+            if (table != NULL) {
+                record = record_map_remove(&table->records, domain, scope_id, code);
+                if (record != NULL) {
+                    name_tree_remove(table->names, record);
+                }
+                
+                /*
+                 * deleting a record of the compiled zone or base leaves a
+                 * tombstone in the overlay. a flat table only becomes a
+                 * base in the copy, so this asks the copy.
+                 */
+                if ((shared_record(table, domain, scope_id, code) != NULL &&
+                     add_tombstone(table, domain, type, scope) != 0) ||
+                    update_glue(table, domain, scope_id, code) != 0) {
+                    free_record_table(table);
+                    table = NULL;
+                }
             }
-            free(record->values);
-            free(record);
             
-            result = 0;
+            if (table != NULL) {
+                table = merge_overlay(table);
+                publish_record_table(table);
+                reclaim_record_tables_locked();
+                result = 0;
+            }
         }
-        
-        free(key);
     }
     
     pthread_mutex_unlock(&dns_records_mutex);
     return result;
 }
 
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t len;
+} ListBuffer;
+
+static int list_append(ListBuffer *buffer, const char *format, ...)
+{
+    for (;;) {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(buffer->data + buffer->len, buffer->size - buffer->len, format, args);
+        va_end(args);
+        
+        if (n < 0) {
+            return -1;
+        }
+        if ((size_t)n < buffer->size - buffer->len) {
+            buffer->len += n;
+            return 0;
+        }
+        
+        char *data = realloc(buffer->data, buffer->size * 2);
+        if (data == NULL) {
+            return -1;
+        }
+        buffer->data = data;
+        buffer->size *= 2;
+    }
+}
+
+static int list_record(ListBuffer *buffer, const DNSRecord *record)
+{
+    if (list_append(buffer, "Domain: %s, Type: %s, TTL: %u, Values: ", record->text->domain,
+                    dns_type_name(record->type_code), dns_record_ttl(record)) != 0) {
+        return -1;
+    }
+    
+    for (int i = 0; i < record->num_values; i++) {
+        const char *separator = (i < record->num_values - 1) ? ", " : "\n";
+        if (list_append(buffer, "%s%s", record->text->values[i], separator) != 0) {
+            return -1;
+        }
+    }
+    
+    return 0;
+}
+
 char *get_records_list(void)
 {
     pthread_mutex_lock(&dns_records_mutex);
     
-    size_t buf_size = 1024;
-    char *buffer = malloc(buf_size);
-    
-    if (buffer == NULL) {
+    ListBuffer buffer = { malloc(1024), 1024, 0 };
+    if (buffer.data == NULL) {
         pthread_mutex_unlock(&dns_records_mutex);
         return NULL;
     }
     
-    size_t offset = 0;
-    int n;
-    n = snprintf(buffer + offset, buf_size - offset, "Current DNS Records:\n");
-    if (n >= buf_size - offset) {
-        free(buffer);
-        pthread_mutex_unlock(&dns_records_mutex);
-        return NULL;
+    int result = list_append(&buffer, "Current DNS Records:\n");
+    if (result == 0) {
+        result = build_record_index();
     }
-    offset += n;
     
-    DNSRecord *record, *tmp;
-    HASH_ITER(hh, dns_records, record, tmp) {
-        n = snprintf(buffer + offset, buf_size - offset, 
-                   "Domain: %s, Type: %s, Values: ", 
-                   record->domain, record->type);
-        if (n >= buf_size - offset) {
-            buf_size *= 2;
-            char *new_buffer = realloc(buffer, buf_size);
-            if (new_buffer == NULL) {
-                free(buffer);
-                pthread_mutex_unlock(&dns_records_mutex);
-                return NULL;
-            }
-            buffer = new_buffer;
-            
-            n = snprintf(buffer + offset, buf_size - offset, 
-                       "Domain: %s, Type: %s, Values: ", 
-                       record->domain, record->type);
-        }
-        offset += n;
-        
-        for (int i = 0; i < record->num_values; i++) {
-            const char *separator = (i < record->num_values - 1) ? ", " : "\n";
-            n = snprintf(buffer + offset, buf_size - offset, 
-                       "%s%s", record->values[i], separator);
-            
-            if (n >= buf_size - offset) {
-                buf_size *= 2;
-                char *new_buffer = realloc(buffer, buf_size);
-                if (new_buffer == NULL) {
-                    free(buffer);
-                    pthread_mutex_unlock(&dns_records_mutex);
-                    return NULL;
-                }
-                buffer = new_buffer;
-                
-                n = snprintf(buffer + offset, buf_size - offset, 
-                           "%s%s", record->values[i], separator);
-            }
-            offset += n;
-        }
+    const DNSRecord *record;
+    for (uint32_t pos = 0; result == 0 && (record = record_map_next(&record_index, &pos)) != NULL;) {
+        result = list_record(&buffer, record);
     }
     
     pthread_mutex_unlock(&dns_records_mutex);
-    return buffer;
+    
+    if (result != 0) {
+        free(buffer.data);
+        return NULL;
+    }
+    return buffer.data;
 }
 
 void log_message(LogLevel level, const char *format, ...)
@@ -596,9 +1854,10 @@ void log_message(LogLevel level, const char *format, ...)
     }
     
     time_t now = time(NULL);
-    struct tm *t = localtime(&now);
+    struct tm t;
+    localtime_r(&now, &t);
     char timestamp[20];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", t);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &t);
     
     fprintf(output, "[%s] [%s] ", timestamp, level_str);
     
@@ -616,14 +1875,34 @@ void handle_add_command(int client_fd, char *input) {
     char *type = strtok(NULL, " \t\n");
     char *scope = strtok(NULL, " \t\n");
     char *value = strtok(NULL, "\n");
+    long ttl = -1;
+    
+    /* an optional ttl=<seconds> ahead of the value */
+    if (value != NULL && strncasecmp(value, "ttl=", 4) == 0) {
+        char *end = value;
+        errno = 0;
+        unsigned long seconds = isdigit((unsigned char)value[4]) ? strtoul(value + 4, &end, 10) : ULONG_MAX;
+        
+        if (seconds > MAX_TTL || errno != 0 || (*end != ' ' && *end != '\t' && *end != '\0')) {
+            const char *response = "ERROR: Invalid TTL, expected ttl=<seconds> from 0 to 2147483647\n";
+            write(client_fd, response, strlen(response));
+            return;
+        }
+        
+        ttl = (long)seconds;
+        value = end + strspn(end, " \t");
+        if (*value == '\0') {
+            value = NULL;
+        }
+    }
     
     if (domain == NULL || type == NULL || scope == NULL || value == NULL) {
-        const char *response = "ERROR: Missing parameters. Usage: ADD domain type scope value\n";
+        const char *response = "ERROR: Missing parameters. Usage: ADD domain type scope [ttl=seconds] value\n";
         write(client_fd, response, strlen(response));
         return;
     }
     
-    if (add_single_record(domain, type, scope, value) == 0) {
+    if (add_single_record(domain, type, scope, value, ttl) == 0) {
         const char *response = "SUCCESS: Record added\n";
         write(client_fd, response, strlen(response));
     } else {
@@ -664,40 +1943,165 @@ void handle_list_command(int client_fd) {
     }
 }
 
+static double elapsed_ms(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/*
+ * the new table is built and validated with no lock held, so queries keep
+ * answering from the old records until the single pointer swap. a file that
+ * fails to load leaves the current records in place.
+ */
 void handle_reload_command(int client_fd) {
-    pthread_mutex_lock(&dns_records_mutex);
+    struct timespec build_start, build_end, swap_end;
+    char response[256];
     
-    DNSRecord *record, *tmp;
-    HASH_ITER(hh, dns_records, record, tmp) {
-        HASH_DEL(dns_records, record);
-        free(record->domain);
-        free(record->type);
-        free(record->key);
-        for (int i = 0; i < record->num_values; i++) {
-            free(record->values[i]);
-        }
-        free(record->values);
-        free(record);
+    clock_gettime(CLOCK_MONOTONIC, &build_start);
+    DNSRecordTable *table = load_record_table(config.mappings_file);
+    clock_gettime(CLOCK_MONOTONIC, &build_end);
+    
+    if (table == NULL) {
+        const char *error = "ERROR: Failed to reload configuration, keeping current records\n";
+        write(client_fd, error, strlen(error));
+        return;
     }
     
+    unsigned int count = record_table_count(table);
+    
+    pthread_mutex_lock(&dns_records_mutex);
+    publish_record_table(table);
+    unsigned long generation = table->generation;
     pthread_mutex_unlock(&dns_records_mutex);
+    clock_gettime(CLOCK_MONOTONIC, &swap_end);
     
-    if (loadDNSMappings(config.mappings_file) == 0) {
-        const char *response = "SUCCESS: Configuration reloaded\n";
-        write(client_fd, response, strlen(response));
+    reclaim_record_tables();
+    
+    double build_ms = elapsed_ms(&build_start, &build_end);
+    double swap_ms = elapsed_ms(&build_end, &swap_end);
+    
+    log_message(LOG_INFO, "Reloaded %u records (generation %lu), build %.3f ms, swap %.3f ms",
+              count, generation, build_ms, swap_ms);
+    
+    snprintf(response, sizeof(response),
+             "SUCCESS: Configuration reloaded, %u records, build %.3f ms, swap %.3f ms\n",
+             count, build_ms, swap_ms);
+    write(client_fd, response, strlen(response));
+}
+
+void handle_stats_command(int client_fd) {
+    DNSCacheStats stats;
+    DNSTcpStats tcp;
+    char response[768];
+    char zone[128];
+    
+    get_cache_stats(&stats);
+    get_tcp_stats(&tcp);
+    unsigned long long filtered = get_filtered_queries();
+    
+    pthread_mutex_lock(&dns_records_mutex);
+    unsigned int filter_names = dns_table->filter.names +
+        (dns_table->compiled != NULL ? dns_table->compiled->filter.names : 0) +
+        (dns_table->base != NULL ? dns_table->base->filter.names : 0);
+    if (dns_table->compiled != NULL) {
+        snprintf(zone, sizeof(zone), "compiled, %u names, %u records, %u overlay entries",
+                 dns_table->compiled->name_count, record_table_count(dns_table), dns_table->records.count);
     } else {
-        const char *response = "ERROR: Failed to reload configuration\n";
-        write(client_fd, response, strlen(response));
+        snprintf(zone, sizeof(zone), "tree, %u records, %u overlay entries", record_table_count(dns_table),
+                 dns_table->base != NULL ? dns_table->records.count : 0);
+    }
+    pthread_mutex_unlock(&dns_records_mutex);
+    
+    unsigned long long lookups = stats.hits + stats.misses;
+    double hit_rate = lookups > 0 ? 100.0 * stats.hits / lookups : 0.0;
+    
+    snprintf(response, sizeof(response),
+             "Response cache: %s\n"
+             "Hits: %llu\n"
+             "Misses: %llu\n"
+             "Hit rate: %.1f%%\n"
+             "Evictions: %llu\n"
+             "Capacity: %zu entries, %zu bytes\n"
+             "Generation: %lu\n"
+             "Zone index: %s\n"
+             "Name filter: %u names, %llu queries short-circuited\n"
+             "TCP: %llu open, %llu accepted, %llu refused, %llu idle timeouts, %llu queries\n",
+             stats.entries > 0 ? "enabled" : "disabled",
+             stats.hits, stats.misses, hit_rate, stats.evictions,
+             stats.entries, stats.bytes, dns_records_generation(), zone,
+             filter_names, filtered,
+             tcp.open, tcp.accepted, tcp.refused, tcp.timed_out, tcp.queries);
+    write(client_fd, response, strlen(response));
+}
+
+static void handle_management_client(int client_fd) {
+    char buffer[1024] = {0};
+    
+    int bytes_read = read(client_fd, buffer, sizeof(buffer) - 1);
+    
+    if (bytes_read > 0) {
+        buffer[bytes_read] = '\0';
+        
+        char *token = strtok(buffer, " \t\n");
+        if (token == NULL || strcmp(token, config.auth_token) != 0) {
+            const char *response = "ERROR: Authentication failed\n";
+            write(client_fd, response, strlen(response));
+            return;
+        }
+        
+        char *cmd = strtok(NULL, " \t\n");
+        if (cmd == NULL) {
+            const char *response = "ERROR: No command specified\n";
+            write(client_fd, response, strlen(response));
+        } else if (strcasecmp(cmd, "ADD") == 0) {
+            handle_add_command(client_fd, cmd);
+        } else if (strcasecmp(cmd, "DELETE") == 0) {
+            handle_delete_command(client_fd, cmd);
+        } else if (strcasecmp(cmd, "LIST") == 0) {
+            handle_list_command(client_fd);
+        } else if (strcasecmp(cmd, "RELOAD") == 0) {
+            handle_reload_command(client_fd);
+        } else if (strcasecmp(cmd, "STATS") == 0) {
+            handle_stats_command(client_fd);
+        } else {
+            const char *response = "ERROR: Unknown command\n";
+            write(client_fd, response, strlen(response));
+        }
+    }
+}
+
+static void handle_management_accept(DNSEventLoop *loop, int server_fd, uint32_t events, void *arg) {
+    (void)loop;
+    (void)events;
+    (void)arg;
+    struct sockaddr_in address;
+    socklen_t addrlen = sizeof(address);
+    
+    int client_fd = accept(server_fd, (struct sockaddr *)&address, &addrlen);
+    if (client_fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            log_message(LOG_ERROR, "Accept failed: %s", strerror(errno));
+        }
+        return;
     }
+    
+    handle_management_client(client_fd);
+    close(client_fd);
+}
+
+static void handle_reclaim_timer(DNSEventLoop *loop, int fd, uint32_t events, void *arg) {
+    (void)loop;
+    (void)fd;
+    (void)events;
+    (void)arg;
+    reclaim_record_tables();
 }
 
 void *management_thread(void *arg) {
-    int server_fd, client_fd;
+    (void)arg;
+    int server_fd;
     struct sockaddr_in address;
-    int addrlen = sizeof(address);
-    char buffer[1024] = {0};
     
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+    if ((server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
         log_message(LOG_ERROR, "Management socket creation failed: %s", strerror(errno));
         return NULL;
     }
@@ -725,68 +2129,30 @@ void *management_thread(void *arg) {
         return NULL;
     }
     
-    log_message(LOG_INFO, "DNS Management interface listening on port %d", config.mgmt_port);
+    DNSEventLoop loop;
+    if (event_loop_init(&loop, NULL, NULL) != 0) {
+        close(server_fd);
+        return NULL;
+    }
     
-    while (running) {
-        struct timeval tv;
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
-        
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(server_fd, &readfds);
-        
-        int activity = select(server_fd + 1, &readfds, NULL, NULL, &tv);
-        
-        if (activity < 0 && errno != EINTR) {
-            log_message(LOG_ERROR, "Select error: %s", strerror(errno));
-            continue;
-        }
-        if (activity == 0) {
-            continue;
-        }
-        
-        if ((client_fd = accept(server_fd, (struct sockaddr *)&address, 
-                               (socklen_t*)&addrlen)) < 0) {
-            log_message(LOG_ERROR, "Accept failed: %s", strerror(errno));
-            continue;
-        }
-        
-        memset(buffer, 0, sizeof(buffer));
-        int bytes_read = read(client_fd, buffer, sizeof(buffer) - 1);
-        
-        if (bytes_read > 0) {
-            buffer[bytes_read] = '\0';
-            
-            char *token = strtok(buffer, " \t\n");
-            if (token == NULL || strcmp(token, config.auth_token) != 0) {
-                const char *response = "ERROR: Authentication failed\n";
-                write(client_fd, response, strlen(response));
-                close(client_fd);
-                continue;
-            }
-            
-            char *cmd = strtok(NULL, " \t\n");
-            if (cmd == NULL) {
-                const char *response = "ERROR: No command specified\n";
-                write(client_fd, response, strlen(response));
-            } else if (strcasecmp(cmd, "ADD") == 0) {
-                handle_add_command(client_fd, cmd);
-            } else if (strcasecmp(cmd, "DELETE") == 0) {
-                handle_delete_command(client_fd, cmd);
-            } else if (strcasecmp(cmd, "LIST") == 0) {
-                handle_list_command(client_fd);
-            } else if (strcasecmp(cmd, "RELOAD") == 0) {
-                handle_reload_command(client_fd);
-            } else {
-                const char *response = "ERROR: Unknown command\n";
-                write(client_fd, response, strlen(response));
-            }
-        }
-        
-        close(client_fd);
+    if (event_loop_add(&loop, server_fd, EPOLLIN, handle_management_accept, NULL) != 0) {
+        event_loop_destroy(&loop);
+        close(server_fd);
+        return NULL;
     }
     
+    /* frees retired record tables whose readers were still active at publish time */
+    if (event_loop_add_timer(&loop, RECLAIM_INTERVAL_MS, handle_reclaim_timer, NULL) < 0) {
+        event_loop_destroy(&loop);
+        close(server_fd);
+        return NULL;
+    }
+    
+    log_message(LOG_INFO, "DNS Management interface listening on port %d", config.mgmt_port);
+    
+    event_loop_run(&loop);
+    
+    event_loop_destroy(&loop);
     close(server_fd);
     return NULL;
-}
\ No newline at end of file
+}
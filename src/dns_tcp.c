@@ -0,0 +1,505 @@
+#include "dns_tcp.h"
+#include "dns_alloc.h"
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+
+/* counters have a single writer, relaxed stores let other threads read them */
+#define TCP_COUNT(counter) __atomic_store_n(&(counter), (counter) + 1, __ATOMIC_RELAXED)
+
+typedef struct dns_tcp_conn
+{
+    int fd;
+    uint32_t events;               /* as registered with the event loop */
+    int eof;                       /* the client closed its side, answer what was read and close */
+    time_t last_active;
+    int unsent;                    /* bytes in the kernel send queue at the last idle check */
+    struct dns_tcp *tcp;
+    struct dns_tcp_conn *prev;
+    struct dns_tcp_conn *next;
+    
+    unsigned char *out;            /* responses not sent yet, from out_start to out_end */
+    size_t out_start;
+    size_t out_end;
+    size_t out_size;
+    
+    size_t in_len;
+    unsigned char in[DNS_TCP_READ_SIZE];
+} DNSTcpConn;
+
+struct dns_tcp
+{
+    DNSWorker *worker;
+    int listen_fd;
+    int owns_listener;
+    DNSTcpConn *oldest;            /* connections ordered by last activity */
+    DNSTcpConn *newest;
+    
+    unsigned long long open;
+    unsigned long long accepted;
+    unsigned long long refused;
+    unsigned long long timed_out;
+    unsigned long long queries;
+    
+    unsigned char response[2 + DNS_TCP_RESPONSE_SIZE];
+};
+
+/* connections over all workers, checked against config.tcp_connections */
+static int open_connections = 0;
+
+static time_t now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+int dns_tcp_listen(int reuseport)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_message(LOG_ERROR, "TCP socket creation error: %s", strerror(errno));
+        return -1;
+    }
+    
+    int opt = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)) {
+        log_message(LOG_ERROR, "TCP setsockopt error: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config.dns_port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        log_message(LOG_ERROR, "TCP bind failed: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    
+    if (listen(fd, DNS_TCP_BACKLOG) < 0) {
+        log_message(LOG_ERROR, "TCP listen failed: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    
+    log_message(LOG_DEBUG, "DNS TCP socket %d listening on port %d", fd, config.dns_port);
+    return fd;
+}
+
+static void unlink_conn(struct dns_tcp *tcp, DNSTcpConn *conn)
+{
+    if (conn->prev != NULL) {
+        conn->prev->next = conn->next;
+    } else {
+        tcp->oldest = conn->next;
+    }
+    
+    if (conn->next != NULL) {
+        conn->next->prev = conn->prev;
+    } else {
+        tcp->newest = conn->prev;
+    }
+    
+    conn->prev = NULL;
+    conn->next = NULL;
+}
+
+static void append_conn(struct dns_tcp *tcp, DNSTcpConn *conn)
+{
+    conn->prev = tcp->newest;
+    conn->next = NULL;
+    
+    if (tcp->newest != NULL) {
+        tcp->newest->next = conn;
+    } else {
+        tcp->oldest = conn;
+    }
+    tcp->newest = conn;
+}
+
+/* moves the connection to the newest end, so the idle sweep stops at the first one still in use */
+static void touch_conn(DNSTcpConn *conn)
+{
+    struct dns_tcp *tcp = conn->tcp;
+    
+    conn->last_active = now_seconds();
+    if (tcp->newest != conn) {
+        unlink_conn(tcp, conn);
+        append_conn(tcp, conn);
+    }
+}
+
+static void close_conn(DNSTcpConn *conn)
+{
+    struct dns_tcp *tcp = conn->tcp;
+    
+    event_loop_remove(&tcp->worker->loop, conn->fd);
+    close(conn->fd);
+    unlink_conn(tcp, conn);
+    
+    __atomic_sub_fetch(&open_connections, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&tcp->open, tcp->open - 1, __ATOMIC_RELAXED);
+    
+    free(conn->out);
+    free(conn);
+}
+
+static size_t pending_output(const DNSTcpConn *conn)
+{
+    return conn->out_end - conn->out_start;
+}
+
+/* sends what it can right away and keeps the rest for when the socket is writable */
+static int queue_output(DNSTcpConn *conn, const unsigned char *data, size_t len)
+{
+    if (pending_output(conn) == 0) {
+        conn->out_start = 0;
+        conn->out_end = 0;
+        
+        ssize_t sent = send(conn->fd, data, len, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                return -1;
+            }
+            sent = 0;
+        }
+        
+        data += sent;
+        len -= sent;
+        if (len == 0) {
+            return 0;
+        }
+    }
+    
+    if (conn->out_end + len > conn->out_size) {
+        size_t pending = pending_output(conn);
+        if (conn->out_start > 0) {
+            memmove(conn->out, conn->out + conn->out_start, pending);
+            conn->out_start = 0;
+            conn->out_end = pending;
+        }
+        
+        if (pending + len > conn->out_size) {
+            size_t size = conn->out_size > 0 ? conn->out_size * 2 : DNS_TCP_READ_SIZE;
+            while (size < pending + len) {
+                size *= 2;
+            }
+            
+            unsigned char *out = realloc(conn->out, size);
+            if (out == NULL) {
+                log_message(LOG_ERROR, "Failed to queue TCP response: %s", strerror(errno));
+                return -1;
+            }
+            conn->out = out;
+            conn->out_size = size;
+        }
+    }
+    
+    memcpy(conn->out + conn->out_end, data, len);
+    conn->out_end += len;
+    return 0;
+}
+
+static int flush_output(DNSTcpConn *conn)
+{
+    while (pending_output(conn) > 0) {
+        ssize_t sent = send(conn->fd, conn->out + conn->out_start, pending_output(conn), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        
+        conn->out_start += sent;
+        touch_conn(conn);
+    }
+    
+    return 0;
+}
+
+/*
+ * answers every complete query in the read buffer, in the order they came,
+ * until the connection has DNS_TCP_MAX_PENDING bytes waiting to go out.
+ * queries left over are answered once the client has read some of that.
+ */
+static int answer_queries(DNSTcpConn *conn)
+{
+    struct dns_tcp *tcp = conn->tcp;
+    size_t offset = 0;
+    unsigned long long queries = 0;
+    
+    while (conn->in_len - offset >= 2 && pending_output(conn) < DNS_TCP_MAX_PENDING) {
+        size_t query_len = (conn->in[offset] << 8) | conn->in[offset + 1];
+        if (query_len < sizeof(DNSHeader) + 5 || query_len > DNS_TCP_MAX_QUERY) {
+            log_message(LOG_DEBUG, "Closing TCP connection with a %zu byte query", query_len);
+            return -1;
+        }
+        if (conn->in_len - offset < 2 + query_len) {
+            break;
+        }
+        
+        /*
+         * an unparseable query gets no answer, the framing is still intact so
+         * the next one does. growing the output buffer in queue_output is the
+         * connection's cost, not the query's, so it stays outside the check.
+         */
+        HOT_PATH_BEGIN();
+        int response_len = build_dns_response(tcp->worker, conn->in + offset + 2, query_len,
+                                              tcp->response + 2, DNS_TCP_RESPONSE_SIZE, DNS_TRANSPORT_TCP);
+        HOT_PATH_END("tcp query path");
+        
+        if (response_len >= 0) {
+            tcp->response[0] = response_len >> 8;
+            tcp->response[1] = response_len & 0xFF;
+            if (queue_output(conn, tcp->response, 2 + response_len) != 0) {
+                return -1;
+            }
+        }
+        
+        offset += 2 + query_len;
+        queries++;
+    }
+    
+    if (offset > 0) {
+        memmove(conn->in, conn->in + offset, conn->in_len - offset);
+        conn->in_len -= offset;
+        __atomic_store_n(&tcp->queries, tcp->queries + queries, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
+
+/* one read per readiness event, so a client that keeps pipelining can't starve the other sockets */
+static int read_queries(DNSTcpConn *conn)
+{
+    ssize_t n = read(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len);
+    
+    if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    }
+    if (n == 0) {
+        conn->eof = 1;
+        return 0;
+    }
+    
+    conn->in_len += n;
+    touch_conn(conn);
+    return answer_queries(conn);
+}
+
+/* reads while there is room for more output, and waits for writability while output is queued */
+static int update_events(DNSTcpConn *conn)
+{
+    uint32_t events = 0;
+    
+    if (!conn->eof && pending_output(conn) < DNS_TCP_MAX_PENDING) {
+        events |= EPOLLIN;
+    }
+    if (pending_output(conn) > 0) {
+        events |= EPOLLOUT;
+    }
+    
+    if (events != conn->events) {
+        if (event_loop_modify(&conn->tcp->worker->loop, conn->fd, events) != 0) {
+            return -1;
+        }
+        conn->events = events;
+    }
+    return 0;
+}
+
+static void handle_tcp_client(DNSEventLoop *loop, int fd, uint32_t events, void *arg)
+{
+    (void)loop;
+    (void)fd;
+    DNSTcpConn *conn = (DNSTcpConn *)arg;
+    
+    if (events & EPOLLERR) {
+        close_conn(conn);
+        return;
+    }
+    
+    if (events & EPOLLOUT) {
+        if (flush_output(conn) != 0 || answer_queries(conn) != 0) {
+            close_conn(conn);
+            return;
+        }
+    }
+    
+    if ((events & (EPOLLIN | EPOLLHUP)) && !conn->eof && pending_output(conn) < DNS_TCP_MAX_PENDING) {
+        if (read_queries(conn) != 0) {
+            close_conn(conn);
+            return;
+        }
+    }
+    
+    /* once the client is done sending, close as soon as everything it asked for is sent */
+    if ((conn->eof && pending_output(conn) == 0) || update_events(conn) != 0) {
+        close_conn(conn);
+    }
+}
+
+static void open_conn(struct dns_tcp *tcp, int fd)
+{
+    DNSTcpConn *conn = calloc(1, sizeof(DNSTcpConn));
+    if (conn == NULL) {
+        log_message(LOG_ERROR, "Failed to allocate TCP connection: %s", strerror(errno));
+        __atomic_sub_fetch(&open_connections, 1, __ATOMIC_RELAXED);
+        close(fd);
+        return;
+    }
+    
+    /* responses go out whole, there is nothing for nagle to coalesce */
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    
+    conn->fd = fd;
+    conn->tcp = tcp;
+    conn->events = EPOLLIN;
+    conn->last_active = now_seconds();
+    
+    if (event_loop_add(&tcp->worker->loop, fd, conn->events, handle_tcp_client, conn) != 0) {
+        __atomic_sub_fetch(&open_connections, 1, __ATOMIC_RELAXED);
+        close(fd);
+        free(conn);
+        return;
+    }
+    
+    append_conn(tcp, conn);
+    TCP_COUNT(tcp->open);
+    TCP_COUNT(tcp->accepted);
+}
+
+static void handle_tcp_accept(DNSEventLoop *loop, int fd, uint32_t events, void *arg)
+{
+    (void)loop;
+    (void)events;
+    struct dns_tcp *tcp = (struct dns_tcp *)arg;
+    
+    for (;;) {
+        int client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+                log_message(LOG_ERROR, "TCP accept error: %s", strerror(errno));
+            }
+            return;
+        }
+        
+        /* refused connections are closed straight away rather than left in the backlog */
+        if (__atomic_add_fetch(&open_connections, 1, __ATOMIC_RELAXED) > config.tcp_connections) {
+            __atomic_sub_fetch(&open_connections, 1, __ATOMIC_RELAXED);
+            close(client_fd);
+            TCP_COUNT(tcp->refused);
+            continue;
+        }
+        
+        open_conn(tcp, client_fd);
+    }
+}
+
+/*
+ * a client still taking responses out of the kernel send queue, however
+ * slowly, is not idle even if the queue hasn't had room for more since.
+ */
+static int send_queue_moved(DNSTcpConn *conn)
+{
+    int unsent = 0;
+    
+    if (ioctl(conn->fd, SIOCOUTQ, &unsent) != 0 || unsent == conn->unsent) {
+        return 0;
+    }
+    conn->unsent = unsent;
+    return unsent > 0 || pending_output(conn) > 0;
+}
+
+static void handle_tcp_sweep(DNSEventLoop *loop, int fd, uint32_t events, void *arg)
+{
+    (void)loop;
+    (void)fd;
+    (void)events;
+    struct dns_tcp *tcp = (struct dns_tcp *)arg;
+    time_t deadline = now_seconds() - config.tcp_idle_timeout;
+    
+    while (tcp->oldest != NULL && tcp->oldest->last_active <= deadline) {
+        DNSTcpConn *conn = tcp->oldest;
+        
+        if (send_queue_moved(conn)) {
+            touch_conn(conn);
+            continue;
+        }
+        
+        close_conn(conn);
+        TCP_COUNT(tcp->timed_out);
+    }
+}
+
+int dns_tcp_init(DNSWorker *worker, int listen_fd)
+{
+    struct dns_tcp *tcp = calloc(1, sizeof(struct dns_tcp));
+    if (tcp == NULL) {
+        log_message(LOG_ERROR, "Failed to allocate TCP state for worker %d: %s", worker->id, strerror(errno));
+        return -1;
+    }
+    
+    tcp->worker = worker;
+    tcp->listen_fd = listen_fd;
+    worker->tcp = tcp;
+    
+    if (tcp->listen_fd < 0) {
+        tcp->listen_fd = dns_tcp_listen(1);
+        if (tcp->listen_fd < 0) {
+            dns_tcp_destroy(worker);
+            return -1;
+        }
+        tcp->owns_listener = 1;
+    }
+    
+    /* a shared listener wakes one worker per connection, not all of them */
+    uint32_t events = tcp->owns_listener ? EPOLLIN : EPOLLIN | EPOLLEXCLUSIVE;
+    if (event_loop_add(&worker->loop, tcp->listen_fd, events, handle_tcp_accept, tcp) != 0 ||
+        event_loop_add_timer(&worker->loop, DNS_TCP_SWEEP_INTERVAL_MS, handle_tcp_sweep, tcp) < 0) {
+        dns_tcp_destroy(worker);
+        return -1;
+    }
+    
+    return 0;
+}
+
+void dns_tcp_destroy(DNSWorker *worker)
+{
+    struct dns_tcp *tcp = worker->tcp;
+    if (tcp == NULL) {
+        return;
+    }
+    
+    while (tcp->oldest != NULL) {
+        close_conn(tcp->oldest);
+    }
+    
+    if (tcp->owns_listener) {
+        close(tcp->listen_fd);
+    }
+    
+    free(tcp);
+    worker->tcp = NULL;
+}
+
+void dns_tcp_add_stats(const DNSWorker *worker, DNSTcpStats *stats)
+{
+    const struct dns_tcp *tcp = worker->tcp;
+    if (tcp == NULL) {
+        return;
+    }
+    
+    stats->open += __atomic_load_n(&tcp->open, __ATOMIC_RELAXED);
+    stats->accepted += __atomic_load_n(&tcp->accepted, __ATOMIC_RELAXED);
+    stats->refused += __atomic_load_n(&tcp->refused, __ATOMIC_RELAXED);
+    stats->timed_out += __atomic_load_n(&tcp->timed_out, __ATOMIC_RELAXED);
+    stats->queries += __atomic_load_n(&tcp->queries, __ATOMIC_RELAXED);
+}
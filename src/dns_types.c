@@ -0,0 +1,167 @@
+#include "dns_types.h"
+#include "dns_records.h"
+#include "dns_parser.h"
+
+static const char *parse_string(const cJSON *item, char *buf, size_t size)
+{
+    (void)buf;
+    (void)size;
+    return cJSON_IsString(item) ? item->valuestring : NULL;
+}
+
+/* "<preference> <exchange>", or the mappings file form {"priority": 10, "value": "mail.example.com"} */
+static const char *parse_mx(const cJSON *item, char *buf, size_t size)
+{
+    if (!cJSON_IsObject(item)) {
+        return parse_string(item, buf, size);
+    }
+    
+    cJSON *priority = cJSON_GetObjectItem(item, "priority");
+    cJSON *value = cJSON_GetObjectItem(item, "value");
+    if (!cJSON_IsNumber(priority) || !cJSON_IsString(value)) {
+        return NULL;
+    }
+    
+    snprintf(buf, size, "%d %s", priority->valueint, value->valuestring);
+    return buf;
+}
+
+static int encode_a(const char *value, unsigned char *rdata, size_t rdata_size)
+{
+    struct in_addr addr;
+    if (rdata_size < 4 || inet_pton(AF_INET, value, &addr) != 1) {
+        return -1;
+    }
+    memcpy(rdata, &addr.s_addr, 4);
+    return 4;
+}
+
+static int encode_aaaa(const char *value, unsigned char *rdata, size_t rdata_size)
+{
+    struct in6_addr addr6;
+    if (rdata_size < 16 || inet_pton(AF_INET6, value, &addr6) != 1) {
+        return -1;
+    }
+    memcpy(rdata, &addr6.s6_addr, 16);
+    return 16;
+}
+
+static int encode_name(const char *value, unsigned char *rdata, size_t rdata_size)
+{
+    return domainToDNSFormat(value, rdata, rdata_size);
+}
+
+static int encode_mx(const char *value, unsigned char *rdata, size_t rdata_size)
+{
+    unsigned int preference;
+    char exchange[256];
+    
+    if (rdata_size < 2 || sscanf(value, "%u %255s", &preference, exchange) != 2 || preference > 65535) {
+        return -1;
+    }
+    
+    unsigned short wire_preference = htons(preference);
+    memcpy(rdata, &wire_preference, 2);
+    
+    int exchange_len = domainToDNSFormat(exchange, rdata + 2, rdata_size - 2);
+    return exchange_len < 0 ? -1 : exchange_len + 2;
+}
+
+/* one or more character-strings of at most 255 bytes each */
+static int encode_txt(const char *value, unsigned char *rdata, size_t rdata_size)
+{
+    size_t len = strlen(value);
+    size_t offset = 0;
+    
+    do {
+        size_t chunk = len > 255 ? 255 : len;
+        if (offset + 1 + chunk > rdata_size) {
+            return -1;
+        }
+        
+        rdata[offset++] = (unsigned char)chunk;
+        memcpy(rdata + offset, value, chunk);
+        offset += chunk;
+        value += chunk;
+        len -= chunk;
+    } while (len > 0);
+    
+    return offset;
+}
+
+static int encode_srv(const char *value, unsigned char *rdata, size_t rdata_size)
+{
+    unsigned int priority, weight, port;
+    char target[256];
+    
+    if (rdata_size < 6 || sscanf(value, "%u %u %u %255s", &priority, &weight, &port, target) != 4 ||
+        priority > 65535 || weight > 65535 || port > 65535) {
+        return -1;
+    }
+    
+    unsigned short fields[3] = { htons(priority), htons(weight), htons(port) };
+    memcpy(rdata, fields, 6);
+    
+    int target_len = domainToDNSFormat(target, rdata + 6, rdata_size - 6);
+    return target_len < 0 ? -1 : target_len + 6;
+}
+
+/*
+ * every supported type, X(mnemonic, parse, encode, name offset, glue
+ * offset), the code is DNS_TYPE_<mnemonic>. only the types of rfc 1035 may
+ * have their names compressed, an SRV target never is (rfc 2782). NS, MX
+ * and SRV targets get their addresses in the additional section.
+ */
+#define DNS_RECORD_TYPES(X) \
+    X(A,     parse_string, encode_a,    -1, -1) \
+    X(NS,    parse_string, encode_name,  0,  0) \
+    X(CNAME, parse_string, encode_name,  0, -1) \
+    X(MX,    parse_mx,     encode_mx,    2,  2) \
+    X(TXT,   parse_string, encode_txt,  -1, -1) \
+    X(AAAA,  parse_string, encode_aaaa, -1, -1) \
+    X(SRV,   parse_string, encode_srv,  -1,  6)
+
+#define TYPE_INDEX(type, parse, encode, name_offset, glue_offset) TYPE_INDEX_##type,
+enum { DNS_RECORD_TYPES(TYPE_INDEX) TYPE_COUNT };
+#undef TYPE_INDEX
+
+#define TYPE_INFO(type, parse, encode, name_offset, glue_offset) \
+    { DNS_TYPE_##type, #type, parse, encode, name_offset, glue_offset },
+static const DNSTypeInfo types[TYPE_COUNT] = { DNS_RECORD_TYPES(TYPE_INFO) };
+#undef TYPE_INFO
+
+/* a switch over the codes, which the compiler turns into a jump table */
+const DNSTypeInfo *dns_type_info(unsigned short code)
+{
+    switch (code) {
+#define TYPE_CASE(type, parse, encode, name_offset, glue_offset) case DNS_TYPE_##type: return &types[TYPE_INDEX_##type];
+    DNS_RECORD_TYPES(TYPE_CASE)
+#undef TYPE_CASE
+    default:
+        return NULL;
+    }
+}
+
+const DNSTypeInfo *dns_type_by_name(const char *name)
+{
+    for (int i = 0; i < TYPE_COUNT; i++) {
+        if (strcmp(types[i].name, name) == 0) {
+            return &types[i];
+        }
+    }
+    return NULL;
+}
+
+const char *dns_type_name(unsigned short code)
+{
+    const DNSTypeInfo *info = dns_type_info(code);
+    return info != NULL ? info->name : "UNKNOWN";
+}
+
+int dns_type_validate(unsigned short code, const char *value)
+{
+    const DNSTypeInfo *info = dns_type_info(code);
+    unsigned char rdata[DNS_MAX_RDATA_SIZE];
+    
+    return info != NULL && info->encode(value, rdata, sizeof(rdata)) >= 0 ? 0 : -1;
+}
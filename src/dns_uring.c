@@ -0,0 +1,600 @@
+#include "dns_uring.h"
+#include "dns_alloc.h"
+
+#include <linux/io_uring.h>
+
+#ifdef IORING_RECV_MULTISHOT
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
+/*
+ * io_uring udp backend. queries arrive through one multishot recvmsg per
+ * worker, which picks receive buffers out of a provided buffer ring, and
+ * responses go out as sendmsg sqes that are submitted together with the next
+ * wait. in steady state each loop iteration is a single io_uring_enter().
+ * tcp connections stay on the worker's epoll loop, whose fd is polled
+ * through the ring. once it is readable the loop is dispatched without
+ * blocking on every iteration until it has nothing ready, as the poll only
+ * fires again for new events and not for level-triggered ones left over.
+ * the raw syscall interface is used so there is no liburing dependency.
+ */
+
+#define URING_BUFFER_GROUP 0
+#define URING_BUFFER_SIZE (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + DEFAULT_BUFFER_SIZE)
+
+#define URING_TAG_RECV     1ULL
+#define URING_TAG_SEND     2ULL
+#define URING_TAG_SHUTDOWN 3ULL
+#define URING_TAG_TIMER    4ULL
+#define URING_TAG_EVENTS   5ULL
+
+#define URING_USER_DATA(tag, index) (((tag) << 32) | (uint32_t)(index))
+#define URING_USER_TAG(data) ((data) >> 32)
+#define URING_USER_INDEX(data) ((uint32_t)(data))
+
+typedef struct
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_in addr;
+    unsigned char response[DNS_RESPONSE_BUFFER_SIZE];
+} DNSUringSend;
+
+struct dns_uring
+{
+    int ring_fd;
+    
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail;
+    unsigned to_submit;
+    
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    unsigned char *buffers;
+    unsigned short buf_tail;
+    
+    struct msghdr recv_msg;
+    int recv_armed;
+    int stop;
+    int events_ready;              /* the epoll loop may have ready sources, dispatch it before waiting */
+    
+    DNSUringSend *sends;
+    int *free_sends;
+    int free_send_count;
+    
+    int timer_fd;
+};
+
+static int uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int ring_fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+int dns_uring_supported(void)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    
+    int ring_fd = uring_setup(1, &params);
+    if (ring_fd < 0) {
+        return 0;
+    }
+    
+    close(ring_fd);
+    return 1;
+}
+
+static int uring_submit(struct dns_uring *ring, unsigned min_complete)
+{
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    
+    int ret = uring_enter(ring->ring_fd, ring->to_submit, min_complete, flags);
+    if (ret < 0) {
+        return -errno;
+    }
+    
+    ring->to_submit -= (unsigned)ret <= ring->to_submit ? (unsigned)ret : ring->to_submit;
+    return ret;
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct dns_uring *ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    
+    if (ring->sq_local_tail - head >= ring->sq_entries) {
+        /* submission queue full, hand what we have to the kernel first */
+        if (uring_submit(ring, 0) < 0) {
+            return NULL;
+        }
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sq_local_tail - head >= ring->sq_entries) {
+            return NULL;
+        }
+    }
+    
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sq_local_tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_local_tail++;
+    ring->to_submit++;
+    return sqe;
+}
+
+static void uring_recycle_buffer(struct dns_uring *ring, unsigned short bid)
+{
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail & (URING_BUFFER_COUNT - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(ring->buffers + (size_t)bid * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = bid;
+    ring->buf_tail++;
+}
+
+static void uring_publish_buffers(struct dns_uring *ring)
+{
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+static int uring_arm_recv(DNSWorker *worker)
+{
+    struct dns_uring *ring = worker->uring;
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (sqe == NULL) {
+        return -1;
+    }
+    
+    memset(&ring->recv_msg, 0, sizeof(ring->recv_msg));
+    ring->recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+    
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = worker->udp_socket;
+    sqe->addr = (uint64_t)(uintptr_t)&ring->recv_msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = URING_USER_DATA(URING_TAG_RECV, 0);
+    
+    ring->recv_armed = 1;
+    return 0;
+}
+
+static int uring_arm_poll(struct dns_uring *ring, int fd, unsigned long long tag, int multishot)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (sqe == NULL) {
+        return -1;
+    }
+    
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = URING_USER_DATA(tag, 0);
+    return 0;
+}
+
+static void uring_queue_send(DNSWorker *worker, const struct sockaddr_in *client_addr,
+                             const unsigned char *query, int query_len)
+{
+    struct dns_uring *ring = worker->uring;
+    
+    if (ring->free_send_count == 0) {
+        /* every send slot is in flight, answer synchronously rather than drop */
+        unsigned char response[DNS_RESPONSE_BUFFER_SIZE];
+        int response_len = build_dns_response(worker, query, query_len, response, sizeof(response),
+                                              DNS_TRANSPORT_UDP);
+        if (response_len >= 0) {
+            sendto(worker->udp_socket, response, response_len, 0,
+                   (const struct sockaddr *)client_addr, sizeof(*client_addr));
+        }
+        return;
+    }
+    
+    int slot = ring->free_sends[ring->free_send_count - 1];
+    DNSUringSend *send = &ring->sends[slot];
+    
+    int response_len = build_dns_response(worker, query, query_len, send->response, sizeof(send->response),
+                                          DNS_TRANSPORT_UDP);
+    if (response_len < 0) {
+        return;
+    }
+    
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (sqe == NULL) {
+        log_message(LOG_ERROR, "io_uring submission queue full, dropping response");
+        return;
+    }
+    ring->free_send_count--;
+    
+    send->addr = *client_addr;
+    send->iov.iov_base = send->response;
+    send->iov.iov_len = response_len;
+    memset(&send->msg, 0, sizeof(send->msg));
+    send->msg.msg_name = &send->addr;
+    send->msg.msg_namelen = sizeof(send->addr);
+    send->msg.msg_iov = &send->iov;
+    send->msg.msg_iovlen = 1;
+    
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = worker->udp_socket;
+    sqe->addr = (uint64_t)(uintptr_t)&send->msg;
+    sqe->len = 1;
+    sqe->user_data = URING_USER_DATA(URING_TAG_SEND, slot);
+}
+
+static void uring_handle_recv(DNSWorker *worker, struct io_uring_cqe *cqe)
+{
+    struct dns_uring *ring = worker->uring;
+    
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        ring->recv_armed = 0;
+    }
+    
+    if (cqe->res < 0) {
+        if (cqe->res != -ENOBUFS) {
+            log_message(LOG_ERROR, "io_uring recvmsg error: %s", strerror(-cqe->res));
+        }
+        return;
+    }
+    
+    if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+        return;
+    }
+    
+    unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    unsigned char *buf = ring->buffers + (size_t)bid * URING_BUFFER_SIZE;
+    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buf;
+    
+    size_t header_len = sizeof(*out) + ring->recv_msg.msg_namelen + ring->recv_msg.msg_controllen;
+    if ((size_t)cqe->res < header_len) {
+        uring_recycle_buffer(ring, bid);
+        return;
+    }
+    
+    const unsigned char *payload = buf + header_len;
+    size_t payload_len = out->payloadlen;
+    if (payload_len > (size_t)cqe->res - header_len) {
+        payload_len = (size_t)cqe->res - header_len;
+    }
+    
+    worker->batch_packets++;
+    
+    if (payload_len < sizeof(DNSHeader) + 5) {
+        log_message(LOG_WARNING, "Received packet too small to be a valid DNS query");
+    } else if (out->namelen >= sizeof(struct sockaddr_in)) {
+        struct sockaddr_in client_addr;
+        memcpy(&client_addr, buf + sizeof(*out), sizeof(client_addr));
+        uring_queue_send(worker, &client_addr, payload, (int)payload_len);
+    }
+    
+    uring_recycle_buffer(ring, bid);
+}
+
+static void uring_report_stats(DNSWorker *worker)
+{
+    if (worker->batch_calls == 0) {
+        return;
+    }
+    
+    log_message(LOG_INFO, "Worker %d io_uring stats: %llu packets in %llu completion batches, average %.2f per batch",
+              worker->id, worker->batch_packets, worker->batch_calls,
+              (double)worker->batch_packets / worker->batch_calls);
+}
+
+static void uring_handle_cqe(DNSWorker *worker, struct io_uring_cqe *cqe)
+{
+    struct dns_uring *ring = worker->uring;
+    
+    switch (URING_USER_TAG(cqe->user_data)) {
+    case URING_TAG_RECV:
+        uring_handle_recv(worker, cqe);
+        break;
+    case URING_TAG_SEND:
+        if (cqe->res < 0) {
+            log_message(LOG_ERROR, "io_uring sendmsg error: %s", strerror(-cqe->res));
+        }
+        ring->free_sends[ring->free_send_count++] = URING_USER_INDEX(cqe->user_data);
+        break;
+    case URING_TAG_SHUTDOWN:
+        ring->stop = 1;
+        break;
+    case URING_TAG_TIMER: {
+        uint64_t expirations;
+        while (read(ring->timer_fd, &expirations, sizeof(expirations)) > 0) {
+        }
+        uring_report_stats(worker);
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            uring_arm_poll(ring, ring->timer_fd, URING_TAG_TIMER, 1);
+        }
+        break;
+    }
+    case URING_TAG_EVENTS:
+        ring->events_ready = 1;
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            uring_arm_poll(ring, worker->loop.epoll_fd, URING_TAG_EVENTS, 1);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void dns_uring_run(DNSWorker *worker)
+{
+    struct dns_uring *ring = worker->uring;
+    
+    if (uring_arm_recv(worker) != 0 ||
+        uring_arm_poll(ring, shutdown_event_fd, URING_TAG_SHUTDOWN, 0) != 0 ||
+        (ring->timer_fd >= 0 && uring_arm_poll(ring, ring->timer_fd, URING_TAG_TIMER, 1) != 0) ||
+        (worker->tcp != NULL && uring_arm_poll(ring, worker->loop.epoll_fd, URING_TAG_EVENTS, 1) != 0)) {
+        log_message(LOG_ERROR, "Worker %d failed to arm io_uring requests", worker->id);
+        return;
+    }
+    
+    while (running && !ring->stop) {
+        int ret = uring_submit(ring, ring->events_ready ? 0 : 1);
+        if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY) {
+            log_message(LOG_ERROR, "io_uring_enter error: %s", strerror(-ret));
+            break;
+        }
+        
+        HOT_PATH_BEGIN();
+        unsigned long long packets_before = worker->batch_packets;
+        unsigned head = *ring->cq_head;
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        
+        while (head != tail) {
+            uring_handle_cqe(worker, &ring->cqes[head & ring->cq_mask]);
+            head++;
+        }
+        
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        uring_publish_buffers(ring);
+        HOT_PATH_END("io_uring query path");
+        
+        if (ring->events_ready) {
+            ring->events_ready = event_loop_dispatch(&worker->loop, 0) > 0;
+        }
+        
+        if (worker->batch_packets != packets_before) {
+            worker->batch_calls++;
+        }
+        
+        if (!ring->stop && !ring->recv_armed) {
+            uring_arm_recv(worker);
+        }
+    }
+    
+    uring_report_stats(worker);
+}
+
+static int uring_map_rings(struct dns_uring *ring, struct io_uring_params *params)
+{
+    ring->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    
+    if (params->features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = NULL;
+        return -1;
+    }
+    
+    if (params->features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = NULL;
+            return -1;
+        }
+    }
+    
+    ring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        return -1;
+    }
+    
+    unsigned char *sq = ring->sq_ring;
+    ring->sq_head = (unsigned *)(sq + params->sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params->sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params->sq_off.ring_mask);
+    ring->sq_entries = *(unsigned *)(sq + params->sq_off.ring_entries);
+    ring->sq_local_tail = *ring->sq_tail;
+    
+    /* sqe slots map one to one onto the submission array */
+    unsigned *sq_array = (unsigned *)(sq + params->sq_off.array);
+    for (unsigned i = 0; i < ring->sq_entries; i++) {
+        sq_array[i] = i;
+    }
+    
+    unsigned char *cq = ring->cq_ring;
+    ring->cq_head = (unsigned *)(cq + params->cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params->cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params->cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params->cq_off.cqes);
+    
+    return 0;
+}
+
+static int uring_register_buffers(struct dns_uring *ring)
+{
+    ring->buf_ring_size = URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    ring->buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buf_ring == MAP_FAILED) {
+        ring->buf_ring = NULL;
+        return -1;
+    }
+    
+    ring->buffers = malloc((size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+    if (ring->buffers == NULL) {
+        return -1;
+    }
+    
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->buf_ring;
+    reg.ring_entries = URING_BUFFER_COUNT;
+    reg.bgid = URING_BUFFER_GROUP;
+    
+    if (uring_register(ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        return -1;
+    }
+    
+    ring->buf_tail = 0;
+    for (unsigned short bid = 0; bid < URING_BUFFER_COUNT; bid++) {
+        uring_recycle_buffer(ring, bid);
+    }
+    uring_publish_buffers(ring);
+    
+    return 0;
+}
+
+int dns_uring_init(DNSWorker *worker)
+{
+    struct dns_uring *ring = calloc(1, sizeof(struct dns_uring));
+    if (ring == NULL) {
+        log_message(LOG_ERROR, "Failed to allocate io_uring state: %s", strerror(errno));
+        return -1;
+    }
+    
+    ring->ring_fd = -1;
+    ring->timer_fd = -1;
+    worker->uring = ring;
+    
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_CQ_DEPTH;
+    
+    ring->ring_fd = uring_setup(URING_QUEUE_DEPTH, &params);
+    if (ring->ring_fd < 0) {
+        log_message(LOG_ERROR, "io_uring_setup failed: %s", strerror(errno));
+        dns_uring_destroy(worker);
+        return -1;
+    }
+    
+    if (uring_map_rings(ring, &params) != 0) {
+        log_message(LOG_ERROR, "Failed to map io_uring rings: %s", strerror(errno));
+        dns_uring_destroy(worker);
+        return -1;
+    }
+    
+    if (uring_register_buffers(ring) != 0) {
+        log_message(LOG_ERROR, "Failed to register io_uring buffer ring: %s", strerror(errno));
+        dns_uring_destroy(worker);
+        return -1;
+    }
+    
+    ring->sends = calloc(URING_SEND_SLOTS, sizeof(DNSUringSend));
+    ring->free_sends = calloc(URING_SEND_SLOTS, sizeof(int));
+    if (ring->sends == NULL || ring->free_sends == NULL) {
+        log_message(LOG_ERROR, "Failed to allocate io_uring send slots: %s", strerror(errno));
+        dns_uring_destroy(worker);
+        return -1;
+    }
+    
+    for (int i = 0; i < URING_SEND_SLOTS; i++) {
+        ring->free_sends[i] = URING_SEND_SLOTS - 1 - i;
+    }
+    ring->free_send_count = URING_SEND_SLOTS;
+    
+    ring->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (ring->timer_fd >= 0) {
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        spec.it_interval.tv_sec = DEFAULT_STATS_INTERVAL;
+        spec.it_value.tv_sec = DEFAULT_STATS_INTERVAL;
+        timerfd_settime(ring->timer_fd, 0, &spec, NULL);
+    }
+    
+    return 0;
+}
+
+void dns_uring_destroy(DNSWorker *worker)
+{
+    struct dns_uring *ring = worker->uring;
+    if (ring == NULL) {
+        return;
+    }
+    
+    if (ring->timer_fd >= 0) close(ring->timer_fd);
+    if (ring->ring_fd >= 0) close(ring->ring_fd);
+    if (ring->sqes != NULL) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring != NULL) munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->buf_ring != NULL) munmap(ring->buf_ring, ring->buf_ring_size);
+    
+    free(ring->buffers);
+    free(ring->sends);
+    free(ring->free_sends);
+    free(ring);
+    worker->uring = NULL;
+}
+
+#else
+
+int dns_uring_supported(void)
+{
+    return 0;
+}
+
+int dns_uring_init(DNSWorker *worker)
+{
+    (void)worker;
+    log_message(LOG_ERROR, "io_uring backend not available: built against kernel headers without multishot recvmsg");
+    return -1;
+}
+
+void dns_uring_run(DNSWorker *worker)
+{
+    (void)worker;
+}
+
+void dns_uring_destroy(DNSWorker *worker)
+{
+    (void)worker;
+}
+
+#endif
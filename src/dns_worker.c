@@ -0,0 +1,350 @@
+#include "dns_worker.h"
+#include "dns_uring.h"
+#include "dns_tcp.h"
+#include "dns_alloc.h"
+
+static DNSWorker *workers = NULL;
+static int worker_count = 0;
+static int tcp_listener = -1;   /* shared by every worker unless config.tcp_reuseport */
+
+static void report_batch_stats(DNSWorker *worker) {
+    if (worker->batch_calls == 0) {
+        return;
+    }
+    
+    double avg_fill = (double)worker->batch_packets / (double)worker->batch_calls;
+    log_message(LOG_INFO, "Worker %d batch stats: %llu packets in %llu recvmmsg calls, average fill %.2f/%d (%.1f%%)",
+              worker->id, worker->batch_packets, worker->batch_calls, avg_fill, config.batch_size,
+              100.0 * avg_fill / config.batch_size);
+}
+
+static void process_single_query(DNSWorker *worker) {
+    struct sockaddr_in clientAddr;
+    socklen_t addrLen = sizeof(clientAddr);
+    unsigned char *buffer = worker->buffers[0];
+    HOT_PATH_BEGIN();
+    
+    memset(buffer, 0, DEFAULT_BUFFER_SIZE);
+    int len = recvfrom(worker->udp_socket, buffer, DEFAULT_BUFFER_SIZE, 0,
+                    (struct sockaddr *)&clientAddr, &addrLen);
+    
+    if (len < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            log_message(LOG_ERROR, "recvfrom error: %s", strerror(errno));
+        }
+        return;
+    }
+    
+    if (len < (int)(sizeof(DNSHeader) + 5)) {
+        log_message(LOG_WARNING, "Received packet too small to be a valid DNS query");
+        return;
+    }
+    
+    process_dns_query(worker, worker->udp_socket, buffer, len, worker->responses[0], DNS_RESPONSE_BUFFER_SIZE,
+                      &clientAddr, addrLen);
+    
+    HOT_PATH_END("recvfrom query path");
+}
+
+/*
+ * receives up to config.batch_size datagrams with one recvmmsg(), builds all
+ * responses and flushes them with one sendmmsg(). returns the number of
+ * datagrams received, 0 when the socket is drained.
+ */
+static int process_dns_batch(DNSWorker *worker) {
+    int batch_size = config.batch_size;
+    HOT_PATH_BEGIN();
+    
+    for (int i = 0; i < batch_size; i++) {
+        worker->rx_iovs[i].iov_base = worker->buffers[i];
+        worker->rx_iovs[i].iov_len = DEFAULT_BUFFER_SIZE;
+        
+        memset(&worker->rx_msgs[i], 0, sizeof(worker->rx_msgs[i]));
+        worker->rx_msgs[i].msg_hdr.msg_name = &worker->client_addrs[i];
+        worker->rx_msgs[i].msg_hdr.msg_namelen = sizeof(worker->client_addrs[i]);
+        worker->rx_msgs[i].msg_hdr.msg_iov = &worker->rx_iovs[i];
+        worker->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    
+    int received = recvmmsg(worker->udp_socket, worker->rx_msgs, batch_size, 0, NULL);
+    if (received < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            log_message(LOG_ERROR, "recvmmsg error: %s", strerror(errno));
+        }
+        return 0;
+    }
+    
+    worker->batch_calls++;
+    worker->batch_packets += received;
+    
+    int pending = 0;
+    for (int i = 0; i < received; i++) {
+        if (worker->rx_msgs[i].msg_len < sizeof(DNSHeader) + 5) {
+            log_message(LOG_WARNING, "Received packet too small to be a valid DNS query");
+            continue;
+        }
+        
+        int response_len = build_dns_response(worker, worker->buffers[i], worker->rx_msgs[i].msg_len,
+                                              worker->responses[pending], DNS_RESPONSE_BUFFER_SIZE,
+                                              DNS_TRANSPORT_UDP);
+        if (response_len < 0) {
+            continue;
+        }
+        
+        worker->tx_iovs[pending].iov_base = worker->responses[pending];
+        worker->tx_iovs[pending].iov_len = response_len;
+        
+        memset(&worker->tx_msgs[pending], 0, sizeof(worker->tx_msgs[pending]));
+        worker->tx_msgs[pending].msg_hdr.msg_name = &worker->client_addrs[i];
+        worker->tx_msgs[pending].msg_hdr.msg_namelen = worker->rx_msgs[i].msg_hdr.msg_namelen;
+        worker->tx_msgs[pending].msg_hdr.msg_iov = &worker->tx_iovs[pending];
+        worker->tx_msgs[pending].msg_hdr.msg_iovlen = 1;
+        pending++;
+    }
+    
+    int sent = 0;
+    while (sent < pending) {
+        int n = sendmmsg(worker->udp_socket, worker->tx_msgs + sent, pending - sent, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_message(LOG_ERROR, "sendmmsg error: %s, dropped %d responses",
+                      strerror(errno), pending - sent);
+            break;
+        }
+        sent += n;
+    }
+    
+    HOT_PATH_END("batched query path");
+    return received;
+}
+
+static void handle_udp_readable(DNSEventLoop *loop, int fd, uint32_t events, void *arg) {
+    (void)loop;
+    (void)fd;
+    (void)events;
+    DNSWorker *worker = (DNSWorker *)arg;
+    
+    if (config.batch_size > 1) {
+        /* keep draining while the kernel hands us full batches */
+        while (running && process_dns_batch(worker) == config.batch_size) {
+        }
+    } else {
+        process_single_query(worker);
+    }
+}
+
+static void handle_stats_timer(DNSEventLoop *loop, int fd, uint32_t events, void *arg) {
+    (void)loop;
+    (void)fd;
+    (void)events;
+    report_batch_stats((DNSWorker *)arg);
+}
+
+static void *worker_thread(void *arg) {
+    DNSWorker *worker = (DNSWorker *)arg;
+    
+    log_message(LOG_DEBUG, "Worker %d started on socket %d", worker->id, worker->udp_socket);
+    
+    if (worker->uring != NULL) {
+        dns_uring_run(worker);
+    } else {
+        event_loop_run(&worker->loop);
+        report_batch_stats(worker);
+    }
+    
+    return NULL;
+}
+
+static void free_worker(DNSWorker *worker) {
+    dns_tcp_destroy(worker);
+    
+    if (worker->loop_ready) {
+        event_loop_destroy(&worker->loop);
+        worker->loop_ready = 0;
+    }
+    
+    dns_uring_destroy(worker);
+    response_cache_destroy(worker->cache);
+    worker->cache = NULL;
+    
+    if (worker->udp_socket >= 0) {
+        close(worker->udp_socket);
+        worker->udp_socket = -1;
+    }
+    
+    free(worker->rx_msgs);
+    free(worker->tx_msgs);
+    free(worker->rx_iovs);
+    free(worker->tx_iovs);
+    free(worker->client_addrs);
+    free(worker->buffers);
+    free(worker->responses);
+}
+
+static int init_worker(DNSWorker *worker, int id) {
+    int batch_size = config.batch_size;
+    
+    memset(worker, 0, sizeof(*worker));
+    worker->id = id;
+    
+    worker->rx_msgs = calloc(batch_size, sizeof(struct mmsghdr));
+    worker->tx_msgs = calloc(batch_size, sizeof(struct mmsghdr));
+    worker->rx_iovs = calloc(batch_size, sizeof(struct iovec));
+    worker->tx_iovs = calloc(batch_size, sizeof(struct iovec));
+    worker->client_addrs = calloc(batch_size, sizeof(struct sockaddr_in));
+    worker->buffers = calloc(batch_size, DEFAULT_BUFFER_SIZE);
+    worker->responses = calloc(batch_size, DNS_RESPONSE_BUFFER_SIZE);
+    
+    if (worker->rx_msgs == NULL || worker->tx_msgs == NULL || worker->rx_iovs == NULL ||
+        worker->tx_iovs == NULL || worker->client_addrs == NULL ||
+        worker->buffers == NULL || worker->responses == NULL) {
+        log_message(LOG_ERROR, "Failed to allocate buffers for worker %d: %s", id, strerror(errno));
+        worker->udp_socket = -1;
+        free_worker(worker);
+        return -1;
+    }
+    
+    if (config.cache_size > 0) {
+        worker->cache = response_cache_create(config.cache_size / config.workers);
+        if (worker->cache == NULL) {
+            log_message(LOG_WARNING, "Worker %d response cache disabled, %zu bytes is too small or allocation failed",
+                      id, config.cache_size / config.workers);
+        }
+    }
+    
+    worker->udp_socket = init_dns_server();
+    if (worker->udp_socket < 0) {
+        free_worker(worker);
+        return -1;
+    }
+    
+    /* tcp connections are served from this loop with either backend, io_uring polls its epoll fd */
+    if (event_loop_init(&worker->loop, NULL, NULL) != 0) {
+        free_worker(worker);
+        return -1;
+    }
+    worker->loop_ready = 1;
+    
+    if (config.tcp_connections > 0 && dns_tcp_init(worker, tcp_listener) != 0) {
+        free_worker(worker);
+        return -1;
+    }
+    
+    if (config.io_backend == IO_BACKEND_URING) {
+        if (dns_uring_init(worker) != 0) {
+            free_worker(worker);
+            return -1;
+        }
+        return 0;
+    }
+    
+    if (event_loop_add(&worker->loop, worker->udp_socket, EPOLLIN, handle_udp_readable, worker) != 0) {
+        free_worker(worker);
+        return -1;
+    }
+    
+    if (config.batch_size > 1 &&
+        event_loop_add_timer(&worker->loop, DEFAULT_STATS_INTERVAL * 1000, handle_stats_timer, worker) < 0) {
+        free_worker(worker);
+        return -1;
+    }
+    
+    return 0;
+}
+
+int start_dns_workers(int count) {
+    workers = calloc(count, sizeof(DNSWorker));
+    if (workers == NULL) {
+        log_message(LOG_ERROR, "Failed to allocate workers: %s", strerror(errno));
+        return -1;
+    }
+    
+    if (config.tcp_connections > 0 && !config.tcp_reuseport) {
+        tcp_listener = dns_tcp_listen(0);
+        if (tcp_listener < 0) {
+            stop_dns_workers();
+            return -1;
+        }
+    }
+    
+    /* bind every socket before any thread runs so a bind error fails startup cleanly */
+    for (worker_count = 0; worker_count < count; worker_count++) {
+        if (init_worker(&workers[worker_count], worker_count) != 0) {
+            stop_dns_workers();
+            return -1;
+        }
+    }
+    
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]) != 0) {
+            log_message(LOG_ERROR, "Failed to create worker thread %d: %s", i, strerror(errno));
+            signal_shutdown();
+            stop_dns_workers();
+            return -1;
+        }
+        workers[i].started = 1;
+    }
+    
+    if (config.io_backend == IO_BACKEND_URING) {
+        log_message(LOG_INFO, "io_uring I/O backend enabled with multishot recvmsg and %d provided buffers per worker",
+                  URING_BUFFER_COUNT);
+    } else if (config.batch_size > 1) {
+        log_message(LOG_INFO, "Batched I/O enabled with up to %d datagrams per call", config.batch_size);
+    }
+    
+    if (config.tcp_connections > 0) {
+        log_message(LOG_INFO, "DNS over TCP enabled with up to %d connections, %d s idle timeout, %s",
+                  config.tcp_connections, config.tcp_idle_timeout,
+                  config.tcp_reuseport ? "a listener per worker" : "one shared listener");
+    }
+    
+    return 0;
+}
+
+void get_cache_stats(DNSCacheStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    
+    for (int i = 0; i < worker_count; i++) {
+        if (workers[i].cache != NULL) {
+            response_cache_add_stats(workers[i].cache, stats);
+        }
+    }
+}
+
+void get_tcp_stats(DNSTcpStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    
+    for (int i = 0; i < worker_count; i++) {
+        dns_tcp_add_stats(&workers[i], stats);
+    }
+}
+
+unsigned long long get_filtered_queries(void) {
+    unsigned long long filtered = 0;
+    
+    for (int i = 0; i < worker_count; i++) {
+        filtered += __atomic_load_n(&workers[i].filtered, __ATOMIC_RELAXED);
+    }
+    
+    return filtered;
+}
+
+void stop_dns_workers(void) {
+    for (int i = 0; i < worker_count; i++) {
+        if (workers[i].started) {
+            pthread_join(workers[i].thread, NULL);
+        }
+        free_worker(&workers[i]);
+    }
+    
+    free(workers);
+    workers = NULL;
+    worker_count = 0;
+    
+    if (tcp_listener >= 0) {
+        close(tcp_listener);
+        tcp_listener = -1;
+    }
+}
@@ -0,0 +1,475 @@
+#include "dns_zone_image.h"
+#include "dns_types.h"
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ZONE_IMAGE_CHECKSUM_SEED 0x510e527fade682d1ULL
+
+typedef uint32_t FilterBlock[FILTER_BLOCK_WORDS];
+
+static uint64_t align_offset(uint64_t offset)
+{
+    return (offset + ZONE_IMAGE_ALIGN - 1) & ~(uint64_t)(ZONE_IMAGE_ALIGN - 1);
+}
+
+static uint64_t image_checksum(const unsigned char *image, uint64_t size)
+{
+    return phash_hash(ZONE_IMAGE_CHECKSUM_SEED, (const char *)image + sizeof(DNSZoneImageHeader),
+                      size - sizeof(DNSZoneImageHeader));
+}
+
+/*
+ * appends len bytes to a section being built, unless the same bytes are
+ * already in it, and returns their offset. the section is allocated for
+ * its worst case up front, so interned data never moves.
+ */
+static int64_t put_interned(DNSInternTable *intern, unsigned char *section, uint64_t *used, const void *data,
+                            size_t len)
+{
+    if (len == 0) {
+        return 0;
+    }
+    
+    const unsigned char *copy = intern_find(intern, data, len);
+    if (copy != NULL) {
+        return copy - section;
+    }
+    
+    uint64_t offset = *used;
+    memcpy(section + offset, data, len);
+    if (intern_add(intern, section + offset, len) != 0) {
+        return -1;
+    }
+    *used += len;
+    return (int64_t)offset;
+}
+
+/* the sections follow the header in this order, each aligned to ZONE_IMAGE_ALIGN */
+static uint64_t place_section(uint64_t *offset, uint64_t size)
+{
+    uint64_t start = *offset;
+    *offset = align_offset(start + size);
+    return start;
+}
+
+static int write_file(const char *path, const unsigned char *data, size_t size)
+{
+    char temp[4096];
+    if (snprintf(temp, sizeof(temp), "%s.tmp", path) >= (int)sizeof(temp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    size_t written = 0;
+    while (written < size) {
+        ssize_t n = write(fd, data + written, size - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            close(fd);
+            unlink(temp);
+            return -1;
+        }
+        written += n;
+    }
+    
+    if (fsync(fd) != 0 || close(fd) != 0 || rename(temp, path) != 0) {
+        unlink(temp);
+        return -1;
+    }
+    
+    return 0;
+}
+
+int zone_image_write(const DNSCompiledZone *zone, const char *path)
+{
+    DNSZoneImageHeader header = { 0 };
+    uint64_t value_count = 0;
+    uint64_t strings_max = zone->names_size;
+    uint64_t answers_max = 0;
+    
+    for (uint32_t i = 0; i < zone->record_count; i++) {
+        const DNSRecord *record = &zone->records[i];
+        
+        strings_max += strlen(record->text->domain) + 1;
+        for (int v = 0; v < record->num_values; v++) {
+            strings_max += strlen(record->text->values[v]) + 1;
+        }
+        value_count += record->num_values;
+        answers_max += record->answers_len + record->glue_len;
+    }
+    for (uint32_t i = 0; i < zone->zone_ttl_count; i++) {
+        strings_max += strlen(zone->zone_ttls[i].apex) + 1;
+    }
+    
+    if (strings_max > UINT32_MAX || answers_max > UINT32_MAX || value_count > UINT32_MAX) {
+        log_message(LOG_ERROR, "zone too large for an image: %llu bytes of strings, %llu bytes of answers",
+                  (unsigned long long)strings_max, (unsigned long long)answers_max);
+        return -1;
+    }
+    
+    /*
+     * strings and answers are laid out first, each stored once: owner names,
+     * a value many records share and answers repeated across records all
+     * point at one copy, and a record's domain points at its owner's name
+     */
+    int result = -1;
+    unsigned char *image = NULL;
+    unsigned char *strings = malloc(strings_max + 1);
+    unsigned char *answers = malloc(answers_max + 1);
+    DNSZoneImageRecord *records = calloc((size_t)zone->record_count + 1, sizeof(DNSZoneImageRecord));
+    uint32_t *values = malloc((value_count + 1) * sizeof(uint32_t));
+    DNSZoneImageZone *zones = calloc((size_t)zone->zone_ttl_count + 1, sizeof(DNSZoneImageZone));
+    DNSInternTable strings_intern, answers_intern;
+    intern_init(&strings_intern, zone->phash.seed);
+    intern_init(&answers_intern, zone->phash.seed);
+    
+    if (strings == NULL || answers == NULL || records == NULL || values == NULL || zones == NULL) {
+        log_message(LOG_ERROR, "failed to allocate zone image sections: %s", strerror(errno));
+        goto done;
+    }
+    
+    /* the slots point at owner names by offset, so the names go in first and unchanged */
+    uint64_t strings_used = zone->names_size;
+    uint64_t answers_used = 0;
+    uint32_t values_used = 0;
+    memcpy(strings, zone->names, zone->names_size);
+    
+    for (uint32_t name = 0; name < zone->names_size; name += strlen(zone->names + name) + 1) {
+        if (intern_add(&strings_intern, strings + name, strlen(zone->names + name) + 1) != 0) {
+            log_message(LOG_ERROR, "failed to index zone image strings: %s", strerror(errno));
+            goto done;
+        }
+    }
+    
+    for (uint32_t i = 0; i < zone->record_count; i++) {
+        const DNSRecord *record = &zone->records[i];
+        DNSZoneImageRecord *out = &records[i];
+        
+        int64_t domain = put_interned(&strings_intern, strings, &strings_used, record->text->domain,
+                                      strlen(record->text->domain) + 1);
+        int64_t answer = put_interned(&answers_intern, answers, &answers_used, record->answers,
+                                      record->answers_len + record->glue_len);
+        if (domain < 0 || answer < 0) {
+            log_message(LOG_ERROR, "failed to index zone image strings: %s", strerror(errno));
+            goto done;
+        }
+        
+        out->domain = (uint32_t)domain;
+        out->values = values_used;
+        out->num_values = record->num_values;
+        for (int v = 0; v < record->num_values; v++) {
+            int64_t value = put_interned(&strings_intern, strings, &strings_used, record->text->values[v],
+                                         strlen(record->text->values[v]) + 1);
+            if (value < 0) {
+                log_message(LOG_ERROR, "failed to index zone image strings: %s", strerror(errno));
+                goto done;
+            }
+            values[values_used++] = (uint32_t)value;
+        }
+        
+        out->answers = (uint32_t)answer;
+        out->answers_len = (uint32_t)record->answers_len;
+        out->glue_len = record->glue_len;
+        out->next = record->name_next != NULL ? (uint32_t)(record->name_next - zone->records) + 1 : 0;
+        out->type_code = record->type_code;
+        out->scope = (uint8_t)record->scope;
+    }
+    
+    for (uint32_t i = 0; i < zone->zone_ttl_count; i++) {
+        int64_t apex = put_interned(&strings_intern, strings, &strings_used, zone->zone_ttls[i].apex,
+                                    strlen(zone->zone_ttls[i].apex) + 1);
+        if (apex < 0) {
+            log_message(LOG_ERROR, "failed to index zone image strings: %s", strerror(errno));
+            goto done;
+        }
+        zones[i].apex = (uint32_t)apex;
+        zones[i].ttl = zone->zone_ttls[i].ttl;
+    }
+    
+    memcpy(header.magic, ZONE_IMAGE_MAGIC, sizeof(header.magic));
+    header.version = ZONE_IMAGE_VERSION;
+    header.header_size = sizeof(DNSZoneImageHeader);
+    header.phash_seed = zone->phash.seed;
+    header.key_count = zone->phash.key_count;
+    header.slot_count = zone->phash.slot_count;
+    header.bucket_count = zone->phash.bucket_count;
+    header.name_count = zone->name_count;
+    header.record_count = zone->record_count;
+    header.wildcard_count = zone->wildcard_count;
+    header.filter_blocks = zone->filter.blocks != NULL ? zone->filter.block_mask + 1 : 0;
+    header.filter_names = zone->filter.names;
+    header.names_size = zone->names_size;
+    header.value_count = (uint32_t)value_count;
+    header.zone_count = zone->zone_ttl_count;
+    header.strings_size = strings_used;
+    header.answers_size = answers_used;
+    
+    uint64_t offset = align_offset(sizeof(header));
+    header.pilots = place_section(&offset, (uint64_t)header.bucket_count * sizeof(uint16_t));
+    header.entries = place_section(&offset, (uint64_t)header.slot_count * sizeof(DNSCompiledEntry));
+    header.filter = place_section(&offset, (uint64_t)header.filter_blocks * sizeof(FilterBlock));
+    header.records = place_section(&offset, (uint64_t)header.record_count * sizeof(DNSZoneImageRecord));
+    header.values = place_section(&offset, value_count * sizeof(uint32_t));
+    header.strings = place_section(&offset, strings_used);
+    header.answers = place_section(&offset, answers_used);
+    header.zones = place_section(&offset, (uint64_t)header.zone_count * sizeof(DNSZoneImageZone));
+    header.size = offset;
+    
+    image = calloc(1, header.size);
+    if (image == NULL) {
+        log_message(LOG_ERROR, "failed to allocate %llu byte zone image: %s",
+                  (unsigned long long)header.size, strerror(errno));
+        goto done;
+    }
+    
+    memcpy(image + header.pilots, zone->phash.pilots, (size_t)header.bucket_count * sizeof(uint16_t));
+    memcpy(image + header.entries, zone->entries, (size_t)header.slot_count * sizeof(DNSCompiledEntry));
+    if (header.filter_blocks != 0) {
+        memcpy(image + header.filter, zone->filter.blocks, (size_t)header.filter_blocks * sizeof(FilterBlock));
+    }
+    memcpy(image + header.records, records, (size_t)header.record_count * sizeof(DNSZoneImageRecord));
+    memcpy(image + header.values, values, value_count * sizeof(uint32_t));
+    memcpy(image + header.strings, strings, strings_used);
+    memcpy(image + header.answers, answers, answers_used);
+    memcpy(image + header.zones, zones, (size_t)header.zone_count * sizeof(DNSZoneImageZone));
+    
+    header.checksum = image_checksum(image, header.size);
+    memcpy(image, &header, sizeof(header));
+    
+    result = write_file(path, image, header.size);
+    if (result != 0) {
+        log_message(LOG_ERROR, "failed to write zone image %s: %s", path, strerror(errno));
+    } else {
+        log_message(LOG_INFO, "wrote zone image %s: %u names, %u records, %llu bytes",
+                  path, zone->name_count, zone->record_count, (unsigned long long)header.size);
+    }
+    
+done:
+    intern_free(&strings_intern);
+    intern_free(&answers_intern);
+    free(strings);
+    free(answers);
+    free(records);
+    free(values);
+    free(zones);
+    free(image);
+    return result;
+}
+
+/* count items of size bytes at offset, aligned and inside the image */
+static int section_valid(const DNSZoneImageHeader *header, uint64_t offset, uint64_t count, size_t size,
+                         size_t align)
+{
+    return offset >= header->header_size && offset <= header->size && offset % align == 0 &&
+           count <= (header->size - offset) / size;
+}
+
+static int header_valid(const DNSZoneImageHeader *header, uint64_t file_size)
+{
+    if (memcmp(header->magic, ZONE_IMAGE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != ZONE_IMAGE_VERSION || header->header_size != sizeof(DNSZoneImageHeader) ||
+        header->size != file_size) {
+        return 0;
+    }
+    
+    if (header->slot_count == 0 || header->bucket_count == 0 ||
+        (header->filter_blocks & (header->filter_blocks - 1)) != 0 ||
+        header->names_size > header->strings_size || header->strings_size == 0 ||
+        header->strings_size > UINT32_MAX || header->answers_size > UINT32_MAX) {
+        return 0;
+    }
+    
+    return section_valid(header, header->pilots, header->bucket_count, sizeof(uint16_t), sizeof(uint16_t)) &&
+           section_valid(header, header->entries, header->slot_count, sizeof(DNSCompiledEntry),
+                         sizeof(uint64_t)) &&
+           section_valid(header, header->filter, header->filter_blocks, sizeof(FilterBlock), sizeof(FilterBlock)) &&
+           section_valid(header, header->records, header->record_count, sizeof(DNSZoneImageRecord),
+                         sizeof(uint32_t)) &&
+           section_valid(header, header->values, header->value_count, sizeof(uint32_t), sizeof(uint32_t)) &&
+           section_valid(header, header->strings, header->strings_size, 1, 1) &&
+           section_valid(header, header->answers, header->answers_size, 1, 1) &&
+           section_valid(header, header->zones, header->zone_count, sizeof(DNSZoneImageZone), sizeof(uint32_t));
+}
+
+static int entries_valid(const DNSZoneImageHeader *header, const DNSCompiledEntry *entries)
+{
+    for (uint32_t i = 0; i < header->slot_count; i++) {
+        const DNSCompiledEntry *entry = &entries[i];
+        
+        if (entry->name_len != 0 && (uint64_t)entry->name + entry->name_len >= header->names_size) {
+            return 0;
+        }
+        for (int scope = 0; scope < DNS_SCOPE_COUNT; scope++) {
+            if (entry->records[scope] > header->record_count) {
+                return 0;
+            }
+        }
+    }
+    
+    return 1;
+}
+
+/*
+ * record headers and their strings point into the image, only they and the
+ * value arrays are private to the process. a record chain only ever moves forward through
+ * the array, so a damaged image can't make a lookup loop.
+ */
+static int load_records(DNSCompiledZone *zone, const DNSZoneImageHeader *header, const unsigned char *image)
+{
+    const DNSZoneImageRecord *records = (const DNSZoneImageRecord *)(image + header->records);
+    const uint32_t *values = (const uint32_t *)(image + header->values);
+    const char *strings = (const char *)image + header->strings;
+    const unsigned char *answers = image + header->answers;
+    
+    zone->records = arena_calloc(&zone->arena, (size_t)header->record_count + 1, sizeof(DNSRecord));
+    zone->texts = arena_calloc(&zone->arena, (size_t)header->record_count + 1, sizeof(DNSRecordText));
+    char **value_ptrs = arena_calloc(&zone->arena, (size_t)header->value_count + 1, sizeof(char *));
+    if (zone->records == NULL || zone->texts == NULL || value_ptrs == NULL) {
+        log_message(LOG_ERROR, "failed to allocate %u zone image records: %s", header->record_count, strerror(errno));
+        return -1;
+    }
+    
+    for (uint32_t i = 0; i < header->value_count; i++) {
+        if (values[i] >= header->strings_size) {
+            return -1;
+        }
+        value_ptrs[i] = (char *)strings + values[i];
+    }
+    
+    for (uint32_t i = 0; i < header->record_count; i++) {
+        const DNSZoneImageRecord *in = &records[i];
+        DNSRecord *record = &zone->records[i];
+        
+        if (in->domain >= header->strings_size || in->num_values > (uint32_t)INT_MAX ||
+            (uint64_t)in->values + in->num_values > header->value_count ||
+            (uint64_t)in->answers + in->answers_len + in->glue_len > header->answers_size ||
+            in->glue_len > DNS_MAX_GLUE_SIZE ||
+            (in->next != 0 && (in->next <= i + 1 || in->next > header->record_count)) ||
+            in->scope >= DNS_SCOPE_COUNT || dns_type_info(in->type_code) == NULL) {
+            return -1;
+        }
+        
+        record->text = &zone->texts[i];
+        record->text->domain = (char *)strings + in->domain;
+        record->text->values = value_ptrs + in->values;
+        record->num_values = (int)in->num_values;
+        record->scope = in->scope;
+        record->type_code = in->type_code;
+        record->answers = (unsigned char *)answers + in->answers;
+        record->answers_len = in->answers_len;
+        record->glue_len = (uint16_t)in->glue_len;
+        record->name_next = in->next != 0 ? &zone->records[in->next - 1] : NULL;
+    }
+    
+    return 0;
+}
+
+/* the zone ttls are kept in the arena like the records, their apexes point into the image */
+static int load_zone_ttls(DNSCompiledZone *zone, const DNSZoneImageHeader *header, const unsigned char *image)
+{
+    const DNSZoneImageZone *zones = (const DNSZoneImageZone *)(image + header->zones);
+    const char *strings = (const char *)image + header->strings;
+    
+    DNSZoneTtl *zone_ttls = arena_calloc(&zone->arena, (size_t)header->zone_count + 1, sizeof(DNSZoneTtl));
+    if (zone_ttls == NULL) {
+        log_message(LOG_ERROR, "failed to allocate %u zone image zones: %s", header->zone_count, strerror(errno));
+        return -1;
+    }
+    
+    for (uint32_t i = 0; i < header->zone_count; i++) {
+        if (zones[i].apex >= header->strings_size) {
+            return -1;
+        }
+        zone_ttls[i].apex = strings + zones[i].apex;
+        zone_ttls[i].ttl = zones[i].ttl;
+    }
+    
+    zone->zone_ttls = zone_ttls;
+    zone->zone_ttl_count = header->zone_count;
+    return 0;
+}
+
+DNSCompiledZone *zone_image_load(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        log_message(LOG_ERROR, "failed to open zone image %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(DNSZoneImageHeader)) {
+        log_message(LOG_ERROR, "zone image %s is too short", path);
+        close(fd);
+        return NULL;
+    }
+    
+    size_t size = (size_t)st.st_size;
+    const unsigned char *image = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        log_message(LOG_ERROR, "failed to map zone image %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    
+    const DNSZoneImageHeader *header = (const DNSZoneImageHeader *)image;
+    if (!header_valid(header, size)) {
+        log_message(LOG_ERROR, "zone image %s has a bad header or was written by another version", path);
+        munmap((void *)image, size);
+        return NULL;
+    }
+    
+    if (image_checksum(image, size) != header->checksum) {
+        log_message(LOG_ERROR, "zone image %s fails its checksum", path);
+        munmap((void *)image, size);
+        return NULL;
+    }
+    
+    DNSCompiledZone *zone = calloc(1, sizeof(DNSCompiledZone));
+    if (zone == NULL) {
+        log_message(LOG_ERROR, "failed to allocate compiled zone: %s", strerror(errno));
+        munmap((void *)image, size);
+        return NULL;
+    }
+    
+    /* from here on releasing the zone unmaps the image */
+    zone->refs = 1;
+    arena_init(&zone->arena);
+    zone->image = image;
+    zone->image_size = size;
+    
+    zone->phash.seed = header->phash_seed;
+    zone->phash.key_count = header->key_count;
+    zone->phash.slot_count = header->slot_count;
+    zone->phash.bucket_count = header->bucket_count;
+    zone->phash.pilots = (uint16_t *)(image + header->pilots);
+    zone->entries = (const DNSCompiledEntry *)(image + header->entries);
+    zone->names = (const char *)image + header->strings;
+    zone->names_size = header->names_size;
+    zone->name_count = header->name_count;
+    zone->record_count = header->record_count;
+    zone->wildcard_count = header->wildcard_count;
+    
+    if (header->filter_blocks != 0) {
+        zone->filter.blocks = (void *)(image + header->filter);
+        zone->filter.block_mask = header->filter_blocks - 1;
+        zone->filter.names = header->filter_names;
+    }
+    
+    if (!entries_valid(header, zone->entries) || load_records(zone, header, image) != 0 ||
+        load_zone_ttls(zone, header, image) != 0) {
+        log_message(LOG_ERROR, "failed to load the records of zone image %s", path);
+        compiled_zone_release(zone);
+        return NULL;
+    }
+    
+    return zone;
+}
@@ -1,10 +1,17 @@
 #include "dns_server.h"
 #include "dns_records.h"
+#include "dns_cache.h"
+#include "dns_compress.h"
 #include "dns_parser.h"
+#include "dns_types.h"
+#include "dns_worker.h"
+#include "dns_event.h"
+#include "dns_uring.h"
+#include <getopt.h>
 
 void handle_signal(int sig) {
     log_message(LOG_INFO, "Received signal %d, shutting down...", sig);
-    running = 0;
+    signal_shutdown();
 }
 
 int init_dns_server() {
@@ -21,6 +28,12 @@ int init_dns_server() {
         return -1;
     }
     
+    if (setsockopt(udpSocket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        log_message(LOG_ERROR, "setsockopt SO_REUSEPORT error: %s", strerror(errno));
+        close(udpSocket);
+        return -1;
+    }
+    
     struct sockaddr_in serverAddr;
     memset(&serverAddr, 0, sizeof(serverAddr));
     serverAddr.sin_family = AF_INET;
@@ -46,27 +59,152 @@ int init_dns_server() {
         return -1;
     }
     
-    log_message(LOG_INFO, "DNS server started on port %d", config.dns_port);
+    log_message(LOG_DEBUG, "DNS socket %d bound to port %d", udpSocket, config.dns_port);
     return udpSocket;
 }
 
-void process_dns_query(int udpSocket, unsigned char *buffer, int len, 
-                     struct sockaddr_in *clientAddr, socklen_t addrLen) {
+/*
+ * the most a response to this query may take: over udp 512 bytes without
+ * EDNS, or the client's payload size, never less than 512 nor more than we
+ * advertise. over tcp the whole buffer.
+ */
+static size_t response_limit(const DNSEdns *edns, DNSTransport transport, size_t response_size)
+{
+    size_t limit = DEFAULT_BUFFER_SIZE;
+    
+    if (transport == DNS_TRANSPORT_TCP) {
+        return response_size;
+    }
+    
+    if (edns->present) {
+        limit = edns->payload > DEFAULT_BUFFER_SIZE ? edns->payload : DEFAULT_BUFFER_SIZE;
+        if (limit > (size_t)config.edns_payload) {
+            limit = config.edns_payload;
+        }
+    }
+    return limit < response_size ? limit : response_size;
+}
+
+/* tells apart responses to the same question: 0 for udp without EDNS, the udp size limit, or 1 and 2 for tcp */
+static unsigned short cache_variant(const DNSEdns *edns, DNSTransport transport, size_t response_size)
+{
+    if (transport == DNS_TRANSPORT_TCP) {
+        return edns->present ? 2 : 1;
+    }
+    return edns->present ? response_limit(edns, transport, response_size) : 0;
+}
+
+/* sets the rcode, appends the OPT record an EDNS query gets back and writes the header */
+static int finish_response(unsigned char *response, int response_len, size_t response_size,
+                           DNSHeader *header, const DNSEdns *edns, int rcode)
+{
+    header->rcode = rcode & 0xF;
+    
+    if (edns->present) {
+        response_len = dns_write_opt(response, response_len, response_size, config.edns_payload, rcode);
+        if (response_len < 0) {
+            log_message(LOG_ERROR, "Response buffer too small for OPT record");
+            return -1;
+        }
+        header->arcount = htons(ntohs(header->arcount) + 1);
+    }
+    
+    memcpy(response, header, sizeof(DNSHeader));
+    return response_len;
+}
+
+/* the bytes of a glue record's owner name and type, which every record of its rrset repeats */
+static size_t glue_rrset_key_len(const unsigned char *glue)
+{
+    size_t len = 0;
     
-    DNSHeader *reqHeader = (DNSHeader *)buffer;
+    while (glue[len] != 0) {
+        len += glue[len] + 1;
+    }
+    return len + 3;
+}
+
+/*
+ * appends the record's glue after its answers, one whole rrset at a time
+ * while they fit. the first rrset that doesn't is left out with all after
+ * it and TC stays clear, the answers are complete without it (rfc 2181 9).
+ * returns the number of records added.
+ */
+static int append_glue(DNSCompressor *compressor, unsigned char *response, size_t *len, size_t size,
+                       const DNSRecord *record)
+{
+    const unsigned char *glue = record->answers + record->answers_len;
+    const unsigned char *end = glue + record->glue_len;
+    const unsigned char *rrset = NULL;
+    size_t rrset_key_len = 0;
+    size_t rrset_start = *len;
+    int rrset_suffixes = compressor->count;
+    int rrset_count = 0;
+    int count = 0;
+    
+    while (glue < end) {
+        if (rrset == NULL || (size_t)(end - glue) < rrset_key_len || memcmp(glue, rrset, rrset_key_len) != 0) {
+            rrset = glue;
+            rrset_key_len = glue_rrset_key_len(glue);
+            rrset_start = *len;
+            rrset_suffixes = compressor->count;
+            rrset_count = count;
+        }
+        
+        int used = dns_compress_record(compressor, response, len, size, glue, end - glue);
+        if (used < 0) {
+            /* names of a dropped rrset must not be pointed at */
+            *len = rrset_start;
+            compressor->count = rrset_suffixes;
+            return rrset_count;
+        }
+        glue += used;
+        count++;
+    }
+    
+    return count;
+}
+
+int build_dns_response(DNSWorker *worker, const unsigned char *buffer, int len, 
+                       unsigned char *response, size_t response_size, DNSTransport transport) {
+    
+    const DNSHeader *reqHeader = (const DNSHeader *)buffer;
+    DNSResponseCache *cache = worker->cache;
+    
+    DNSCacheKey cache_key;
+    DNSEdns edns;
+    int keyed = cache != NULL && response_cache_key(buffer, len, &cache_key) == 0;
+    int edns_status = keyed ? dns_parse_edns(buffer, len, sizeof(DNSHeader) + cache_key.question_len, &edns) : 0;
+    
+    /*
+     * the same question is cached once per transport and response size
+     * limit. a query whose OPT record is broken or of a later version gets
+     * an error, which isn't cached.
+     */
+    int cacheable = keyed && edns_status == 0 && edns.version == 0;
+    
+    if (cacheable) {
+        response_cache_key_variant(&cache_key, cache_variant(&edns, transport, response_size));
+        
+        int cached_len = response_cache_lookup(cache, &cache_key, dns_records_generation(),
+                                               buffer, response, response_size);
+        if (cached_len >= 0) {
+            return cached_len;
+        }
+    }
     
     char domain[256];
     unsigned short queryType;
-    char typeString[16];
     int query_len = 0;
     
-    if (parseDNSQuery(buffer, len, domain, sizeof(domain), &queryType, 
-                    typeString, sizeof(typeString), &query_len) != 0) {
+    if (parseDNSQuery(buffer, len, domain, sizeof(domain), &queryType, &query_len) != 0) {
         log_message(LOG_ERROR, "Failed to parse DNS query");
-        return;
+        return -1;
     }
     
-    log_message(LOG_INFO, "Received query for domain: %s, type: %s", domain, typeString);
+    if (!keyed) {
+        edns_status = dns_parse_edns(buffer, len, sizeof(DNSHeader) + query_len, &edns);
+    }
     
     DNSHeader resHeader;
     memset(&resHeader, 0, sizeof(DNSHeader));
@@ -81,209 +219,320 @@ void process_dns_query(int udpSocket, unsigned char *buffer, int len,
     resHeader.rcode = 0;
     resHeader.qdcount = htons(1);
     
-    unsigned char response[DEFAULT_BUFFER_SIZE];
     int response_len = 0;
     
     memcpy(response, &resHeader, sizeof(DNSHeader));
     response_len += sizeof(DNSHeader);
     
-    if (response_len + query_len > sizeof(response)) {
+    if ((size_t)(response_len + query_len) > response_size) {
         log_message(LOG_ERROR, "Response buffer too small");
-        return;
+        return -1;
     }
     
     memcpy(response + response_len, buffer + sizeof(DNSHeader), query_len);
     response_len += query_len;
-    pthread_mutex_lock(&dns_records_mutex);
     
-    DNSRecord *record = resolveRecord(domain, typeString);
+    /* a malformed OPT record gets no OPT back, a later EDNS version gets ours (rfc 6891 6.1.3) */
+    if (edns_status != 0) {
+        log_message(LOG_DEBUG, "Malformed additional records in query for: %s", domain);
+        edns.present = 0;
+        return finish_response(response, response_len, response_size, &resHeader, &edns, DNS_RCODE_FORMERR);
+    }
+    if (edns.present && edns.version != 0) {
+        return finish_response(response, response_len, response_size, &resHeader, &edns, DNS_RCODE_BADVERS);
+    }
+    
+    const DNSRecordTable *table = dns_table_read_lock();
+    if (table == NULL) {
+        log_message(LOG_ERROR, "No reader slot available for: %s", domain);
+        return finish_response(response, response_len, response_size, &resHeader, &edns, DNS_RCODE_SERVFAIL);
+    }
+    
+    /*
+     * a name the filter rules out gets its NXDOMAIN straight away, with no
+     * lookup, no log line and no cache entry, so a flood of random names
+     * can't evict the cached answers for real ones.
+     */
+    if (!record_table_may_hold(table, domain)) {
+        dns_table_read_unlock();
+        __atomic_store_n(&worker->filtered, worker->filtered + 1, __ATOMIC_RELAXED);
+        
+        return finish_response(response, response_len, response_size, &resHeader, &edns, DNS_RCODE_NXDOMAIN);
+    }
+    
+    log_message(LOG_INFO, "Received query for domain: %s, type: %s", domain, dns_type_name(queryType));
+    
+    const DNSRecord *record = resolveRecord(table, domain, queryType);
     
     if (record == NULL) {
-        resHeader.rcode = DNS_RCODE_NXDOMAIN;
-        resHeader.ancount = htons(0);
         log_message(LOG_INFO, "Resolution failed for: %s", domain);
         
-        memcpy(response, &resHeader, sizeof(DNSHeader));
-        
-        sendto(udpSocket, response, response_len, 0, 
-              (struct sockaddr *)clientAddr, addrLen);
+        response_len = finish_response(response, response_len, response_size, &resHeader, &edns,
+                                       DNS_RCODE_NXDOMAIN);
+        if (cacheable) {
+            response_cache_store(cache, &cache_key, table->generation, response, response_len);
+        }
         
-        pthread_mutex_unlock(&dns_records_mutex);
-        return;
+        dns_table_read_unlock();
+        return response_len;
     }
     
-    resHeader.rcode = DNS_RCODE_NOERROR;
-    resHeader.ancount = htons(record->num_values);
-    resHeader.nscount = htons(0);
-    resHeader.arcount = htons(0);
+    /*
+     * answers were encoded at load time, each only needs the owner name in
+     * front. a name in the rdata is compressed against the question and the
+     * names of the answers before it. they have to fit in the client's limit
+     * with room left for the OPT record.
+     */
+    size_t answer_size = response_limit(&edns, transport, response_size) - (edns.present ? DNS_OPT_SIZE : 0);
+    const unsigned char *answer = record->answers;
+    int name_offset = dns_type_info(record->type_code)->name_offset;
+    int answer_count = 0;
+    size_t offset = response_len;
+    DNSCompressor compressor;
+    dns_compress_init(&compressor, response, sizeof(DNSHeader));
     
     for (int i = 0; i < record->num_values; i++) {
-        if (response_len + 16 > sizeof(response)) {
-            log_message(LOG_ERROR, "Response buffer too small for answer");
+        unsigned short rdlength;
+        memcpy(&rdlength, answer + 8, 2);
+        size_t answer_len = DNS_ANSWER_FIXED_SIZE + ntohs(rdlength);
+        size_t end = offset + 2;   /* past the owner name pointer */
+        
+        /*
+         * an rrset is sent whole or not at all (rfc 2181 9), so a response
+         * that runs out of room goes out with no answers and TC set and the
+         * client retries over tcp.
+         */
+        if (end > answer_size ||
+            dns_compress_answer(&compressor, response, &end, answer_size, answer, answer_len,
+                                name_offset) != 0) {
+            log_message(LOG_DEBUG, "Answers for %s don't fit in %zu bytes, truncated", domain, answer_size);
+            resHeader.tc = 1;
+            answer_count = 0;
+            offset = response_len;
             break;
         }
         
-        unsigned char answer_name[2];
-        answer_name[0] = 0xC0;
-        answer_name[1] = sizeof(DNSHeader);
-        
-        memcpy(response + response_len, answer_name, 2);
-        response_len += 2;
-        
-        unsigned short ans_type;
-        unsigned short ans_class = htons(1);
-        
-        if (strcmp(typeString, "A") == 0)
-            ans_type = htons(DNS_TYPE_A);
-        else if (strcmp(typeString, "AAAA") == 0)
-            ans_type = htons(DNS_TYPE_AAAA);
-        else if (strcmp(typeString, "CNAME") == 0)
-            ans_type = htons(DNS_TYPE_CNAME);
-        else if (strcmp(typeString, "MX") == 0)
-            ans_type = htons(DNS_TYPE_MX);
-        else if (strcmp(typeString, "NS") == 0)
-            ans_type = htons(DNS_TYPE_NS);
-        else if (strcmp(typeString, "TXT") == 0)
-            ans_type = htons(DNS_TYPE_TXT);
-        else if (strcmp(typeString, "SRV") == 0)
-            ans_type = htons(DNS_TYPE_SRV);
-        else
-            ans_type = htons(queryType);
-        
-        memcpy(response + response_len, &ans_type, 2);
-        response_len += 2;
-        
-        memcpy(response + response_len, &ans_class, 2);
-        response_len += 2;
-        
-        unsigned int ttl = htonl(config.default_ttl);
-        memcpy(response + response_len, &ttl, 4);
-        response_len += 4;
-        
-        unsigned short rdlength;
-        
-        if (strcmp(typeString, "A") == 0) {
-            struct in_addr addr;
-            if (inet_aton(record->values[i], &addr) == 0) {
-                log_message(LOG_ERROR, "Invalid IP address: %s", record->values[i]);
-                continue;
-            }
-            
-            if (response_len + 6 > sizeof(response)) {
-                log_message(LOG_ERROR, "Response buffer too small for A record");
-                break;
-            }
-            
-            rdlength = htons(4);
-            memcpy(response + response_len, &rdlength, 2);
-            response_len += 2;
+        response[offset] = 0xC0;
+        response[offset + 1] = sizeof(DNSHeader);
+        offset = end;
+        answer += answer_len;
+        answer_count++;
+    }
+    response_len = offset;
+    
+    /* the addresses of NS, MX and SRV targets were gathered when the record was loaded */
+    if (answer_count > 0 && record->glue_len > 0) {
+        size_t glue_end = response_len;
+        resHeader.arcount = htons(append_glue(&compressor, response, &glue_end, answer_size, record));
+        response_len = glue_end;
+    }
+    
+    resHeader.ancount = htons(answer_count);
+    response_len = finish_response(response, response_len, response_size, &resHeader, &edns, DNS_RCODE_NOERROR);
+    
+    if (cacheable) {
+        response_cache_store(cache, &cache_key, table->generation, response, response_len);
+    }
+    
+    dns_table_read_unlock();
+    
+    log_message(LOG_INFO, "Resolved for: %s, type: %s", domain, dns_type_name(queryType));
+    return response_len;
+}
+
+void process_dns_query(DNSWorker *worker, int udpSocket, unsigned char *buffer, int len, 
+                     unsigned char *response, size_t response_size,
+                     struct sockaddr_in *clientAddr, socklen_t addrLen) {
+    unsigned long long filtered = worker->filtered;
+    int response_len = build_dns_response(worker, buffer, len, response, response_size, DNS_TRANSPORT_UDP);
+    if (response_len < 0) {
+        return;
+    }
+    
+    sendto(udpSocket, response, response_len, 0, 
+          (struct sockaddr *)clientAddr, addrLen);
+    
+    /* answers from the name filter are not logged */
+    if (worker->filtered != filtered) {
+        return;
+    }
+    
+    char client_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &clientAddr->sin_addr, client_ip, sizeof(client_ip));
+    log_message(LOG_INFO, "Response sent to: %s", client_ip);
+}
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "usage: %s [OPTIONS]\n", prog);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -b, --batch SIZE    Datagrams per recvmmsg/sendmmsg call, 1 disables batching (default: %d, max: %d)\n",
+            DEFAULT_BATCH_SIZE, MAX_BATCH_SIZE);
+    fprintf(stderr, "  -w, --workers N     Query worker threads, each with its own SO_REUSEPORT socket, 0 = one per cpu (default: %d)\n",
+            DEFAULT_WORKERS);
+    fprintf(stderr, "  -i, --io BACKEND    UDP I/O backend: epoll or uring (default: epoll)\n");
+    fprintf(stderr, "  -c, --cache-size MB Response cache memory shared out over the workers, 0 disables (default: %d)\n",
+            DEFAULT_CACHE_SIZE_MB);
+    fprintf(stderr, "  -z, --zone-index IX Record index: tree, or compiled for a read-only perfect hash with a write overlay (default: tree)\n");
+    fprintf(stderr, "  -Z, --zone-image FILE   Serve from a zone image mapped read-only instead of the mappings file (implies -z compiled)\n");
+    fprintf(stderr, "  -C, --compile-zone FILE Compile the mappings file into a zone image and exit\n");
+    fprintf(stderr, "  -e, --edns-payload BYTES UDP payload size advertised to EDNS clients and the most a response takes (default: %d, max: %d)\n",
+            DEFAULT_EDNS_PAYLOAD, MAX_EDNS_PAYLOAD);
+    fprintf(stderr, "  -t, --tcp-connections N  Open DNS over TCP connections over all workers, 0 disables TCP (default: %d)\n",
+            DEFAULT_TCP_CONNECTIONS);
+    fprintf(stderr, "  -T, --tcp-idle SECONDS   Close TCP connections idle this long (default: %d)\n",
+            DEFAULT_TCP_IDLE_TIMEOUT);
+    fprintf(stderr, "  -R, --tcp-reuseport      Give every worker its own SO_REUSEPORT TCP listener instead of sharing one\n");
+    fprintf(stderr, "  -v, --verbose       Enable debug logging\n");
+    fprintf(stderr, "  -h, --help          Show this help message\n");
+}
+
+static const char *compile_zone = NULL;
 
-            memcpy(response + response_len, &addr.s_addr, 4);
-            response_len += 4;
-        } 
-        else if (strcmp(typeString, "AAAA") == 0) {
-            struct in6_addr addr6;
-            if (inet_pton(AF_INET6, record->values[i], &addr6) != 1) {
-                log_message(LOG_ERROR, "Invalid IPv6 address: %s", record->values[i]);
-                continue;
+static int parse_arguments(int argc, char *argv[]) {
+    static const struct option long_options[] = {
+        {"batch",   required_argument, NULL, 'b'},
+        {"workers", required_argument, NULL, 'w'},
+        {"io",      required_argument, NULL, 'i'},
+        {"cache-size", required_argument, NULL, 'c'},
+        {"zone-index", required_argument, NULL, 'z'},
+        {"zone-image", required_argument, NULL, 'Z'},
+        {"compile-zone", required_argument, NULL, 'C'},
+        {"edns-payload", required_argument, NULL, 'e'},
+        {"tcp-connections", required_argument, NULL, 't'},
+        {"tcp-idle", required_argument, NULL, 'T'},
+        {"tcp-reuseport", no_argument, NULL, 'R'},
+        {"verbose", no_argument,       NULL, 'v'},
+        {"help",    no_argument,       NULL, 'h'},
+        {NULL,      0,                 NULL, 0}
+    };
+    
+    int opt;
+    while ((opt = getopt_long(argc, argv, "b:w:i:c:z:Z:C:e:t:T:Rvh", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'b':
+            config.batch_size = atoi(optarg);
+            if (config.batch_size < 1 || config.batch_size > MAX_BATCH_SIZE) {
+                fprintf(stderr, "Invalid batch size: %s (must be 1-%d)\n", optarg, MAX_BATCH_SIZE);
+                return -1;
             }
-            
-            if (response_len + 18 > sizeof(response)) {
-                log_message(LOG_ERROR, "Response buffer too small for AAAA record");
-                break;
+            break;
+        case 'w':
+            config.workers = atoi(optarg);
+            if (config.workers < 0 || config.workers > MAX_WORKERS) {
+                fprintf(stderr, "Invalid worker count: %s (must be 0-%d)\n", optarg, MAX_WORKERS);
+                return -1;
             }
-            
-            rdlength = htons(16);
-            memcpy(response + response_len, &rdlength, 2);
-            response_len += 2;
-            
-            memcpy(response + response_len, &addr6.s6_addr, 16);
-            response_len += 16;
-        } 
-        else if (strcmp(typeString, "CNAME") == 0 || strcmp(typeString, "NS") == 0) {
-            unsigned char dns_format[256];
-            int dns_len = domainToDNSFormat(record->values[i], dns_format, sizeof(dns_format));
-            
-            if (dns_len < 0) {
-                log_message(LOG_ERROR, "Failed to encode domain name: %s", record->values[i]);
-                continue;
+            break;
+        case 'i':
+            if (strcmp(optarg, "epoll") == 0) {
+                config.io_backend = IO_BACKEND_EPOLL;
+            } else if (strcmp(optarg, "uring") == 0) {
+                config.io_backend = IO_BACKEND_URING;
+            } else {
+                fprintf(stderr, "Invalid I/O backend: %s (must be epoll or uring)\n", optarg);
+                return -1;
             }
-            
-            if (response_len + 2 + dns_len > sizeof(response)) {
-                log_message(LOG_ERROR, "Response buffer too small for domain name");
-                break;
+            break;
+        case 'c': {
+            long megabytes = atol(optarg);
+            if (megabytes < 0 || megabytes > MAX_CACHE_SIZE_MB) {
+                fprintf(stderr, "Invalid cache size: %s (must be 0-%d MB)\n", optarg, MAX_CACHE_SIZE_MB);
+                return -1;
             }
-            
-            rdlength = htons(dns_len);
-            memcpy(response + response_len, &rdlength, 2);
-            response_len += 2;
-            
-            memcpy(response + response_len, dns_format, dns_len);
-            response_len += dns_len;
-        } 
-        else if (strcmp(typeString, "MX") == 0) {
-            unsigned short preference;
-            char exchange_str[256];
-            
-            if (sscanf(record->values[i], "%hu %255s", &preference, exchange_str) != 2) {
-                log_message(LOG_ERROR, "Invalid MX record format: %s", record->values[i]);
-                continue;
+            config.cache_size = (size_t)megabytes * 1024 * 1024;
+            break;
+        }
+        case 'z':
+            if (strcmp(optarg, "tree") == 0) {
+                config.zone_index = ZONE_INDEX_TREE;
+            } else if (strcmp(optarg, "compiled") == 0) {
+                config.zone_index = ZONE_INDEX_COMPILED;
+            } else {
+                fprintf(stderr, "Invalid zone index: %s (must be tree or compiled)\n", optarg);
+                return -1;
             }
-            
-            preference = htons(preference);
-            
-            unsigned char exchange_dns[256];
-            int exchange_len = domainToDNSFormat(exchange_str, exchange_dns, sizeof(exchange_dns));
-            
-            if (exchange_len < 0) {
-                log_message(LOG_ERROR, "Failed to encode MX exchange: %s", exchange_str);
-                continue;
+            break;
+        case 'e':
+            config.edns_payload = atoi(optarg);
+            if (config.edns_payload < DEFAULT_BUFFER_SIZE || config.edns_payload > MAX_EDNS_PAYLOAD) {
+                fprintf(stderr, "Invalid EDNS payload size: %s (must be %d-%d)\n", optarg,
+                        DEFAULT_BUFFER_SIZE, MAX_EDNS_PAYLOAD);
+                return -1;
             }
-            
-            if (response_len + 4 + exchange_len > sizeof(response)) {
-                log_message(LOG_ERROR, "Response buffer too small for MX record");
-                break;
+            break;
+        case 't':
+            config.tcp_connections = atoi(optarg);
+            if (config.tcp_connections < 0 || config.tcp_connections > MAX_TCP_CONNECTIONS) {
+                fprintf(stderr, "Invalid TCP connection limit: %s (must be 0-%d)\n", optarg, MAX_TCP_CONNECTIONS);
+                return -1;
             }
-            
-            rdlength = htons(2 + exchange_len);
-            memcpy(response + response_len, &rdlength, 2);
-            response_len += 2;
-            
-            memcpy(response + response_len, &preference, 2);
-            response_len += 2;
-            
-            memcpy(response + response_len, exchange_dns, exchange_len);
-            response_len += exchange_len;
-        }
-        else {
-            log_message(LOG_ERROR, "Unsupported query type: %s", typeString);
-            resHeader.rcode = DNS_RCODE_NOTIMP;
-            resHeader.ancount = htons(0);
-            
-            memcpy(response, &resHeader, sizeof(DNSHeader));
-            
-            sendto(udpSocket, response, response_len, 0, 
-                  (struct sockaddr *)clientAddr, addrLen);
-            
-            pthread_mutex_unlock(&dns_records_mutex);
-            return;
+            break;
+        case 'T':
+            config.tcp_idle_timeout = atoi(optarg);
+            if (config.tcp_idle_timeout < 1 || config.tcp_idle_timeout > MAX_TCP_IDLE_TIMEOUT) {
+                fprintf(stderr, "Invalid TCP idle timeout: %s (must be 1-%d seconds)\n", optarg, MAX_TCP_IDLE_TIMEOUT);
+                return -1;
+            }
+            break;
+        case 'R':
+            config.tcp_reuseport = 1;
+            break;
+        case 'Z':
+            free(config.zone_image);
+            config.zone_image = strdup(optarg);
+            break;
+        case 'C':
+            compile_zone = optarg;
+            break;
+        case 'v':
+            config.verbose = 1;
+            break;
+        case 'h':
+        default:
+            print_usage(argv[0]);
+            return -1;
         }
     }
     
-    pthread_mutex_unlock(&dns_records_mutex);
+    if (config.io_backend == IO_BACKEND_URING && !dns_uring_supported()) {
+        log_message(LOG_WARNING, "io_uring is not available on this system, falling back to epoll");
+        config.io_backend = IO_BACKEND_EPOLL;
+    }
     
-    memcpy(response, &resHeader, sizeof(DNSHeader));
+    /* an image holds a compiled zone, writes go to its overlay */
+    if (config.zone_image != NULL) {
+        config.zone_index = ZONE_INDEX_COMPILED;
+    }
     
-    sendto(udpSocket, response, response_len, 0, 
-          (struct sockaddr *)clientAddr, addrLen);
+    if (config.workers == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        config.workers = cpus > 0 ? (cpus < MAX_WORKERS ? cpus : MAX_WORKERS) : 1;
+    }
     
-    log_message(LOG_INFO, "Resolved for: %s, type: %s", domain, typeString);
-    log_message(LOG_INFO, "Response sent to: %s", inet_ntoa(clientAddr->sin_addr));
+    return 0;
 }
 
 int main(int argc, char *argv[]) {
     init_config();
     
+    if (parse_arguments(argc, argv) != 0) {
+        free(config.mappings_file);
+        free(config.zone_image);
+        free(config.auth_token);
+        return 1;
+    }
+    
+    if (compile_zone != NULL) {
+        init_dns_records();
+        int result = compile_zone_image(config.mappings_file, compile_zone);
+        cleanup_dns_records();
+        free(config.mappings_file);
+        free(config.zone_image);
+        free(config.auth_token);
+        return result != 0;
+    }
+    
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
     sa.sa_handler = handle_signal;
@@ -291,18 +540,33 @@ int main(int argc, char *argv[]) {
     sigaction(SIGTERM, &sa, NULL);
     
     log_message(LOG_INFO, "Starting DNS server...");
-    log_message(LOG_INFO, "Loading DNS mappings from %s", config.mappings_file);
+    if (config.zone_image != NULL) {
+        log_message(LOG_INFO, "Mapping zone image %s", config.zone_image);
+    } else {
+        log_message(LOG_INFO, "Loading DNS mappings from %s", config.mappings_file);
+    }
     
     init_dns_records();
     
+    if (init_shutdown_event() != 0) {
+        cleanup_dns_records();
+        return 1;
+    }
+    
     if (loadDNSMappings(config.mappings_file) != 0) {
         log_message(LOG_ERROR, "Failed to load DNS mappings");
         cleanup_dns_records();
         return 1;
     }
     
-    int udpSocket = init_dns_server();
-    if (udpSocket < 0) {
+    /* only the main thread takes SIGINT/SIGTERM, workers inherit the blocked mask */
+    sigset_t block_mask, wait_mask;
+    sigemptyset(&block_mask);
+    sigaddset(&block_mask, SIGINT);
+    sigaddset(&block_mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block_mask, &wait_mask);
+    
+    if (start_dns_workers(config.workers) != 0) {
         log_message(LOG_ERROR, "Failed to initialize DNS server");
         cleanup_dns_records();
         return 1;
@@ -311,65 +575,28 @@ int main(int argc, char *argv[]) {
     pthread_t mgmt_thread_id;
     if (pthread_create(&mgmt_thread_id, NULL, management_thread, NULL) != 0) {
         log_message(LOG_ERROR, "Failed to create management thread: %s", strerror(errno));
-        close(udpSocket);
+        signal_shutdown();
+        stop_dns_workers();
         cleanup_dns_records();
         return 1;
     }
     
-    struct sockaddr_in clientAddr;
-    socklen_t addrLen = sizeof(clientAddr);
-    unsigned char buffer[DEFAULT_BUFFER_SIZE];
-    
-    log_message(LOG_INFO, "DNS server running on port %d", config.dns_port);
+    log_message(LOG_INFO, "DNS server running on port %d with %d worker(s)", config.dns_port, config.workers);
     
     while (running) {
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(udpSocket, &readfds);
-        
-        struct timeval tv;
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
-        
-        int activity = select(udpSocket + 1, &readfds, NULL, NULL, &tv);
-        
-        if (activity < 0 && errno != EINTR) {
-            log_message(LOG_ERROR, "Select error: %s", strerror(errno));
-            continue;
-        }
-        
-        if (activity == 0) {
-            continue;
-        }
-        
-        if (FD_ISSET(udpSocket, &readfds)) {
-            memset(buffer, 0, sizeof(buffer));
-            int len = recvfrom(udpSocket, buffer, sizeof(buffer), 0, 
-                            (struct sockaddr *)&clientAddr, &addrLen);
-            
-            if (len < 0) {
-                if (errno != EAGAIN && errno != EWOULDBLOCK) {
-                    log_message(LOG_ERROR, "recvfrom error: %s", strerror(errno));
-                }
-                continue;
-            }
-            
-            if (len < sizeof(DNSHeader) + 5) {
-                log_message(LOG_WARNING, "Received packet too small to be a valid DNS query");
-                continue;
-            }
-            
-            process_dns_query(udpSocket, buffer, len, &clientAddr, addrLen);
-        }
+        sigsuspend(&wait_mask);
     }
     
-    close(udpSocket);
+    /* the management thread reads worker cache stats, stop it first */
     pthread_join(mgmt_thread_id, NULL);
+    stop_dns_workers();
     cleanup_dns_records();
+    cleanup_shutdown_event();
     
     free(config.mappings_file);
+    free(config.zone_image);
     free(config.auth_token);
     
     log_message(LOG_INFO, "DNS server shutdown complete");
     return 0;
-}
\ No newline at end of file
+}
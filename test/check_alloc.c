@@ -0,0 +1,105 @@
+#include "dns_test_client.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+/*
+ * sends a server built with ALLOC_CHECK=1 every kind of query the hot path
+ * answers: plain udp, EDNS with a larger limit, an unsupported EDNS
+ * version, names that miss, repeats that come from the response cache and
+ * pipelined queries over tcp. the server aborts on the first allocation it
+ * makes while answering, so any query left unanswered fails the check.
+ */
+
+#define CHECK_ROUNDS 3
+#define CHECK_TIMEOUT_MS 2000
+
+static int failures = 0;
+
+static void check_udp(const char *name, unsigned short type, int edns_payload, int edns_version)
+{
+    DNSTestResponse response;
+    
+    if (test_query_udp(name, type, edns_payload, edns_version, CHECK_TIMEOUT_MS, &response) != 0) {
+        fprintf(stderr, "no answer over udp for %s type %u (edns %d, version %d)\n",
+                name, type, edns_payload, edns_version);
+        failures++;
+    }
+}
+
+static void check_tcp(void)
+{
+    static const char *names[] = { "example.com", "foo.example.com", "test.com", "sub.test.com", "missing.org" };
+    static const unsigned short types[] = { 1, 28, 15, 2, 1 };
+    const int count = sizeof(names) / sizeof(names[0]);
+    DNSTestResponse response;
+    
+    int fd = test_tcp_connect();
+    if (fd < 0) {
+        fprintf(stderr, "tcp connect failed\n");
+        failures++;
+        return;
+    }
+    
+    /* everything is written before the first read so the server sees a pipeline */
+    for (int i = 0; i < count; i++) {
+        if (test_tcp_send(fd, (unsigned short)(100 + i), names[i], types[i], i % 2 ? 1232 : 0) != 0) {
+            fprintf(stderr, "tcp send failed for %s\n", names[i]);
+            failures++;
+            close(fd);
+            return;
+        }
+    }
+    
+    for (int i = 0; i < count; i++) {
+        if (test_tcp_receive(fd, CHECK_TIMEOUT_MS, &response) != 0) {
+            fprintf(stderr, "no answer over tcp for query %d of %d\n", i + 1, count);
+            failures++;
+            break;
+        }
+    }
+    
+    close(fd);
+}
+
+int main(void)
+{
+    DNSTestResponse response;
+    int ready = 0;
+    
+    for (int i = 0; i < 50 && !ready; i++) {
+        ready = test_query_udp("example.com", 1, 0, 0, 100, &response) == 0;
+        if (!ready) {
+            usleep(100000);
+        }
+    }
+    if (!ready) {
+        fprintf(stderr, "dns_server did not answer on port %d\n", TEST_DNS_PORT);
+        return 1;
+    }
+    
+    /* the later rounds repeat every query, so they are answered from the cache */
+    for (int round = 0; round < CHECK_ROUNDS; round++) {
+        check_udp("example.com", 1, 0, 0);
+        check_udp("example.com", 28, 0, 0);
+        check_udp("example.com", 15, 0, 0);
+        check_udp("example.com", 2, 0, 0);
+        check_udp("a.b.example.com", 1, 0, 0);
+        check_udp("sub.test.com", 1, 0, 0);
+        check_udp("nope.org", 1, 0, 0);
+        check_udp("Example.COM", 1, 0, 0);
+        check_udp("example.com", 1, 1232, 0);
+        check_udp("example.com", 15, 4096, 0);
+        check_udp("nope.org", 28, 512, 0);
+        check_udp("example.com", 1, 1232, 1);
+        check_tcp();
+    }
+    
+    if (failures > 0) {
+        fprintf(stderr, "%d queries went unanswered\n", failures);
+        return 1;
+    }
+    
+    printf("all queries answered\n");
+    return 0;
+}
@@ -0,0 +1,38 @@
+#!/bin/bash
+
+# runs an ALLOC_CHECK=1 build of the server against test/check_alloc and fails
+# if the server aborted, which it does on any allocation while answering.
+# usage: test/check_alloc.sh SERVER CLIENT [SERVER OPTIONS...]
+
+SERVER="$1"
+CLIENT="$2"
+shift 2
+NAME="dns_server${*:+ $*}"
+
+"$SERVER" "$@" &
+PID=$!
+
+"$CLIENT"
+RESULT=$?
+
+if ! kill -0 "$PID" 2>/dev/null; then
+    wait "$PID"
+    echo "check-alloc: $NAME exited with status $? while answering" >&2
+    exit 1
+fi
+
+kill -INT "$PID"
+wait "$PID"
+STATUS=$?
+
+if [ "$STATUS" -ne 0 ]; then
+    echo "check-alloc: $NAME exited with status $STATUS" >&2
+    exit 1
+fi
+
+if [ "$RESULT" -ne 0 ]; then
+    echo "check-alloc: $NAME left queries unanswered" >&2
+    exit 1
+fi
+
+echo "check-alloc: $NAME made no allocations while answering"
@@ -0,0 +1,384 @@
+#include "dns_test_client.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define TEST_AUTH_TOKEN "123456"
+
+static void loopback_address(struct sockaddr_in *address, int port)
+{
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;
+    address->sin_port = htons(port);
+    address->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+static int wait_readable(int fd, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    
+    int n;
+    do {
+        n = poll(&pfd, 1, timeout_ms);
+    } while (n < 0 && errno == EINTR);
+    
+    return n > 0 ? 0 : -1;
+}
+
+int test_build_query(unsigned char *buf, size_t size, unsigned short id, const char *name,
+                     unsigned short type, int edns_payload, int edns_version)
+{
+    size_t len = 12;
+    
+    if (size < len + 256 + 4 + 11) {
+        return -1;
+    }
+    
+    memset(buf, 0, len);
+    buf[0] = id >> 8;
+    buf[1] = id & 0xff;
+    buf[2] = 0x01;             /* rd */
+    buf[5] = 1;
+    buf[11] = edns_payload > 0 ? 1 : 0;
+    
+    const char *label = name;
+    while (*label != '\0') {
+        const char *dot = strchr(label, '.');
+        size_t label_len = dot != NULL ? (size_t)(dot - label) : strlen(label);
+        if (label_len == 0 || label_len > 63 || len + label_len + 1 > 12 + 255) {
+            return -1;
+        }
+        buf[len++] = (unsigned char)label_len;
+        memcpy(buf + len, label, label_len);
+        len += label_len;
+        label += label_len;
+        if (*label == '.') {
+            label++;
+        }
+    }
+    buf[len++] = 0;
+    
+    buf[len++] = type >> 8;
+    buf[len++] = type & 0xff;
+    buf[len++] = 0;
+    buf[len++] = 1;
+    
+    if (edns_payload > 0) {
+        buf[len++] = 0;        /* root owner */
+        buf[len++] = 0;
+        buf[len++] = 41;
+        buf[len++] = edns_payload >> 8;
+        buf[len++] = edns_payload & 0xff;
+        buf[len++] = 0;        /* extended rcode */
+        buf[len++] = (unsigned char)edns_version;
+        buf[len++] = 0;
+        buf[len++] = 0;
+        buf[len++] = 0;        /* rdlength */
+        buf[len++] = 0;
+    }
+    
+    return (int)len;
+}
+
+/* decodes the possibly compressed name at *offset into out and moves *offset past it */
+static int read_name(const unsigned char *msg, int len, int *offset, char *out, size_t size)
+{
+    int pos = *offset;
+    int end = -1;
+    size_t out_len = 0;
+    int jumps = 0;
+    
+    while (pos < len) {
+        unsigned char label_len = msg[pos];
+        
+        if (label_len == 0) {
+            if (end < 0) {
+                end = pos + 1;
+            }
+            break;
+        }
+        
+        if ((label_len & 0xc0) == 0xc0) {
+            if (pos + 1 >= len || ++jumps > 64) {
+                return -1;
+            }
+            if (end < 0) {
+                end = pos + 2;
+            }
+            pos = ((label_len & 0x3f) << 8) | msg[pos + 1];
+            continue;
+        }
+        
+        if (label_len > 63 || pos + 1 + label_len > len || out_len + label_len + 2 > size) {
+            return -1;
+        }
+        if (out_len > 0) {
+            out[out_len++] = '.';
+        }
+        memcpy(out + out_len, msg + pos + 1, label_len);
+        out_len += label_len;
+        pos += 1 + label_len;
+    }
+    
+    if (end < 0) {
+        return -1;
+    }
+    
+    out[out_len] = '\0';
+    *offset = end;
+    return 0;
+}
+
+static int read_record(const unsigned char *msg, int len, int *offset, DNSTestRecord *record)
+{
+    if (read_name(msg, len, offset, record->name, sizeof(record->name)) != 0 || *offset + 10 > len) {
+        return -1;
+    }
+    
+    const unsigned char *p = msg + *offset;
+    record->type = (p[0] << 8) | p[1];
+    record->rclass = (p[2] << 8) | p[3];
+    record->ttl = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7];
+    record->rdlength = (p[8] << 8) | p[9];
+    
+    if (*offset + 10 + record->rdlength > len) {
+        return -1;
+    }
+    record->rdata = p + 10;
+    *offset += 10 + record->rdlength;
+    return 0;
+}
+
+int test_parse_response(DNSTestResponse *response)
+{
+    const unsigned char *msg = response->data;
+    int len = response->len;
+    
+    if (len < 12) {
+        return -1;
+    }
+    
+    response->id = (msg[0] << 8) | msg[1];
+    response->tc = (msg[2] >> 1) & 1;
+    response->rcode = msg[3] & 0x0f;
+    response->qdcount = (msg[4] << 8) | msg[5];
+    response->ancount = (msg[6] << 8) | msg[7];
+    response->nscount = (msg[8] << 8) | msg[9];
+    response->arcount = (msg[10] << 8) | msg[11];
+    response->has_opt = 0;
+    response->opt_payload = 0;
+    response->opt_version = 0;
+    response->answer_count = 0;
+    response->additional_count = 0;
+    
+    int offset = 12;
+    char qname[256];
+    for (int i = 0; i < response->qdcount; i++) {
+        if (read_name(msg, len, &offset, qname, sizeof(qname)) != 0 || offset + 4 > len) {
+            return -1;
+        }
+        offset += 4;
+    }
+    
+    DNSTestRecord record;
+    for (int i = 0; i < response->ancount; i++) {
+        if (read_record(msg, len, &offset, &record) != 0) {
+            return -1;
+        }
+        if (response->answer_count < TEST_MAX_RECORDS) {
+            response->answers[response->answer_count++] = record;
+        }
+    }
+    
+    for (int i = 0; i < response->nscount; i++) {
+        if (read_record(msg, len, &offset, &record) != 0) {
+            return -1;
+        }
+    }
+    
+    for (int i = 0; i < response->arcount; i++) {
+        if (read_record(msg, len, &offset, &record) != 0) {
+            return -1;
+        }
+        if (record.type == 41) {
+            response->has_opt = 1;
+            response->opt_payload = record.rclass;
+            response->rcode |= (int)(record.ttl >> 24) << 4;
+            response->opt_version = (record.ttl >> 16) & 0xff;
+        } else if (response->additional_count < TEST_MAX_RECORDS) {
+            response->additional[response->additional_count++] = record;
+        }
+    }
+    
+    return offset == len ? 0 : -1;
+}
+
+int test_exchange_udp(const unsigned char *query, int query_len, int timeout_ms, DNSTestResponse *response)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    struct sockaddr_in address;
+    loopback_address(&address, TEST_DNS_PORT);
+    
+    int result = -1;
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0 &&
+        send(fd, query, query_len, 0) == query_len &&
+        wait_readable(fd, timeout_ms) == 0) {
+        ssize_t n = recv(fd, response->data, sizeof(response->data), 0);
+        if (n > 0) {
+            response->len = (int)n;
+            result = test_parse_response(response);
+        }
+    }
+    
+    close(fd);
+    return result;
+}
+
+int test_query_udp(const char *name, unsigned short type, int edns_payload, int edns_version,
+                   int timeout_ms, DNSTestResponse *response)
+{
+    unsigned char query[512];
+    unsigned short id = (unsigned short)(getpid() ^ type ^ (uintptr_t)response);
+    int query_len = test_build_query(query, sizeof(query), id, name, type, edns_payload, edns_version);
+    if (query_len < 0) {
+        return -1;
+    }
+    
+    if (test_exchange_udp(query, query_len, timeout_ms, response) != 0) {
+        return -1;
+    }
+    return response->id == id ? 0 : -1;
+}
+
+int test_tcp_connect(void)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    struct sockaddr_in address;
+    loopback_address(&address, TEST_DNS_PORT);
+    
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int read_all(int fd, unsigned char *buf, size_t len, int timeout_ms)
+{
+    while (len > 0) {
+        if (wait_readable(fd, timeout_ms) != 0) {
+            return -1;
+        }
+        ssize_t n = recv(fd, buf, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int test_tcp_send(int fd, unsigned short id, const char *name, unsigned short type, int edns_payload)
+{
+    unsigned char frame[2 + 512];
+    int query_len = test_build_query(frame + 2, sizeof(frame) - 2, id, name, type, edns_payload, 0);
+    if (query_len < 0) {
+        return -1;
+    }
+    
+    frame[0] = query_len >> 8;
+    frame[1] = query_len & 0xff;
+    return write_all(fd, frame, 2 + (size_t)query_len);
+}
+
+int test_tcp_receive(int fd, int timeout_ms, DNSTestResponse *response)
+{
+    unsigned char prefix[2];
+    
+    if (read_all(fd, prefix, 2, timeout_ms) != 0) {
+        return -1;
+    }
+    
+    response->len = (prefix[0] << 8) | prefix[1];
+    if (read_all(fd, response->data, (size_t)response->len, timeout_ms) != 0) {
+        return -1;
+    }
+    return test_parse_response(response);
+}
+
+const DNSTestRecord *test_find_answer(const DNSTestResponse *response, unsigned short type)
+{
+    for (int i = 0; i < response->answer_count; i++) {
+        if (response->answers[i].type == type) {
+            return &response->answers[i];
+        }
+    }
+    return NULL;
+}
+
+int test_management(const char *command, char *buf, size_t size)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    
+    struct sockaddr_in address;
+    loopback_address(&address, TEST_MANAGEMENT_PORT);
+    
+    char line[1024];
+    int line_len = snprintf(line, sizeof(line), "%s %s\n", TEST_AUTH_TOKEN, command);
+    if (line_len < 0 || (size_t)line_len >= sizeof(line) ||
+        connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        write_all(fd, (const unsigned char *)line, (size_t)line_len) != 0) {
+        close(fd);
+        return -1;
+    }
+    
+    size_t used = 0;
+    while (used + 1 < size && wait_readable(fd, 5000) == 0) {
+        ssize_t n = recv(fd, buf + used, size - 1 - used, 0);
+        if (n <= 0) {
+            break;
+        }
+        used += (size_t)n;
+    }
+    buf[used] = '\0';
+    
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,78 @@
+#ifndef DNS_TEST_CLIENT_H
+#define DNS_TEST_CLIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * a minimal dns client for driving a running dns_server from the tests.
+ * queries go to 127.0.0.1 on the server's default port, over udp or over
+ * tcp with the two byte length framing, and responses are decoded into
+ * their header fields and answer and additional records.
+ */
+
+#define TEST_DNS_PORT 2053
+#define TEST_MANAGEMENT_PORT 8053
+#define TEST_MAX_MESSAGE 65535
+#define TEST_MAX_RECORDS 64
+
+typedef struct
+{
+    char name[256];
+    unsigned short type;
+    unsigned short rclass;
+    uint32_t ttl;
+    unsigned short rdlength;
+    const unsigned char *rdata;
+} DNSTestRecord;
+
+typedef struct
+{
+    unsigned char data[TEST_MAX_MESSAGE];
+    int len;
+    unsigned short id;
+    int tc;
+    int rcode;                 /* including the extended bits of an OPT record */
+    int qdcount;
+    int ancount;
+    int nscount;
+    int arcount;
+    int has_opt;
+    unsigned short opt_payload;
+    int opt_version;
+    int answer_count;
+    DNSTestRecord answers[TEST_MAX_RECORDS];
+    int additional_count;       /* not counting the OPT record */
+    DNSTestRecord additional[TEST_MAX_RECORDS];
+} DNSTestResponse;
+
+/* query length, or -1. edns_payload 0 sends no OPT record */
+int test_build_query(unsigned char *buf, size_t size, unsigned short id, const char *name,
+                     unsigned short type, int edns_payload, int edns_version);
+
+/* 0 once the response is decoded, -1 if it is malformed */
+int test_parse_response(DNSTestResponse *response);
+
+/* sends a prebuilt query over udp and decodes the answer, 0 or -1 */
+int test_exchange_udp(const unsigned char *query, int query_len, int timeout_ms, DNSTestResponse *response);
+
+/* sends one query over udp and waits up to timeout_ms for the answer */
+int test_query_udp(const char *name, unsigned short type, int edns_payload, int edns_version,
+                   int timeout_ms, DNSTestResponse *response);
+
+/* connected tcp socket or -1 */
+int test_tcp_connect(void);
+
+/* frames a query onto the connection, 0 or -1 */
+int test_tcp_send(int fd, unsigned short id, const char *name, unsigned short type, int edns_payload);
+
+/* reads one framed response, 0 or -1 on timeout, error or a closed connection */
+int test_tcp_receive(int fd, int timeout_ms, DNSTestResponse *response);
+
+/* first answer of the given type, or NULL */
+const DNSTestRecord *test_find_answer(const DNSTestResponse *response, unsigned short type);
+
+/* sends one command to the management interface and reads the reply into buf */
+int test_management(const char *command, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,64 @@
+#!/bin/bash
+
+# runs the test programs one after another against a server loaded with
+# test/test_zone.json. the server reads its mappings from the working
+# directory, so it runs in a scratch directory that holds the zone. a -Z
+# FILE option gets the zone compiled into FILE there first.
+# usage: test/run_tests.sh SERVER TEST... [-- SERVER OPTIONS...]
+
+SERVER="$(realpath "$1")"
+ZONE="$(realpath "$(dirname "$0")/test_zone.json")"
+shift
+
+TESTS=()
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+    TESTS+=("$(realpath "$1")")
+    shift
+done
+[ "$1" = "--" ] && shift
+NAME="dns_server${*:+ $*}"
+
+DIR="$(mktemp -d)"
+trap 'rm -rf "$DIR"' EXIT
+cp "$ZONE" "$DIR/dns_mappings.json"
+cd "$DIR" || exit 1
+
+ARGS=("$@")
+for ((i = 0; i < ${#ARGS[@]} - 1; i++)); do
+    if [ "${ARGS[i]}" = "-Z" ] && ! "$SERVER" --compile-zone "${ARGS[i + 1]}" > compile.log 2>&1; then
+        cat compile.log >&2
+        echo "test: could not compile the zone image for $NAME" >&2
+        exit 1
+    fi
+done
+
+"$SERVER" "$@" > server.log 2>&1 &
+PID=$!
+
+RESULT=0
+for TEST in "${TESTS[@]}"; do
+    "$TEST" || RESULT=1
+done
+
+if ! kill -0 "$PID" 2>/dev/null; then
+    wait "$PID"
+    echo "test: $NAME exited with status $? during the tests" >&2
+    tail -n 20 server.log >&2
+    exit 1
+fi
+
+kill -INT "$PID"
+wait "$PID"
+STATUS=$?
+
+if [ "$STATUS" -ne 0 ]; then
+    echo "test: $NAME exited with status $STATUS" >&2
+    exit 1
+fi
+
+if [ "$RESULT" -ne 0 ]; then
+    echo "test: $NAME failed" >&2
+    exit 1
+fi
+
+echo "test: $NAME passed"
@@ -0,0 +1,67 @@
+#include "test_harness.h"
+
+/*
+ * what the server has always done: answer a name from its base records,
+ * then its subdomain records, then the wildcard of a zone above it, and
+ * take ADD, DELETE and RELOAD over the management port.
+ */
+
+static void check_lookups(void)
+{
+    test_expect_address("example.test", TEST_TYPE_A, "192.0.2.1");
+    test_expect_address("example.test", TEST_TYPE_AAAA, "2001:db8::1");
+    test_expect_address("www.example.test", TEST_TYPE_A, "192.0.2.80");
+    test_expect_address("other.test", TEST_TYPE_A, "192.0.2.10");
+    test_expect_address("ns.other.test", TEST_TYPE_A, "192.0.2.11");
+    
+    /* a wildcard answers with the name that was asked for */
+    test_expect_address("x.example.test", TEST_TYPE_A, "192.0.2.100");
+    test_expect_address("x.example.test", TEST_TYPE_AAAA, "2001:db8::100");
+    
+    test_expect_nxdomain("nope.test", TEST_TYPE_A);
+    test_expect_nxdomain("x.other.test", TEST_TYPE_A);
+    test_expect_nxdomain("www.example.test", TEST_TYPE_MX);
+    test_expect_nxdomain("example", TEST_TYPE_A);
+}
+
+static void check_changes(void)
+{
+    /* an added base record shadows the subdomain one until it is deleted */
+    test_manage("ADD www.example.test A base 192.0.2.81", "SUCCESS");
+    test_expect_address("www.example.test", TEST_TYPE_A, "192.0.2.81");
+    test_manage("DELETE www.example.test A base", "SUCCESS");
+    test_expect_address("www.example.test", TEST_TYPE_A, "192.0.2.80");
+    
+    /* a new name, replaced and then deleted */
+    test_manage("ADD new.other.test A base 192.0.2.12", "SUCCESS");
+    test_expect_address("new.other.test", TEST_TYPE_A, "192.0.2.12");
+    test_manage("ADD new.other.test A base 192.0.2.13", "SUCCESS");
+    test_expect_address("new.other.test", TEST_TYPE_A, "192.0.2.13");
+    test_manage("DELETE new.other.test A base", "SUCCESS");
+    test_expect_nxdomain("new.other.test", TEST_TYPE_A);
+    test_manage("DELETE new.other.test A base", "ERROR");
+    
+    /* a command missing its value and an unknown command are refused */
+    test_manage("ADD new.other.test A base", "ERROR");
+    test_manage("FLUSH", "ERROR");
+    
+    /* the zone is served as loaded after a reload */
+    test_manage("ADD www.example.test A base 192.0.2.81", "SUCCESS");
+    test_manage("RELOAD", "SUCCESS");
+    test_expect_address("www.example.test", TEST_TYPE_A, "192.0.2.80");
+}
+
+int main(void)
+{
+    if (test_wait_ready() != 0) {
+        return 1;
+    }
+    
+    check_lookups();
+    check_changes();
+    
+    /* after every change has been put back the answers are the ones from the start */
+    check_lookups();
+    
+    return test_report("test_baseline");
+}
@@ -0,0 +1,105 @@
+#include "test_harness.h"
+
+/*
+ * EDNS0 over udp: responses are held to 512 bytes, or to the client's OPT
+ * payload size capped at the server's 1232. an rrset that doesn't fit is
+ * dropped with TC set. a later EDNS version gets BADVERS and a broken OPT
+ * record FORMERR.
+ */
+
+/* the payload size dns_server advertises when -e isn't given */
+#define SERVER_PAYLOAD 1232
+
+static void check_limits(void)
+{
+    /* 40 addresses don't fit in 512 bytes */
+    if (test_query("big.example.test", TEST_TYPE_A, 0) == 0) {
+        test_expect(test_response.tc && test_response.ancount == 0 && !test_response.has_opt &&
+                    test_response.len <= 512,
+                    "big rrset without EDNS: tc %d, %d answers, %d bytes", test_response.tc,
+                    test_response.ancount, test_response.len);
+    }
+    
+    if (test_query("big.example.test", TEST_TYPE_A, SERVER_PAYLOAD) == 0) {
+        test_expect(!test_response.tc && test_response.ancount == 40 && test_response.has_opt &&
+                    test_response.opt_payload == SERVER_PAYLOAD && test_response.len <= SERVER_PAYLOAD,
+                    "big rrset with EDNS %d: tc %d, %d answers, opt %d", SERVER_PAYLOAD, test_response.tc,
+                    test_response.ancount, test_response.opt_payload);
+    }
+    
+    if (test_query("big.example.test", TEST_TYPE_A, 512) == 0) {
+        test_expect(test_response.tc && test_response.ancount == 0 && test_response.has_opt &&
+                    test_response.len <= 512,
+                    "big rrset with EDNS 512: tc %d, %d answers", test_response.tc, test_response.ancount);
+    }
+    
+    /* a client limit above the server's is capped at it */
+    if (test_query("huge.example.test", TEST_TYPE_A, 4096) == 0) {
+        test_expect(test_response.tc && test_response.ancount == 0 && test_response.has_opt &&
+                    test_response.opt_payload == SERVER_PAYLOAD,
+                    "huge rrset with EDNS 4096: tc %d, %d answers, opt %d", test_response.tc,
+                    test_response.ancount, test_response.opt_payload);
+    }
+    
+    /* a limit below 512 counts as 512 */
+    if (test_query("example.test", TEST_TYPE_NS, 100) == 0) {
+        test_expect(!test_response.tc && test_response.ancount == 3 && test_response.has_opt,
+                    "small EDNS limit: tc %d, %d answers", test_response.tc, test_response.ancount);
+    }
+    
+    if (test_query("example.test", TEST_TYPE_A, SERVER_PAYLOAD) == 0) {
+        test_expect(test_response.rcode == 0 && test_response.ancount == 1 && test_response.has_opt &&
+                    test_response.opt_version == 0,
+                    "EDNS answer: rcode %d, %d answers, opt %d", test_response.rcode, test_response.ancount,
+                    test_response.has_opt);
+    }
+    
+    if (test_query("nope.test", TEST_TYPE_A, SERVER_PAYLOAD) == 0) {
+        test_expect(test_response.rcode == 3 && test_response.has_opt, "NXDOMAIN with EDNS: rcode %d, opt %d",
+                    test_response.rcode, test_response.has_opt);
+    }
+}
+
+static void check_errors(void)
+{
+    /* a later EDNS version is refused with BADVERS in the OPT record */
+    if (test_query_udp("example.test", TEST_TYPE_A, SERVER_PAYLOAD, 1, TEST_TIMEOUT_MS, &test_response) == 0) {
+        test_expect(test_response.rcode == 16 && test_response.ancount == 0 && test_response.has_opt &&
+                    test_response.opt_version == 0,
+                    "EDNS version 1: rcode %d, %d answers, opt %d", test_response.rcode, test_response.ancount,
+                    test_response.has_opt);
+    } else {
+        test_expect(0, "no answer for EDNS version 1");
+    }
+    
+    /* an OPT record whose rdata runs past the message is a FORMERR without OPT */
+    unsigned char query[512];
+    int len = test_build_query(query, sizeof(query), 4242, "example.test", TEST_TYPE_A, SERVER_PAYLOAD, 0);
+    query[len - 1] = 8;
+    if (test_exchange_udp(query, len, TEST_TIMEOUT_MS, &test_response) == 0) {
+        test_expect(test_response.id == 4242 && test_response.rcode == 1 && test_response.ancount == 0 &&
+                    !test_response.has_opt,
+                    "malformed OPT: rcode %d, %d answers, opt %d", test_response.rcode, test_response.ancount,
+                    test_response.has_opt);
+    } else {
+        test_expect(0, "no answer for a malformed OPT record");
+    }
+    
+    /* and neither error sticks to the next query for the name */
+    if (test_query("example.test", TEST_TYPE_A, SERVER_PAYLOAD) == 0) {
+        test_expect(test_response.rcode == 0 && test_response.ancount == 1,
+                    "EDNS answer after errors: rcode %d, %d answers", test_response.rcode, test_response.ancount);
+    }
+}
+
+int main(void)
+{
+    if (test_wait_ready() != 0) {
+        return 1;
+    }
+    
+    check_limits();
+    check_errors();
+    
+    return test_report("test_edns");
+}
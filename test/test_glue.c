@@ -0,0 +1,146 @@
+#include "test_harness.h"
+
+#include <strings.h>
+
+/*
+ * glue: answers to NS, MX and SRV queries carry the A and AAAA records of
+ * their targets in the additional section, from any zone and from
+ * wildcards, each at the ttl of its own rrset. glue goes in one rrset at a
+ * time while it fits and is left out without setting TC when it doesn't.
+ */
+
+/* additional records for name of type, and whether one of them holds address */
+static int count_additional(const char *name, unsigned short type, const char *address, int *found)
+{
+    int count = 0;
+    *found = 0;
+    
+    for (int i = 0; i < test_response.additional_count; i++) {
+        const DNSTestRecord *record = &test_response.additional[i];
+        if (record->type == type && strcasecmp(record->name, name) == 0) {
+            count++;
+            *found = *found || (address != NULL && test_same_address(record, address));
+        }
+    }
+    return count;
+}
+
+/* checks that the last response glues exactly the one address for name, or none for a NULL address */
+static void expect_glue(const char *name, unsigned short type, const char *address)
+{
+    int found;
+    int count = count_additional(name, type, address, &found);
+    
+    if (address == NULL) {
+        test_expect(count == 0, "unexpected glue for %s type %u", name, type);
+    } else {
+        test_expect(count == 1 && found, "expected glue %s for %s type %u, found %d records", address, name, type,
+                    count);
+    }
+}
+
+static void check_loaded(void)
+{
+    /* every target of the NS rrset gets its A and AAAA, from any zone and from wildcards */
+    if (test_query("example.test", TEST_TYPE_NS, 0) == 0) {
+        test_expect(test_response.ancount == 3 && test_response.additional_count == 5,
+                    "example.test NS: %d answers, %d glue records", test_response.ancount,
+                    test_response.additional_count);
+        expect_glue("ns1.example.test", TEST_TYPE_A, "192.0.2.53");
+        expect_glue("ns1.example.test", TEST_TYPE_AAAA, "2001:db8::53");
+        expect_glue("ns2.example.test", TEST_TYPE_A, "192.0.2.54");
+        expect_glue("ns2.example.test", TEST_TYPE_AAAA, "2001:db8::100");
+        expect_glue("ns.other.test", TEST_TYPE_A, "192.0.2.11");
+        expect_glue("ns.other.test", TEST_TYPE_AAAA, NULL);
+        
+        /* glue carries the ttl of its own rrset */
+        int ok = 1;
+        for (int i = 0; i < test_response.additional_count; i++) {
+            const DNSTestRecord *record = &test_response.additional[i];
+            ok = ok && record->ttl == (strcasecmp(record->name, "ns.other.test") == 0 ? 3600 : 600);
+        }
+        test_expect(ok, "glue ttls of example.test NS");
+    }
+    
+    /* a target named by two MX records is glued once, with the wildcard's AAAA */
+    if (test_query("example.test", TEST_TYPE_MX, 0) == 0) {
+        test_expect(test_response.ancount == 2 && test_response.additional_count == 2,
+                    "example.test MX: %d answers, %d glue records", test_response.ancount,
+                    test_response.additional_count);
+        expect_glue("mail.example.test", TEST_TYPE_A, "192.0.2.25");
+        expect_glue("mail.example.test", TEST_TYPE_AAAA, "2001:db8::100");
+    }
+    
+    if (test_query("example.test", TEST_TYPE_SRV, 0) == 0) {
+        test_expect(test_response.ancount == 1, "example.test SRV: %d answers", test_response.ancount);
+        expect_glue("sip.example.test", TEST_TYPE_A, "192.0.2.60");
+    }
+    
+    if (test_query("example.test", TEST_TYPE_A, 0) == 0) {
+        test_expect(test_response.arcount == 0, "example.test A: %d additional records", test_response.arcount);
+    }
+    
+    /* glue that doesn't fit is left out, without TC, and sent when the limit allows */
+    if (test_query("deleg.example.test", TEST_TYPE_NS, 0) == 0) {
+        test_expect(!test_response.tc && test_response.ancount == 1 && test_response.arcount == 0,
+                    "deleg NS without EDNS: tc %d, %d answers, %d additional", test_response.tc,
+                    test_response.ancount, test_response.arcount);
+    }
+    if (test_query("deleg.example.test", TEST_TYPE_NS, 1232) == 0) {
+        int found;
+        test_expect(!test_response.tc && test_response.ancount == 1 &&
+                    count_additional("big.example.test", TEST_TYPE_A, "198.51.100.40", &found) == 40 && found,
+                    "deleg NS with EDNS: tc %d, %d answers, %d glue records", test_response.tc,
+                    test_response.ancount, test_response.additional_count);
+    }
+}
+
+static void check_changes(void)
+{
+    /* glue follows changes to the targets' addresses */
+    test_manage("ADD ns2.example.test AAAA subdomain 2001:db8::54", "SUCCESS");
+    if (test_query("example.test", TEST_TYPE_NS, 0) == 0) {
+        expect_glue("ns2.example.test", TEST_TYPE_AAAA, "2001:db8::54");
+    }
+    test_manage("DELETE ns2.example.test AAAA subdomain", "SUCCESS");
+    if (test_query("example.test", TEST_TYPE_NS, 0) == 0) {
+        expect_glue("ns2.example.test", TEST_TYPE_AAAA, "2001:db8::100");
+    }
+    
+    test_manage("DELETE ns.other.test A subdomain", "SUCCESS");
+    if (test_query("example.test", TEST_TYPE_NS, 0) == 0) {
+        test_expect(test_response.additional_count == 4, "example.test NS: %d glue records",
+                    test_response.additional_count);
+        expect_glue("ns.other.test", TEST_TYPE_A, NULL);
+    }
+    test_manage("ADD ns.other.test A subdomain 192.0.2.11", "SUCCESS");
+    if (test_query("example.test", TEST_TYPE_NS, 0) == 0) {
+        expect_glue("ns.other.test", TEST_TYPE_A, "192.0.2.11");
+    }
+    
+    /* a new NS rrset gets glue for targets already in the zone */
+    test_manage("ADD sub.other.test NS base ns1.example.test", "SUCCESS");
+    if (test_query("sub.other.test", TEST_TYPE_NS, 0) == 0) {
+        expect_glue("ns1.example.test", TEST_TYPE_A, "192.0.2.53");
+        expect_glue("ns1.example.test", TEST_TYPE_AAAA, "2001:db8::53");
+    }
+    test_manage("DELETE sub.other.test NS base", "SUCCESS");
+}
+
+int main(void)
+{
+    if (test_wait_ready() != 0) {
+        return 1;
+    }
+    
+    check_loaded();
+    check_changes();
+    check_loaded();
+    
+    /* and the loaded glue is back after a reload */
+    test_manage("ADD ns2.example.test AAAA subdomain 2001:db8::54", "SUCCESS");
+    test_manage("RELOAD", "SUCCESS");
+    check_loaded();
+    
+    return test_report("test_glue");
+}
@@ -0,0 +1,106 @@
+#include "test_harness.h"
+
+#include <arpa/inet.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+DNSTestResponse test_response;
+
+static int checks = 0;
+static int failures = 0;
+
+int test_wait_ready(void)
+{
+    char reply[512];
+    
+    /* the management port opens after the workers, so wait for both */
+    for (int i = 0; i < 50; i++) {
+        if (test_query_udp("example.test", TEST_TYPE_A, 0, 0, 100, &test_response) == 0 &&
+            test_management("STATS", reply, sizeof(reply)) == 0) {
+            return 0;
+        }
+        usleep(100000);
+    }
+    
+    fprintf(stderr, "dns_server did not answer on ports %d and %d\n", TEST_DNS_PORT, TEST_MANAGEMENT_PORT);
+    return -1;
+}
+
+void test_expect(int ok, const char *format, ...)
+{
+    checks++;
+    if (ok) {
+        return;
+    }
+    
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "FAIL: ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    failures++;
+}
+
+int test_query(const char *name, unsigned short type, int edns_payload)
+{
+    int result = test_query_udp(name, type, edns_payload, 0, TEST_TIMEOUT_MS, &test_response);
+    test_expect(result == 0, "no answer over udp for %s type %u", name, type);
+    return result;
+}
+
+void test_manage(const char *command, const char *expected)
+{
+    char reply[512];
+    
+    int result = test_management(command, reply, sizeof(reply));
+    test_expect(result == 0 && strncmp(reply, expected, strlen(expected)) == 0,
+                "%s: expected %s, got %s", command, expected, result == 0 ? reply : "no reply");
+}
+
+int test_same_address(const DNSTestRecord *record, const char *text)
+{
+    unsigned char address[16];
+    int family = record->type == TEST_TYPE_AAAA ? AF_INET6 : AF_INET;
+    size_t size = record->type == TEST_TYPE_AAAA ? 16 : 4;
+    
+    return record->rdlength == size && inet_pton(family, text, address) == 1 &&
+           memcmp(record->rdata, address, size) == 0;
+}
+
+void test_expect_address(const char *name, unsigned short type, const char *address)
+{
+    if (test_query(name, type, 0) != 0) {
+        return;
+    }
+    
+    const DNSTestRecord *answer = test_find_answer(&test_response, type);
+    test_expect(test_response.rcode == 0 && test_response.ancount == 1 && answer != NULL &&
+                test_same_address(answer, address) && strcasecmp(answer->name, name) == 0,
+                "%s type %u: expected %s (rcode %d, %d answers)", name, type, address,
+                test_response.rcode, test_response.ancount);
+}
+
+void test_expect_nxdomain(const char *name, unsigned short type)
+{
+    if (test_query(name, type, 0) != 0) {
+        return;
+    }
+    test_expect(test_response.rcode == 3 && test_response.ancount == 0,
+                "%s type %u: expected NXDOMAIN (rcode %d, %d answers)", name, type,
+                test_response.rcode, test_response.ancount);
+}
+
+int test_report(const char *program)
+{
+    if (failures > 0) {
+        fprintf(stderr, "%s: %d of %d checks failed\n", program, failures, checks);
+        return 1;
+    }
+    
+    printf("%s: all %d checks passed\n", program, checks);
+    return 0;
+}
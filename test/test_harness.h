@@ -0,0 +1,46 @@
+#ifndef TEST_HARNESS_H
+#define TEST_HARNESS_H
+
+#include "dns_test_client.h"
+
+/*
+ * the checks every test program is built from. each program runs against
+ * a dns_server loaded with test/test_zone.json, puts back whatever it
+ * changes and prints one line per failed check.
+ */
+
+#define TEST_TIMEOUT_MS 2000
+
+#define TEST_TYPE_A 1
+#define TEST_TYPE_NS 2
+#define TEST_TYPE_MX 15
+#define TEST_TYPE_AAAA 28
+#define TEST_TYPE_SRV 33
+
+/* the last response test_query decoded, too big for the stack of every check */
+extern DNSTestResponse test_response;
+
+/* 0 once the server answers on the dns and the management port, -1 if it never does */
+int test_wait_ready(void);
+
+/* counts a check and prints the message if it failed */
+void test_expect(int ok, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/* queries over udp into test_response, 0 or -1 after a failed check */
+int test_query(const char *name, unsigned short type, int edns_payload);
+
+/* sends a management command and checks that the reply starts with expected */
+void test_manage(const char *command, const char *expected);
+
+/* whether an A or AAAA record holds the address given as text */
+int test_same_address(const DNSTestRecord *record, const char *text);
+
+/* checks that the name answers with exactly the one address */
+void test_expect_address(const char *name, unsigned short type, const char *address);
+
+void test_expect_nxdomain(const char *name, unsigned short type);
+
+/* exit status for main, with a summary line */
+int test_report(const char *program);
+
+#endif
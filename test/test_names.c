@@ -0,0 +1,74 @@
+#include "test_harness.h"
+
+/*
+ * lookups through the name tree: a wildcard of the right type is found at
+ * any depth below its apex, the deepest one wins, and a name that exists
+ * without the type still falls back to it.
+ */
+
+static void check_wildcards(void)
+{
+    test_expect_address("a.b.example.test", TEST_TYPE_AAAA, "2001:db8::100");
+    test_expect_address("a.b.c.d.e.f.g.h.i.j.k.l.example.test", TEST_TYPE_A, "192.0.2.100");
+    
+    /* an existing name without the type */
+    test_expect_address("www.example.test", TEST_TYPE_AAAA, "2001:db8::100");
+    test_expect_address("deep.example.test", TEST_TYPE_AAAA, "2001:db8::100");
+    
+    /* the deepest wildcard wins, but never answers for its own apex */
+    test_expect_address("x.deep.example.test", TEST_TYPE_A, "192.0.2.200");
+    test_expect_address("a.b.deep.example.test", TEST_TYPE_A, "192.0.2.200");
+    test_expect_address("deep.example.test", TEST_TYPE_A, "192.0.2.150");
+    
+    /* a deeper wildcard without the type leaves it to the one above */
+    test_expect_address("x.deep.example.test", TEST_TYPE_AAAA, "2001:db8::100");
+    
+    /* wildcards only cover names below their apex, never beside it */
+    test_expect_nxdomain("example.test.other.test", TEST_TYPE_A);
+    test_expect_nxdomain("deep.test", TEST_TYPE_A);
+}
+
+/* queries match names without regard to case, also names added in another case */
+static void check_case(void)
+{
+    test_expect_address("WWW.Example.TEST", TEST_TYPE_A, "192.0.2.80");
+    test_expect_address("X.DEEP.example.test", TEST_TYPE_A, "192.0.2.200");
+    test_expect_nxdomain("NOPE.test", TEST_TYPE_A);
+    
+    test_manage("ADD Case.Other.TEST A base 192.0.2.15", "SUCCESS");
+    test_expect_address("case.other.test", TEST_TYPE_A, "192.0.2.15");
+    test_manage("DELETE Case.Other.TEST A base", "SUCCESS");
+    test_expect_nxdomain("CASE.other.test", TEST_TYPE_A);
+}
+
+static void check_changes(void)
+{
+    /* a wildcard added below another takes over only its own names */
+    test_manage("ADD *.www.example.test A wildcard 192.0.2.201", "SUCCESS");
+    test_expect_address("x.www.example.test", TEST_TYPE_A, "192.0.2.201");
+    test_expect_address("www.example.test", TEST_TYPE_A, "192.0.2.80");
+    test_expect_address("x.example.test", TEST_TYPE_A, "192.0.2.100");
+    test_manage("DELETE *.www.example.test A wildcard", "SUCCESS");
+    test_expect_address("x.www.example.test", TEST_TYPE_A, "192.0.2.100");
+    
+    /* an exact record below a wildcard is answered instead of it */
+    test_manage("ADD y.deep.example.test A base 192.0.2.151", "SUCCESS");
+    test_expect_address("y.deep.example.test", TEST_TYPE_A, "192.0.2.151");
+    test_expect_address("z.y.deep.example.test", TEST_TYPE_A, "192.0.2.200");
+    test_manage("DELETE y.deep.example.test A base", "SUCCESS");
+    test_expect_address("y.deep.example.test", TEST_TYPE_A, "192.0.2.200");
+}
+
+int main(void)
+{
+    if (test_wait_ready() != 0) {
+        return 1;
+    }
+    
+    check_wildcards();
+    check_case();
+    check_changes();
+    check_wildcards();
+    
+    return test_report("test_names");
+}
@@ -0,0 +1,107 @@
+#include "test_harness.h"
+
+#include <stdio.h>
+
+/*
+ * changes on top of the loaded zone. they live in an overlay over the
+ * compiled zone or the shared base until there are enough of them to fold
+ * in, and a DELETE of a loaded record leaves a tombstone that hides it.
+ */
+
+/* more changes than ZONE_OVERLAY_MAX, so the overlay is folded in at least once */
+#define OVERLAY_FOLD_NAMES 300
+
+static void check_tombstones(void)
+{
+    /* deleting a loaded record hides it and lets the wildcard answer */
+    test_manage("DELETE www.example.test A subdomain", "SUCCESS");
+    test_expect_address("www.example.test", TEST_TYPE_A, "192.0.2.100");
+    test_manage("DELETE www.example.test A subdomain", "ERROR");
+    test_manage("ADD www.example.test A subdomain 192.0.2.80", "SUCCESS");
+    test_expect_address("www.example.test", TEST_TYPE_A, "192.0.2.80");
+    
+    /* a loaded name without any records left misses unless a wildcard covers it */
+    test_manage("DELETE ns.other.test A subdomain", "SUCCESS");
+    test_expect_nxdomain("ns.other.test", TEST_TYPE_A);
+    test_manage("ADD ns.other.test A subdomain 192.0.2.11", "SUCCESS");
+    test_expect_address("ns.other.test", TEST_TYPE_A, "192.0.2.11");
+    
+    /* without its wildcard a deeper zone falls back to the one above */
+    test_manage("DELETE *.deep.example.test A wildcard", "SUCCESS");
+    test_expect_address("x.deep.example.test", TEST_TYPE_A, "192.0.2.100");
+    test_expect_address("deep.example.test", TEST_TYPE_A, "192.0.2.150");
+    test_manage("ADD *.deep.example.test A wildcard 192.0.2.200", "SUCCESS");
+    test_expect_address("x.deep.example.test", TEST_TYPE_A, "192.0.2.200");
+    
+    /* a loaded record replaced in the overlay */
+    test_manage("ADD example.test A base 192.0.2.2", "SUCCESS");
+    test_expect_address("example.test", TEST_TYPE_A, "192.0.2.2");
+    test_manage("ADD example.test A base 192.0.2.1", "SUCCESS");
+    test_expect_address("example.test", TEST_TYPE_A, "192.0.2.1");
+}
+
+static void check_overlay_names(void)
+{
+    /* a name only the overlay knows, added and deleted again */
+    test_manage("ADD new.other.test A base 192.0.2.12", "SUCCESS");
+    test_expect_address("new.other.test", TEST_TYPE_A, "192.0.2.12");
+    test_expect_nxdomain("new.other.test", TEST_TYPE_AAAA);
+    test_manage("DELETE new.other.test A base", "SUCCESS");
+    test_expect_nxdomain("new.other.test", TEST_TYPE_A);
+    
+    /* a new wildcard takes over names below it, and goes away again */
+    test_manage("ADD *.other.test A wildcard 192.0.2.14", "SUCCESS");
+    test_expect_address("x.other.test", TEST_TYPE_A, "192.0.2.14");
+    test_expect_address("ns.other.test", TEST_TYPE_A, "192.0.2.11");
+    test_manage("DELETE *.other.test A wildcard", "SUCCESS");
+    test_expect_nxdomain("x.other.test", TEST_TYPE_A);
+}
+
+/* enough changes to fold the overlay in, with a tombstone among them */
+static void check_fold(void)
+{
+    char command[128];
+    char name[64];
+    
+    test_manage("DELETE www.example.test A subdomain", "SUCCESS");
+    for (int i = 0; i < OVERLAY_FOLD_NAMES; i++) {
+        snprintf(command, sizeof(command), "ADD host%d.other.test A base 198.18.%d.%d", i, i / 250, i % 250 + 1);
+        test_manage(command, "SUCCESS");
+    }
+    
+    test_expect_address("host0.other.test", TEST_TYPE_A, "198.18.0.1");
+    test_expect_address("host299.other.test", TEST_TYPE_A, "198.18.1.50");
+    test_expect_address("www.example.test", TEST_TYPE_A, "192.0.2.100");
+    test_expect_address("example.test", TEST_TYPE_A, "192.0.2.1");
+    
+    for (int i = 0; i < OVERLAY_FOLD_NAMES; i++) {
+        snprintf(command, sizeof(command), "DELETE host%d.other.test A base", i);
+        test_manage(command, "SUCCESS");
+    }
+    test_manage("ADD www.example.test A subdomain 192.0.2.80", "SUCCESS");
+    
+    for (int i = 0; i < OVERLAY_FOLD_NAMES; i += 99) {
+        snprintf(name, sizeof(name), "host%d.other.test", i);
+        test_expect_nxdomain(name, TEST_TYPE_A);
+    }
+    test_expect_address("www.example.test", TEST_TYPE_A, "192.0.2.80");
+}
+
+int main(void)
+{
+    if (test_wait_ready() != 0) {
+        return 1;
+    }
+    
+    check_tombstones();
+    check_overlay_names();
+    check_fold();
+    
+    /* the zone is served as loaded after a reload */
+    test_manage("DELETE www.example.test A subdomain", "SUCCESS");
+    test_manage("RELOAD", "SUCCESS");
+    test_expect_address("www.example.test", TEST_TYPE_A, "192.0.2.80");
+    test_expect_address("x.deep.example.test", TEST_TYPE_A, "192.0.2.200");
+    
+    return test_report("test_overlay");
+}
@@ -0,0 +1,129 @@
+#include "test_harness.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * dns over tcp: every query comes with a two byte length in front, however
+ * the client's writes split it up, queries pipelined on one connection are
+ * all answered, and a response is never held to a udp size.
+ */
+
+/* reads the next response off the connection and checks its id, answer count and first address */
+static void expect_tcp_answer(int fd, unsigned short id, int answers, const char *address)
+{
+    if (test_tcp_receive(fd, TEST_TIMEOUT_MS, &test_response) != 0) {
+        test_expect(0, "no tcp answer for query %u", id);
+        return;
+    }
+    test_expect(test_response.id == id && !test_response.tc && test_response.ancount == answers &&
+                test_response.answer_count > 0 && test_same_address(&test_response.answers[0], address),
+                "tcp query %u: id %u, tc %d, %d answers", id, test_response.id, test_response.tc,
+                test_response.ancount);
+}
+
+static int write_bytes(int fd, const unsigned char *buf, size_t len)
+{
+    return send(fd, buf, len, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+
+/* a query with its two byte length in front */
+static int frame_query(unsigned char *frame, size_t size, unsigned short id, const char *name, unsigned short type)
+{
+    int len = test_build_query(frame + 2, size - 2, id, name, type, 0, 0);
+    if (len < 0) {
+        return -1;
+    }
+    frame[0] = len >> 8;
+    frame[1] = len & 0xff;
+    return len + 2;
+}
+
+static void check_pipelining(int fd)
+{
+    /* every query is written before the first answer is read */
+    test_expect(test_tcp_send(fd, 1, "example.test", TEST_TYPE_A, 0) == 0 &&
+                test_tcp_send(fd, 2, "www.example.test", TEST_TYPE_A, 0) == 0 &&
+                test_tcp_send(fd, 3, "huge.example.test", TEST_TYPE_A, 0) == 0 &&
+                test_tcp_send(fd, 4, "x.deep.example.test", TEST_TYPE_A, 1232) == 0, "tcp send failed");
+    expect_tcp_answer(fd, 1, 1, "192.0.2.1");
+    expect_tcp_answer(fd, 2, 1, "192.0.2.80");
+    expect_tcp_answer(fd, 3, 100, "203.0.113.1");
+    expect_tcp_answer(fd, 4, 1, "192.0.2.200");
+    
+    if (test_tcp_send(fd, 5, "nope.test", TEST_TYPE_A, 0) == 0 &&
+        test_tcp_receive(fd, TEST_TIMEOUT_MS, &test_response) == 0) {
+        test_expect(test_response.id == 5 && test_response.rcode == 3, "tcp NXDOMAIN: id %u, rcode %d",
+                    test_response.id, test_response.rcode);
+    } else {
+        test_expect(0, "no tcp answer for query 5");
+    }
+}
+
+static void check_framing(int fd)
+{
+    unsigned char frame[2 * 300];
+    
+    /* a query split across writes, inside the length and inside the message */
+    int len = frame_query(frame, sizeof(frame), 6, "big.example.test", TEST_TYPE_A);
+    test_expect(write_bytes(fd, frame, 1) == 0, "tcp send failed");
+    usleep(50000);
+    test_expect(write_bytes(fd, frame + 1, 6) == 0, "tcp send failed");
+    usleep(50000);
+    test_expect(write_bytes(fd, frame + 7, len - 7) == 0, "tcp send failed");
+    expect_tcp_answer(fd, 6, 40, "198.51.100.1");
+    
+    /* two queries in one write */
+    len = frame_query(frame, sizeof(frame), 7, "mail.example.test", TEST_TYPE_A);
+    len += frame_query(frame + len, sizeof(frame) - len, 8, "ns2.example.test", TEST_TYPE_A);
+    test_expect(write_bytes(fd, frame, len) == 0, "tcp send failed");
+    expect_tcp_answer(fd, 7, 1, "192.0.2.25");
+    expect_tcp_answer(fd, 8, 1, "192.0.2.54");
+}
+
+/* a length too short for any query ends the connection */
+static void check_bad_length(void)
+{
+    unsigned char frame[2] = { 0, 3 };
+    int fd = test_tcp_connect();
+    if (fd < 0) {
+        test_expect(0, "tcp connect failed");
+        return;
+    }
+    
+    test_expect(write_bytes(fd, frame, sizeof(frame)) == 0, "tcp send failed");
+    test_expect(test_tcp_receive(fd, TEST_TIMEOUT_MS, &test_response) != 0,
+                "a 3 byte query got an answer instead of a closed connection");
+    close(fd);
+}
+
+int main(void)
+{
+    if (test_wait_ready() != 0) {
+        return 1;
+    }
+    
+    int fd = test_tcp_connect();
+    if (fd < 0) {
+        test_expect(0, "tcp connect failed");
+        return test_report("test_tcp");
+    }
+    
+    check_pipelining(fd);
+    check_framing(fd);
+    close(fd);
+    
+    check_bad_length();
+    
+    /* a connection closed mid query doesn't take the server down with it */
+    unsigned char frame[300];
+    fd = test_tcp_connect();
+    if (fd >= 0) {
+        int len = frame_query(frame, sizeof(frame), 9, "example.test", TEST_TYPE_A);
+        write_bytes(fd, frame, len / 2);
+        close(fd);
+    }
+    test_expect_address("example.test", TEST_TYPE_A, "192.0.2.1");
+    
+    return test_report("test_tcp");
+}
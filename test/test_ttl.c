@@ -0,0 +1,87 @@
+#include "test_harness.h"
+
+/*
+ * ttls: a zone's "ttl" applies to its records, wildcards and subdomains, an
+ * rrset's own overrides it, and DEFAULT_TTL covers zones without one. an
+ * ADD without ttl= keeps the ttl of the rrset it replaces, and a new rrset
+ * gets the ttl of the deepest zone its name is in.
+ */
+
+#define DEFAULT_TTL 3600
+
+/* checks the ttl of the first answer for name */
+static void expect_ttl(const char *name, unsigned short type, uint32_t ttl)
+{
+    if (test_query(name, type, 0) != 0) {
+        return;
+    }
+    test_expect(test_response.rcode == 0 && test_response.answer_count > 0 && test_response.answers[0].ttl == ttl,
+                "%s type %u: rcode %d, %d answers, ttl %u instead of %u", name, type, test_response.rcode,
+                test_response.answer_count, test_response.answer_count > 0 ? test_response.answers[0].ttl : 0,
+                ttl);
+}
+
+static void check_loaded(void)
+{
+    expect_ttl("example.test", TEST_TYPE_A, 600);
+    expect_ttl("example.test", TEST_TYPE_AAAA, 120);
+    expect_ttl("www.example.test", TEST_TYPE_A, 600);
+    expect_ttl("x.example.test", TEST_TYPE_A, 600);
+    expect_ttl("zero.example.test", TEST_TYPE_A, 0);
+    
+    /* a zone's ttl isn't passed on to a zone below it */
+    expect_ttl("deep.example.test", TEST_TYPE_A, DEFAULT_TTL);
+    expect_ttl("x.deep.example.test", TEST_TYPE_A, DEFAULT_TTL);
+    expect_ttl("other.test", TEST_TYPE_A, DEFAULT_TTL);
+}
+
+static void check_changes(void)
+{
+    /* a replaced rrset keeps its ttl unless the ADD names one */
+    test_manage("ADD ttl.example.test A base ttl=300 192.0.2.30", "SUCCESS");
+    expect_ttl("ttl.example.test", TEST_TYPE_A, 300);
+    test_manage("ADD ttl.example.test A base 192.0.2.31", "SUCCESS");
+    expect_ttl("ttl.example.test", TEST_TYPE_A, 300);
+    test_manage("ADD ttl.example.test A base ttl=0 192.0.2.32", "SUCCESS");
+    expect_ttl("ttl.example.test", TEST_TYPE_A, 0);
+    test_manage("DELETE ttl.example.test A base", "SUCCESS");
+    
+    /* a new rrset gets the ttl of the deepest zone it is in */
+    test_manage("ADD ttl.example.test A base 192.0.2.33", "SUCCESS");
+    expect_ttl("ttl.example.test", TEST_TYPE_A, 600);
+    test_manage("DELETE ttl.example.test A base", "SUCCESS");
+    
+    test_manage("ADD TTL.Example.TEST AAAA base 2001:db8::33", "SUCCESS");
+    expect_ttl("ttl.example.test", TEST_TYPE_AAAA, 600);
+    test_manage("DELETE TTL.Example.TEST AAAA base", "SUCCESS");
+    
+    test_manage("ADD ttl.deep.example.test A base 192.0.2.34", "SUCCESS");
+    expect_ttl("ttl.deep.example.test", TEST_TYPE_A, DEFAULT_TTL);
+    test_manage("DELETE ttl.deep.example.test A base", "SUCCESS");
+    
+    test_manage("ADD ttl.nozone.test A base 192.0.2.35", "SUCCESS");
+    expect_ttl("ttl.nozone.test", TEST_TYPE_A, DEFAULT_TTL);
+    test_manage("DELETE ttl.nozone.test A base", "SUCCESS");
+    
+    test_manage("ADD ttl.example.test A base ttl=-1 192.0.2.36", "ERROR");
+    test_manage("ADD ttl.example.test A base ttl=2147483648 192.0.2.36", "ERROR");
+    test_expect_address("ttl.example.test", TEST_TYPE_A, "192.0.2.100");
+}
+
+int main(void)
+{
+    if (test_wait_ready() != 0) {
+        return 1;
+    }
+    
+    check_loaded();
+    check_changes();
+    
+    /* a reload brings back the loaded ttls, and the zones of the reloaded file */
+    test_manage("ADD example.test A base ttl=60 192.0.2.1", "SUCCESS");
+    test_manage("RELOAD", "SUCCESS");
+    check_loaded();
+    check_changes();
+    
+    return test_report("test_ttl");
+}